@@ -24,17 +24,129 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "common/mg_str.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 struct cs_frbuf;
 
-struct cs_frbuf *cs_frbuf_init(const char *fname, uint16_t size);
+/*
+ * When to persist the file header (and flush the file).
+ * Until the header is written, appended records are not visible after
+ * a restart and consumed records will be returned again.
+ */
+struct cs_frbuf_sync_policy {
+  /* Sync after this many records have been appended or consumed, 0 - never. */
+  uint32_t max_records;
+  /*
+   * Sync if this many milliseconds have passed since the first unsynced
+   * change, 0 - never. Only checked when records are appended or consumed,
+   * call cs_frbuf_sync() from a timer for a hard bound.
+   */
+  uint32_t max_ms;
+};
+
+/*
+ * On-disk format of the buffer.
+ * v1: up to 64K, no integrity checks.
+ * v2: 32-bit sizes, per-record CRC and sequence number, double file header.
+ *   On open, records appended after the header was last written are
+ *   recovered and a corrupted record is dropped together with those after it.
+ */
+enum cs_frbuf_format {
+  CS_FRBUF_FORMAT_V1 = 1,
+  CS_FRBUF_FORMAT_V2 = 2,
+};
+
+/*
+ * Open the buffer in fname or create a new v2 one of the given size.
+ * An existing buffer is used in its own format and size, unless it's empty:
+ * then it's created anew, so v1 buffers are converted once drained.
+ */
+struct cs_frbuf *cs_frbuf_init(const char *fname, uint32_t size);
+/* Same, with the format of a new buffer specified. */
+struct cs_frbuf *cs_frbuf_init_format(const char *fname, uint32_t size,
+                                      enum cs_frbuf_format format);
+/* Syncs pending changes, if any, and closes the file. */
 void cs_frbuf_deinit(struct cs_frbuf *b);
-bool cs_frbuf_append(struct cs_frbuf *b, const void *data, uint16_t len);
+/*
+ * Append a record, applying the sync policy. Records longer than the buffer
+ * are truncated; v1 buffers refuse records over 64K, their record header
+ * can't hold the length.
+ */
+bool cs_frbuf_append(struct cs_frbuf *b, const void *data, uint32_t len);
+/*
+ * Get and remove the oldest record, *data is malloc-ed.
+ * Returns its length, 0 if the buffer is empty, negative value on error
+ * (-6: the record is corrupted, it and the records after it are dropped).
+ */
 int cs_frbuf_get(struct cs_frbuf *b, char **data);
 
+/*
+ * Append num records, applying the sync policy once for the whole batch.
+ * Records longer than the buffer are truncated, as with cs_frbuf_append.
+ * Returns the number of records appended; stops at the first empty or
+ * too long (see cs_frbuf_append) record or write error. A failed sync is retried by the next one.
+ */
+int cs_frbuf_append_batch(struct cs_frbuf *b, const struct mg_str *recs,
+                          int num);
+
+/*
+ * Get and remove up to max records, applying the sync policy once for the
+ * whole batch. Each recs[i].p is malloc-ed and must be freed by the caller.
+ * Returns the number of records returned, or a negative value on error if
+ * there were none. A failed sync is retried by the next one.
+ */
+int cs_frbuf_get_batch(struct cs_frbuf *b, struct mg_str *recs, int max);
+
+/*
+ * Read position for at-least-once consumption: records are peeked into
+ * a caller-provided buffer and only removed by cs_frbuf_commit, e.g. once
+ * the server has acknowledged them. If the device restarts before that,
+ * they are returned again. Fields are private.
+ */
+struct cs_frbuf_cursor {
+  uint32_t pos, seq;
+  uint32_t head;
+};
+
+/* Position the cursor at the oldest record. */
+void cs_frbuf_cursor_reset(const struct cs_frbuf *b,
+                           struct cs_frbuf_cursor *c);
+
+/*
+ * Copy up to max records following the cursor into buf and advance the
+ * cursor past them. recs[i] point into buf, records are not removed.
+ * Returns the number of records, 0 if there are none after the cursor,
+ * -2 if the next record does not fit in buf (records can be up to the
+ * buffer size minus the record header long), -6 if it's corrupted (it
+ * and the records after it are dropped), other negative values on read
+ * error.
+ * If records before the cursor have been removed in the meantime (by
+ * cs_frbuf_get or by appends making room), the cursor is reset first.
+ */
+int cs_frbuf_peek(struct cs_frbuf *b, struct cs_frbuf_cursor *c,
+                  struct mg_str *recs, int max, char *buf, size_t buf_size);
+
+/*
+ * Remove records up to the cursor, applying the sync policy.
+ * Records already removed in the meantime are skipped.
+ */
+bool cs_frbuf_commit(struct cs_frbuf *b, const struct cs_frbuf_cursor *c);
+
+/*
+ * Set the sync policy. The default is {.max_records = 1}: the header is
+ * written and the file is flushed after every record.
+ * {0, 0} leaves syncing entirely to cs_frbuf_sync() and cs_frbuf_deinit().
+ */
+void cs_frbuf_set_sync_policy(struct cs_frbuf *b,
+                              const struct cs_frbuf_sync_policy *policy);
+
+/* Write the header and flush the file if there are unsynced changes. */
+bool cs_frbuf_sync(struct cs_frbuf *b);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CS_COMMON_CS_POOL_H_
+#define CS_COMMON_CS_POOL_H_
+
+/*
+ * Fixed-size object pool.
+ *
+ * Objects are carved out of slabs: the first slab holds `prealloc` objects
+ * and is allocated on first use, subsequent slabs of `grow` objects are added
+ * when the pool runs out. Slabs are only returned to the heap on deinit.
+ * If `grow` is 0, the pool does not grow and allocation fails when the first
+ * slab is exhausted.
+ *
+ * The pool is not thread-safe, callers are expected to provide locking.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+struct cs_pool_stats {
+  uint32_t num_total;  /* Number of objects in all the slabs */
+  uint32_t num_used;   /* Number of objects currently allocated */
+  uint32_t max_used;   /* High watermark of num_used */
+  uint32_t num_slabs;  /* Number of slabs allocated */
+  uint32_t num_failed; /* Number of failed allocations */
+};
+
+struct cs_pool_slab;
+
+struct cs_pool {
+  size_t obj_size;
+  uint16_t prealloc;
+  uint16_t grow;
+  void *free_list;
+  struct cs_pool_slab *slabs;
+  struct cs_pool_stats stats;
+};
+
+/* Static initializer, equivalent to cs_pool_init(). */
+#define CS_POOL_INIT(obj_size, prealloc, grow) \
+  { (obj_size), (prealloc), (grow), NULL, NULL, {0, 0, 0, 0, 0} }
+
+void cs_pool_init(struct cs_pool *p, size_t obj_size, uint16_t prealloc,
+                  uint16_t grow);
+void cs_pool_deinit(struct cs_pool *p);
+
+/* Returns a zeroed object or NULL if pool is exhausted. */
+void *cs_pool_alloc(struct cs_pool *p);
+void cs_pool_free(struct cs_pool *p, void *obj);
+
+void cs_pool_get_stats(const struct cs_pool *p, struct cs_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CS_COMMON_CS_POOL_H_ */
@@ -21,27 +21,147 @@
 /* Ring buffer structure */
 
 #include <inttypes.h>
+#include <stdbool.h>
+
+/* Use 32-bit sizes, for buffers larger than 64K. */
+#ifndef CS_RBUF_ENABLE_32BIT
+#define CS_RBUF_ENABLE_32BIT 0
+#endif
+
+/*
+ * Round buffer sizes up to a power of two (or down, if that does not fit
+ * the size type) and wrap pointers by masking instead of comparing.
+ */
+#ifndef CS_RBUF_ENABLE_POW2
+#define CS_RBUF_ENABLE_POW2 0
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+#if CS_RBUF_ENABLE_32BIT
+typedef uint32_t cs_rbuf_size_t;
+#else
+typedef uint16_t cs_rbuf_size_t;
+#endif
+
 typedef struct cs_rbuf {
-  uint16_t size, used, in_flight, avail;
+  cs_rbuf_size_t size, used, in_flight, avail;
   uint8_t *begin, *end;
   uint8_t *head, *tail;
 } cs_rbuf_t;
 
-void cs_rbuf_init(cs_rbuf_t *b, uint16_t size);
+void cs_rbuf_init(cs_rbuf_t *b, cs_rbuf_size_t size);
 void cs_rbuf_deinit(cs_rbuf_t *b);
 void cs_rbuf_clear(cs_rbuf_t *b);
-void cs_rbuf_append(cs_rbuf_t *b, const void *data, uint16_t len);
+void cs_rbuf_append(cs_rbuf_t *b, const void *data, cs_rbuf_size_t len);
 void cs_rbuf_append_one(cs_rbuf_t *b, uint8_t byte);
-uint8_t cs_rbuf_at(cs_rbuf_t *b, uint16_t i);
-uint16_t cs_rbuf_get(cs_rbuf_t *b, uint16_t max, uint8_t **data);
-void cs_rbuf_consume(cs_rbuf_t *b, uint16_t len);
-uint16_t cs_rbuf_contig_tail_space(cs_rbuf_t *b, uint8_t **data);
-void cs_rbuf_advance_tail(cs_rbuf_t *b, uint16_t len);
+uint8_t cs_rbuf_at(cs_rbuf_t *b, cs_rbuf_size_t i);
+cs_rbuf_size_t cs_rbuf_get(cs_rbuf_t *b, cs_rbuf_size_t max, uint8_t **data);
+void cs_rbuf_consume(cs_rbuf_t *b, cs_rbuf_size_t len);
+cs_rbuf_size_t cs_rbuf_contig_tail_space(cs_rbuf_t *b, uint8_t **data);
+void cs_rbuf_advance_tail(cs_rbuf_t *b, cs_rbuf_size_t len);
+
+/*
+ * Copy up to len bytes from the head of the buffer to dst, without removing
+ * them. Returns the number of bytes copied.
+ */
+cs_rbuf_size_t cs_rbuf_peek(const cs_rbuf_t *b, void *dst, cs_rbuf_size_t len);
+
+/*
+ * Like cs_rbuf_peek, but also removes the data from the buffer.
+ * Must not be mixed with cs_rbuf_get / cs_rbuf_consume in progress.
+ */
+cs_rbuf_size_t cs_rbuf_read(cs_rbuf_t *b, void *dst, cs_rbuf_size_t len);
+
+/*
+ * Filling the ring by DMA: a transfer is set up into the contiguous free
+ * space at the tail and data is committed as the transfer's remaining count
+ * goes down, so the DMA engine writes straight into the ring.
+ * Commits race with the consumer and must be serialized with it.
+ */
+typedef struct cs_rbuf_dma {
+  uint8_t *dst;        /* Start of the current transfer, NULL if none. */
+  cs_rbuf_size_t len;  /* Length of the current transfer. */
+  cs_rbuf_size_t done; /* Bytes of the current transfer committed so far. */
+} cs_rbuf_dma_t;
+
+/*
+ * Set up a new transfer into the free space at the tail.
+ * Returns its length, 0 if the ring is full (no transfer is set up).
+ */
+cs_rbuf_size_t cs_rbuf_dma_start(cs_rbuf_t *b, cs_rbuf_dma_t *d);
+
+/*
+ * Commit data received by the current transfer, given the number of bytes
+ * the DMA engine has yet to transfer. Returns the number of new bytes.
+ * Once the transfer is complete, d->dst is reset to NULL.
+ */
+cs_rbuf_size_t cs_rbuf_dma_commit(cs_rbuf_t *b, cs_rbuf_dma_t *d,
+                                  cs_rbuf_size_t remaining);
+
+/*
+ * Single-producer / single-consumer ring buffer.
+ *
+ * Unlike cs_rbuf, this one can be appended to by one context (e.g. an ISR)
+ * while another one (e.g. a task) is consuming, with no locking and without
+ * masking interrupts. The producer only ever writes tail and the consumer
+ * only ever writes head; each publishes its index with a release store and
+ * reads the other's with an acquire load, so data written before an index
+ * update is visible to the other side once it sees the new index.
+ * Indices run over [0, 2 * size) to tell a full buffer from an empty one.
+ *
+ * Producer side: cs_rbuf_spsc_avail, cs_rbuf_spsc_write,
+ * cs_rbuf_spsc_append_one, cs_rbuf_spsc_contig_tail_space,
+ * cs_rbuf_spsc_advance_tail.
+ * Consumer side: cs_rbuf_spsc_used, cs_rbuf_spsc_read, cs_rbuf_spsc_get,
+ * cs_rbuf_spsc_consume.
+ * Init, deinit and clear must not race with either side.
+ */
+typedef struct cs_rbuf_spsc {
+  uint8_t *buf;
+  cs_rbuf_size_t size;
+  uint32_t head; /* Written by the consumer only. */
+  uint32_t tail; /* Written by the producer only. */
+} cs_rbuf_spsc_t;
+
+void cs_rbuf_spsc_init(cs_rbuf_spsc_t *b, cs_rbuf_size_t size);
+void cs_rbuf_spsc_deinit(cs_rbuf_spsc_t *b);
+void cs_rbuf_spsc_clear(cs_rbuf_spsc_t *b);
+
+/* Free space, as seen by the producer. */
+cs_rbuf_size_t cs_rbuf_spsc_avail(const cs_rbuf_spsc_t *b);
+
+/* Append up to len bytes. Returns the number of bytes appended. */
+cs_rbuf_size_t cs_rbuf_spsc_write(cs_rbuf_spsc_t *b, const void *data,
+                                  cs_rbuf_size_t len);
+
+/* Append one byte. Returns false if the buffer is full. */
+bool cs_rbuf_spsc_append_one(cs_rbuf_spsc_t *b, uint8_t byte);
+
+/*
+ * Contiguous free space at the tail, to be filled in place and then
+ * published with cs_rbuf_spsc_advance_tail.
+ */
+cs_rbuf_size_t cs_rbuf_spsc_contig_tail_space(const cs_rbuf_spsc_t *b,
+                                              uint8_t **data);
+void cs_rbuf_spsc_advance_tail(cs_rbuf_spsc_t *b, cs_rbuf_size_t len);
+
+/* Data available, as seen by the consumer. */
+cs_rbuf_size_t cs_rbuf_spsc_used(const cs_rbuf_spsc_t *b);
+
+/* Copy out and remove up to len bytes. Returns the number of bytes read. */
+cs_rbuf_size_t cs_rbuf_spsc_read(cs_rbuf_spsc_t *b, void *dst,
+                                 cs_rbuf_size_t len);
+
+/*
+ * Zero-copy read: returns up to max contiguous bytes at the head, which stay
+ * in the buffer until released with cs_rbuf_spsc_consume.
+ */
+cs_rbuf_size_t cs_rbuf_spsc_get(const cs_rbuf_spsc_t *b, cs_rbuf_size_t max,
+                                uint8_t **data);
+void cs_rbuf_spsc_consume(cs_rbuf_spsc_t *b, cs_rbuf_size_t len);
 
 #ifdef __cplusplus
 }
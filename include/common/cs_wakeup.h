@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CS_COMMON_CS_WAKEUP_H_
+#define CS_COMMON_CS_WAKEUP_H_
+
+/*
+ * Event loop wakeup primitive for POSIX hosts.
+ *
+ * Exposes a file descriptor that becomes readable after cs_wakeup_signal()
+ * and can be added to the poll set of an event loop. On Linux it is an
+ * eventfd, elsewhere a non-blocking pipe. Any number of signals before the
+ * loop gets to run collapse into a single wakeup.
+ *
+ * cs_wakeup_signal() may be called from any thread or from a signal handler.
+ */
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+struct cs_wakeup {
+  int rfd; /* Descriptor to poll for reading */
+  int wfd; /* Descriptor signal writes to, same as rfd for eventfd */
+};
+
+bool cs_wakeup_init(struct cs_wakeup *w);
+
+/*
+ * Like cs_wakeup_init(), but the descriptors are a pair of connected sockets.
+ * For event loops that read the descriptor with recv(), such as mongoose
+ * built without MG_USE_READ_WRITE.
+ */
+bool cs_wakeup_init_socket(struct cs_wakeup *w);
+void cs_wakeup_deinit(struct cs_wakeup *w);
+
+/* Make the descriptor readable. */
+void cs_wakeup_signal(struct cs_wakeup *w);
+
+/* Reset the descriptor to non-readable. Returns true if it was signalled. */
+bool cs_wakeup_drain(struct cs_wakeup *w);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CS_COMMON_CS_WAKEUP_H_ */
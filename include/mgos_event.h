@@ -24,6 +24,7 @@
 #define CS_FW_INCLUDE_MGOS_EVENT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -141,6 +142,25 @@ bool mgos_event_register_base(int base_event_number, const char *name);
  * handlers invoked. */
 int mgos_event_trigger(int ev, void *ev_data);
 
+/* Max size of the event data that can be passed to `mgos_event_post()`. */
+#ifndef MGOS_EVENT_POST_MAX_DATA_LEN
+#define MGOS_EVENT_POST_MAX_DATA_LEN 128
+#endif
+
+/*
+ * Post an event `ev` for deferred delivery from the main event loop.
+ *
+ * `len` bytes at `ev_data` are copied into a preallocated queue and the
+ * handlers receive a pointer to that copy (or NULL if `len` is 0), valid
+ * only for the duration of the handler. No memory is allocated, so this is
+ * safe to call from an ISR (set `from_isr` accordingly) or from another
+ * task. Posted events are delivered in order, in batches.
+ *
+ * Returns false if the queue is full or `len` exceeds
+ * `MGOS_EVENT_POST_MAX_DATA_LEN`.
+ */
+bool mgos_event_post(int ev, const void *ev_data, size_t len, bool from_isr);
+
 /* Event handler signature. */
 typedef void (*mgos_event_handler_t)(int ev, void *ev_data, void *userdata);
 
@@ -112,6 +112,18 @@ typedef uintptr_t mgos_timer_id;
 mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb,
                              void *cb_arg);
 
+/*
+ * Like `mgos_set_timer()`, but allows the timer to fire up to `slack_ms`
+ * milliseconds late.
+ *
+ * Timers whose windows overlap are fired together, on a single wakeup of the
+ * event loop. Use this for timers that do not need to be precise, such as
+ * sensor polling or retries, to reduce the number of wakeups.
+ * `mgos_set_timer()` is equivalent to a `slack_ms` of 0.
+ */
+mgos_timer_id mgos_set_timer_ex(int msecs, int slack_ms, int flags,
+                                timer_callback cb, void *cb_arg);
+
 /*
  * Setup a hardware timer with `usecs` timeout and `cb` as a callback.
  *
@@ -130,6 +142,45 @@ mgos_timer_id mgos_set_hw_timer(int usecs, int flags, timer_callback cb,
  */
 void mgos_clear_timer(mgos_timer_id id);
 
+/*
+ * Number of buckets in the software timer histograms.
+ * Bucket 0 counts values of 0 us, bucket `i` counts values in the
+ * [2^(i-1), 2^i) us range. The last bucket also counts everything above.
+ */
+#define MGOS_TIMERS_STATS_HIST_SIZE 24
+
+/* Software timer statistics, see `mgos_timers_get_stats()`. */
+struct mgos_timers_stats {
+  uint32_t num_wakeups; /* Wakeups that fired at least one timer */
+  uint32_t num_fired;   /* Timer callbacks invoked */
+  uint32_t num_merged;  /* Expirations merged into another one's wakeup */
+
+  /* How late timers fire relative to their deadline (includes slack). */
+  uint32_t lateness_hist[MGOS_TIMERS_STATS_HIST_SIZE];
+  int64_t max_lateness_us;
+
+  /* How long timer callbacks run. */
+  uint32_t duration_hist[MGOS_TIMERS_STATS_HIST_SIZE];
+  int64_t max_duration_us;
+
+  /* Callbacks that exceeded the budget, see `mgos_timers_set_cb_budget()`. */
+  uint32_t num_over_budget;
+};
+
+/* Get software timer statistics. */
+void mgos_timers_get_stats(struct mgos_timers_stats *stats);
+
+/* Reset software timer statistics. */
+void mgos_timers_reset_stats(void);
+
+/*
+ * Report software timer callbacks that run for longer than `budget_us`
+ * microseconds: a warning is logged and `num_over_budget` is incremented.
+ * Long-running callbacks delay other timers and starve the event loop.
+ * 0 disables the check (default).
+ */
+void mgos_timers_set_cb_budget(int budget_us);
+
 /* Get number of seconds since last reboot */
 double mgos_uptime(void);
 
@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "common/mbuf.h"
+#include "common/mg_str.h"
 #include "common/platform.h"
 
 #if CS_PLATFORM == CS_P_CC3200 || CS_PLATFORM == CS_P_CC3220
@@ -62,6 +63,18 @@ enum mgos_uart_parity {
   MGOS_UART_PARITY_ODD = 2,
 };
 
+/*
+ * RX framing mode, see `mgos_uart_set_frame_handler()`.
+ * Frames are delimited at ingest and handed out whole, with the delimiter
+ * removed and SLIP / COBS encoding undone.
+ */
+enum mgos_uart_framing {
+  MGOS_UART_FRAMING_NONE = 0,
+  MGOS_UART_FRAMING_LINE = 1, /* \n-terminated lines, trailing \r dropped */
+  MGOS_UART_FRAMING_SLIP = 2, /* RFC 1055, END (0xC0) delimited */
+  MGOS_UART_FRAMING_COBS = 3, /* COBS, 0x00 delimited */
+};
+
 /* UART stop bits mode */
 enum mgos_uart_stop_bits {
   MGOS_UART_STOP_BITS_1 = 1, /* So that 1 means 1 bit and 2 means 2. */
@@ -75,7 +88,7 @@ struct mgos_uart_config {
   enum mgos_uart_parity parity;       /* Parity. Default: none */
   enum mgos_uart_stop_bits stop_bits; /* Number of stop bits. Default: 1 */
 
-  /* Size of the Rx buffer, default: 256 */
+  /* Size of the Rx buffer (max 65535), default: 256 */
   int rx_buf_size;
   /* Enable flow control for Rx (RTS pin), default: off */
   enum mgos_uart_fc_type rx_fc_type;
@@ -85,11 +98,17 @@ struct mgos_uart_config {
    */
   int rx_linger_micros;
 
-  /* Size of the Tx buffer, default: 256 */
+  /* Size of the Tx buffer (max 65535), default: 256 */
   int tx_buf_size;
   /* Enable flow control for Tx (CTS pin), default: off */
   enum mgos_uart_fc_type tx_fc_type;
 
+  /*
+   * Split RX data into frames for the frame handler, default: none.
+   * A frame must fit in the Rx buffer, longer ones are dropped.
+   */
+  enum mgos_uart_framing rx_framing;
+
   /* Platform-specific configuration options. */
   struct mgos_uart_dev_config dev;
 };
@@ -99,6 +118,8 @@ struct mgos_uart_config {
 
 /*
  * Apply given UART configuration.
+ * Returns false if it is invalid or rejected by the hardware, in which case
+ * the UART keeps its previous configuration and buffers.
  *
  * Example:
  * ```c
@@ -139,22 +160,65 @@ typedef void (*mgos_uart_dispatcher_t)(int uart_no, void *arg);
 void mgos_uart_set_dispatcher(int uart_no, mgos_uart_dispatcher_t cb,
                               void *arg);
 
+/*
+ * UART frame handler signature, see `mgos_uart_set_frame_handler()`.
+ * The frame is in the Rx buffer, which is a ring, so it may be split in two:
+ * `frame[0]` is the first part and `frame[1]` is the rest (possibly empty).
+ * Pointers of empty parts are not NULL.
+ * The data is only valid until the handler returns.
+ */
+typedef void (*mgos_uart_frame_handler_t)(int uart_no,
+                                          const struct mg_str frame[2],
+                                          void *arg);
+
+/*
+ * Set UART frame handler: a callback which gets called from the dispatcher
+ * once for every complete frame received, if `rx_framing` is configured.
+ * Frames are consumed from the input buffer when the handler returns.
+ * Empty lines are delivered, empty SLIP and COBS frames are skipped.
+ * Malformed frames are dropped and counted in `rx_frame_errors`.
+ */
+void mgos_uart_set_frame_handler(int uart_no, mgos_uart_frame_handler_t cb,
+                                 void *arg);
+
 /*
  * Write data to the UART.
  * Note: if there is enough space in the output buffer, the call will return
  * immediately, otherwise it will wait for buffer to drain.
  * If you want the call to not block, check mgos_uart_write_avail() first.
+ * Returns the number of bytes written, which is less than `len` if the
+ * device stopped accepting data, see `mgos_uart_flush`.
  */
 size_t mgos_uart_write(int uart_no, const void *buf, size_t len);
 
+/*
+ * Write `cnt` segments described by `iov` to the UART, back to back.
+ * All the segments are queued under a single lock and the dispatcher is
+ * scheduled once, so this is cheaper than a sequence of `mgos_uart_write`
+ * calls and the data is never interleaved with writes from other tasks
+ * (unless it does not fit in the output buffer).
+ * Like `mgos_uart_write`, blocks if there is not enough space in the
+ * output buffer. Returns the total number of bytes written.
+ */
+size_t mgos_uart_writev(int uart_no, const struct mg_str *iov, int cnt);
+
+/*
+ * Like `mgos_uart_writev`, but does not block: queues as much as fits in
+ * the output buffer and returns the number of bytes queued, which may be
+ * less than the total length of the segments.
+ */
+size_t mgos_uart_writev_nb(int uart_no, const struct mg_str *iov, int cnt);
+
 /* Returns amount of space availabe in the output buffer. */
 size_t mgos_uart_write_avail(int uart_no);
 
 /*
  * Write data to UART, printf style.
- * Note: currently this requires that data is fully rendered in memory before
- * sending. There is no fixed limit as heap allocation is used, but be careful
- * when printing longer strings.
+ * Output is formatted directly into the output buffer if it fits in the
+ * free space there. Output longer than 100 bytes that wraps around the end
+ * of the buffer also needs to fit in the free space at its start.
+ * Otherwise it is rendered in memory first (using heap for strings longer
+ * than 100 bytes) and written like `mgos_uart_write`, which may block.
  */
 int mgos_uart_printf(int uart_no, const char *fmt, ...);
 
@@ -171,13 +235,32 @@ size_t mgos_uart_read_mbuf(int uart_no, struct mbuf *mb, size_t len);
 /* Returns the number of bytes available for reading. */
 size_t mgos_uart_read_avail(int uart_no);
 
+/*
+ * Get the contents of the UART input buffer without copying it.
+ * The buffer is a ring, so data may be split in two: `spans[0]` is filled
+ * with the first part and `spans[1]` with the rest (possibly empty).
+ * Pointers of empty spans are not NULL.
+ * Returns the total number of bytes available, same as
+ * `mgos_uart_read_avail`.
+ * Data remains valid and in place until it is consumed with
+ * `mgos_uart_rx_consume` or `mgos_uart_read`, or the UART is reconfigured.
+ * Like `mgos_uart_read`, this should be called from the main task.
+ */
+size_t mgos_uart_rx_peek(int uart_no, struct mg_str spans[2]);
+
+/* Remove first `len` bytes from the UART input buffer. */
+void mgos_uart_rx_consume(int uart_no, size_t len);
+
 /* Controls whether UART receiver is enabled. */
 void mgos_uart_set_rx_enabled(int uart_no, bool enabled);
 
 /* Returns whether UART receiver is enabled. */
 bool mgos_uart_is_rx_enabled(int uart_no);
 
-/* Flush the UART output buffer - waits for data to be sent. */
+/*
+ * Flush the UART output buffer - waits for data to be sent.
+ * Gives up if the device stops accepting data while waiting for it to drain.
+ */
 void mgos_uart_flush(int uart_no);
 
 /* Schedule a call to dispatcher on the next `mongoose_poll` */
@@ -191,6 +274,8 @@ struct mgos_uart_stats {
   uint32_t rx_bytes;
   uint32_t rx_overflows;
   uint32_t rx_linger_conts;
+  uint32_t rx_frames;
+  uint32_t rx_frame_errors;
 
   uint32_t tx_ints;
   uint32_t tx_bytes;
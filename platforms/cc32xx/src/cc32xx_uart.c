@@ -115,7 +115,7 @@ recv_more:
       uint8_t *data;
       int num_to_get = MIN(mgos_uart_rxb_free(us), irxb->used);
       num_recd = cs_rbuf_get(irxb, num_to_get, &data);
-      mbuf_append(&us->rx_buf, data, num_recd);
+      cs_rbuf_append(&us->rx_buf, data, num_recd);
       cs_rbuf_consume(irxb, num_recd);
       us->stats.rx_bytes += num_recd;
       if (num_recd > 0) recd = true;
@@ -142,13 +142,15 @@ recv_more:
 
 void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
   struct cc32xx_uart_state *ds = (struct cc32xx_uart_state *) us->dev_data;
-  struct mbuf *txb = &us->tx_buf;
+  cs_rbuf_t *txb = &us->tx_buf;
   size_t len = 0;
-  while (len < txb->len && MAP_UARTSpaceAvail(ds->base)) {
-    HWREG(ds->base + UART_O_DR) = *(txb->buf + len);
+  while (txb->used > 0 && MAP_UARTSpaceAvail(ds->base)) {
+    uint8_t *data = NULL;
+    cs_rbuf_get(txb, 1, &data);
+    HWREG(ds->base + UART_O_DR) = *data;
+    cs_rbuf_consume(txb, 1);
     len++;
   }
-  mbuf_remove(txb, len);
   us->stats.tx_bytes += len;
   MAP_UARTIntClear(ds->base, UART_TX_INTS);
 }
@@ -157,7 +159,7 @@ void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
   struct cc32xx_uart_state *ds = (struct cc32xx_uart_state *) us->dev_data;
   uint32_t int_ena = UART_INFO_INTS;
   if (us->rx_enabled && ds->isr_rx_buf.avail > 0) int_ena |= UART_RX_INTS;
-  if (us->tx_buf.len > 0) int_ena |= UART_TX_INTS;
+  if (us->tx_buf.used > 0) int_ena |= UART_TX_INTS;
   MAP_UARTIntEnable(ds->base, int_ena);
 }
 
@@ -111,15 +111,19 @@ IRAM bool adj_rx_fifo_full_thresh(struct mgos_uart_state *us) {
 static IRAM size_t fill_tx_fifo(struct mgos_uart_state *us) {
   struct esp32_uart_state *uds = (struct esp32_uart_state *) us->dev_data;
   int uart_no = us->uart_no;
-  size_t tx_av = us->tx_buf.len - uds->isr_tx_bytes;
+  size_t tx_av = us->tx_buf.used - uds->isr_tx_bytes;
   if (tx_av == 0) return 0;
   size_t fifo_av = UART_TX_FIFO_SIZE - esp32_uart_tx_fifo_len(uart_no);
   if (fifo_av == 0) return 0;
   size_t len = MIN(tx_av, fifo_av);
-  const char *src = us->tx_buf.buf + uds->isr_tx_bytes;
+  /* Note: cs_rbuf functions are not in IRAM, walk the ring directly. */
+  const cs_rbuf_t *txb = &us->tx_buf;
+  const uint8_t *src = txb->head + uds->isr_tx_bytes;
+  if (src >= txb->end) src -= txb->size;
   if (uds->hd) mgos_gpio_write(uds->tx_en_gpio, uds->tx_en_gpio_val);
   for (size_t i = 0; i < len; i++) {
-    esp32_uart_tx_byte(uart_no, src[i]);
+    esp32_uart_tx_byte(uart_no, *src++);
+    if (src >= txb->end) src = txb->begin;
   }
   WRITE_PERI_REG(UART_INT_CLR_REG(uart_no), UART_TX_DONE_INT_CLR);
   return len;
@@ -180,7 +184,7 @@ IRAM NOINSTR static void esp32_handle_uart_int(struct mgos_uart_state *us) {
     if (!us->locked) {
       struct esp32_uart_state *uds = (struct esp32_uart_state *) us->dev_data;
       uds->isr_tx_bytes += fill_tx_fifo(us);
-      tx_av = us->tx_buf.len - uds->isr_tx_bytes;
+      tx_av = us->tx_buf.used - uds->isr_tx_bytes;
     }
     if (tx_av > 0) {
       SET_PERI_REG_MASK(UART_INT_ENA_REG(uart_no), UART_TX_INTS);
@@ -198,7 +202,7 @@ IRAM NOINSTR static void esp32_handle_uart_int(struct mgos_uart_state *us) {
 
 void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
   int uart_no = us->uart_no;
-  struct mbuf *rxb = &us->rx_buf;
+  cs_rbuf_t *rxb = &us->rx_buf;
   uint32_t rxn = 0;
   /* RX */
   if (mgos_uart_rxb_free(us) > 0 && esp32_uart_rx_fifo_len(uart_no) > 0) {
@@ -218,10 +222,8 @@ void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
       size_t rx_len = esp32_uart_rx_fifo_len(uart_no);
       if (rx_len > 0) {
         rx_len = MIN(rx_len, mgos_uart_rxb_free(us));
-        if (rxb->size < rxb->len + rx_len) mbuf_resize(rxb, rxb->len + rx_len);
         while (rx_len > 0) {
-          uint8_t b = rx_byte(uart_no);
-          mbuf_append(rxb, &b, 1);
+          cs_rbuf_append_one(rxb, rx_byte(uart_no));
           rx_len--;
           rxn++;
         }
@@ -247,7 +249,12 @@ void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
   CLEAR_PERI_REG_MASK(UART_INT_ENA_REG(uart_no), UART_TX_INTS);
   uint32_t txn = uds->isr_tx_bytes;
   txn += fill_tx_fifo(us);
-  mbuf_remove(&us->tx_buf, txn);
+  for (uint32_t n = txn; n > 0;) {
+    uint8_t *data = NULL;
+    uint16_t len = cs_rbuf_get(&us->tx_buf, n, &data);
+    cs_rbuf_consume(&us->tx_buf, len);
+    n -= len;
+  }
   uds->isr_tx_bytes = 0;
   us->stats.tx_bytes += txn;
 
@@ -261,7 +268,7 @@ void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
   if (us->rx_enabled && mgos_uart_rxb_free(us) > 0) {
     int_ena |= UART_RX_INTS;
   }
-  if (us->tx_buf.len > 0) {
+  if (us->tx_buf.used > 0) {
     int_ena |= UART_TX_INTS;
   } else if (uds->hd) {
     if (mgos_gpio_read_out(uds->tx_en_gpio) == uds->tx_en_gpio_val) {
@@ -22,6 +22,7 @@
 #include <time.h>
 
 #include "common/cs_dbg.h"
+#include "common/cs_wakeup.h"
 
 #include "mgos_init.h"
 #include "mgos_mongoose_internal.h"
@@ -30,27 +31,42 @@
 
 #include "fw.h"
 
+static struct cs_wakeup s_wakeup = {.rfd = -1, .wfd = -1};
+
+/*
+ * Mongoose reads the wakeup descriptor with recv() unless it's built with
+ * MG_USE_READ_WRITE, so it has to be a socket.
+ */
+static void wakeup_handler(struct mg_connection *nc, int ev, void *ev_data,
+                           void *user_data) {
+  if (ev == MG_EV_RECV) {
+    mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+  } else if (ev == MG_EV_CLOSE) {
+    /* Read end has been closed by mongoose, don't signal a stale fd. */
+    if (s_wakeup.wfd != s_wakeup.rfd) close(s_wakeup.wfd);
+    s_wakeup.rfd = s_wakeup.wfd = -1;
+  }
+  (void) ev_data;
+  (void) user_data;
+}
+
 int main(int argc, char *argv[]) {
   (void) argc;
   (void) argv;
+  if (!cs_wakeup_init_socket(&s_wakeup)) {
+    return EXIT_FAILURE;
+  }
   mongoose_init();
+  mg_add_sock(mgos_get_mgr(), s_wakeup.rfd, wakeup_handler, NULL);
   for (;;) {
     mongoose_poll(1000);
   }
   return EXIT_SUCCESS;
 }
 
-static void dummy_handler(struct mg_connection *nc, int ev, void *ev_data,
-                          void *user_data) {
-  (void) nc;
-  (void) ev;
-  (void) ev_data;
-  (void) user_data;
-}
-
 void mongoose_schedule_poll(bool from_isr) {
   (void) from_isr;
-  mg_broadcast(mgos_get_mgr(), dummy_handler, NULL, 0);
+  if (s_wakeup.wfd >= 0) cs_wakeup_signal(&s_wakeup);
 }
 
 enum mgos_init_result mgos_sys_config_init_platform(struct mgos_config *cfg) {
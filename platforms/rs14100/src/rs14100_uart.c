@@ -168,7 +168,7 @@ void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
     uint8_t *data = NULL;
     uds->regs->IER_b.ERBFI = false;
     uint16_t n = cs_rbuf_get(irxb, rxb_free, &data);
-    mbuf_append(&us->rx_buf, data, n);
+    cs_rbuf_append(&us->rx_buf, data, n);
     cs_rbuf_consume(irxb, n);
   }
   if (irxb->avail > 0) uds->regs->IER_b.ERBFI = us->rx_enabled;
@@ -176,17 +176,20 @@ void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
 
 void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
   struct rs14100_uart_state *uds = (struct rs14100_uart_state *) us->dev_data;
-  struct mbuf *txb = &us->tx_buf;
+  cs_rbuf_t *txb = &us->tx_buf;
   struct cs_rbuf *itxb = &uds->itx_buf;
-  uint16_t n = MIN(txb->len, itxb->avail);
-  if (n > 0) {
+  if (txb->used > 0 && itxb->avail > 0) {
     uds->regs->IER_b.ETBEI = uds->regs->IER_b.PTIME = false;
-    cs_rbuf_append(itxb, txb->buf, n);
+    while (txb->used > 0 && itxb->avail > 0) {
+      uint8_t *data = NULL;
+      uint16_t n = cs_rbuf_get(txb, itxb->avail, &data);
+      cs_rbuf_append(itxb, data, n);
+      cs_rbuf_consume(txb, n);
+    }
   }
   if (itxb->used > 0) {
     uds->regs->IER_b.ETBEI = uds->regs->IER_b.PTIME = true;
   }
-  mbuf_remove(txb, n);
 }
 
 void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
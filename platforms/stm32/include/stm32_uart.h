@@ -18,6 +18,8 @@
 #ifndef CS_FW_PLATFORMS_STM32_INCLUDE_STM32_UART_H_
 #define CS_FW_PLATFORMS_STM32_INCLUDE_STM32_UART_H_
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +30,11 @@ struct stm32_uart_pins {
 
 struct mgos_uart_dev_config {
   struct stm32_uart_pins pins;
+  /*
+   * Receive by DMA, if the UART has a DMA stream assigned.
+   * Recommended for high baud rates. Default: off.
+   */
+  bool rx_dma;
 };
 
 #ifdef __cplusplus
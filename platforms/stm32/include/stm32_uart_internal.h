@@ -26,9 +26,24 @@
 extern "C" {
 #endif
 
+/* DMA stream (F2, F4, F7) or channel (L4) used by a UART. */
+struct stm32_uart_dma_def {
+  DMA_TypeDef *dma;
+#ifdef STM32L4
+  DMA_Channel_TypeDef *ch;
+  DMA_Request_TypeDef *csel;
+#else
+  DMA_Stream_TypeDef *ch;
+#endif
+  uint8_t index; /* Stream (0-7) or channel (1-7) number. */
+  uint8_t sel;   /* Channel (F2, F4, F7) or request (L4) selection. */
+  IRQn_Type irqn;
+};
+
 struct stm32_uart_def {
   USART_TypeDef *regs;
   struct stm32_uart_pins default_pins;
+  struct stm32_uart_dma_def rx_dma; /* .ch is NULL if there is none. */
 };
 
 bool stm32_uart_configure(int uart_no, const struct mgos_uart_config *cfg);
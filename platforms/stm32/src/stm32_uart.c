@@ -27,6 +27,7 @@
 #include "mgos_core_dump.h"
 #include "mgos_debug.h"
 #include "mgos_gpio.h"
+#include "mgos_system.h"
 #include "mgos_uart_hal.h"
 #include "mgos_utils.h"
 
@@ -38,6 +39,11 @@ struct stm32_uart_state {
   volatile USART_TypeDef *regs;
   cs_rbuf_t irx_buf;
   cs_rbuf_t itx_buf;
+  /* RX interrupt: RXNE, or IDLE when receiving by DMA. */
+  uint32_t rx_int;
+  /* RX DMA stream, NULL if RX is interrupt-driven. */
+  const struct stm32_uart_dma_def *rx_dma;
+  cs_rbuf_dma_t rx_dma_xfer;
 };
 
 static struct mgos_uart_state *s_us[MGOS_MAX_NUM_UARTS];
@@ -53,6 +59,7 @@ static inline uint8_t stm32_uart_rx_byte(struct mgos_uart_state *us);
 #if defined(STM32F2) || defined(STM32F4)
 #define ISR SR
 #define USART_ISR_CTSIF USART_SR_CTS
+#define USART_ISR_IDLE USART_SR_IDLE
 #define USART_ISR_ORE USART_SR_ORE
 #define USART_ISR_RXNE USART_SR_RXNE
 #define USART_ISR_TC USART_SR_TC
@@ -67,6 +74,11 @@ static inline void stm32_uart_clear_ovf_int(struct mgos_uart_state *us) {
   CLEAR_BIT(uds->regs->SR, USART_SR_ORE);
   (void) stm32_uart_rx_byte(us);
 }
+static inline void stm32_uart_clear_idle_int(struct stm32_uart_state *uds) {
+  /* Cleared by reading SR followed by DR. */
+  (void) uds->regs->SR;
+  (void) uds->regs->DR;
+}
 #elif defined(USART_ICR_CTSCF) && defined(USART_ICR_ORECF)
 static inline void stm32_uart_clear_cts_int(struct stm32_uart_state *uds) {
   uds->regs->ICR = USART_ICR_CTSCF;
@@ -75,9 +87,15 @@ static inline void stm32_uart_clear_ovf_int(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
   uds->regs->ICR = USART_ICR_ORECF;
 }
+static inline void stm32_uart_clear_idle_int(struct stm32_uart_state *uds) {
+  uds->regs->ICR = USART_ICR_IDLECF;
+}
 #endif
 
 #define UART_ISR_BUF_SIZE 128
+#ifndef UART_DMA_RX_BUF_SIZE
+#define UART_DMA_RX_BUF_SIZE 512
+#endif
 #define UART_ISR_BUF_DISP_THRESH 16
 #define UART_ISR_BUF_XOFF_THRESH 8
 #define USART_ERROR_INTS (USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_PECF);
@@ -109,6 +127,113 @@ static inline void stm32_uart_tx_byte_from_buf(struct mgos_uart_state *us) {
   }
 }
 
+/*
+ * RX DMA.
+ * Transfers go straight into the free space at the tail of irx_buf. Data is
+ * committed when the line goes idle (which flushes partial bursts), when a
+ * transfer completes and when the dispatcher runs. A new transfer is set up
+ * when the previous one completes; if irx_buf is full, DMA is left stopped
+ * until the dispatcher makes room, so the USART holds off the sender (RTS)
+ * or overruns.
+ */
+#ifdef STM32L4
+static inline void stm32_uart_dma_stop(const struct stm32_uart_dma_def *dd) {
+  CLEAR_BIT(dd->ch->CCR, DMA_CCR_EN);
+}
+
+static inline void stm32_uart_dma_clear_flags(
+    const struct stm32_uart_dma_def *dd) {
+  dd->dma->IFCR = (0xfU << ((dd->index - 1) * 4));
+}
+
+static inline uint16_t stm32_uart_dma_remaining(
+    const struct stm32_uart_dma_def *dd) {
+  return dd->ch->CNDTR;
+}
+
+static void stm32_uart_dma_setup(const struct stm32_uart_dma_def *dd,
+                                 volatile void *src, uint8_t *dst,
+                                 uint16_t len) {
+  dd->ch->CPAR = (uint32_t) src;
+  dd->ch->CMAR = (uint32_t) dst;
+  dd->ch->CNDTR = len;
+  dd->ch->CCR = (DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_EN);
+}
+#else
+static inline void stm32_uart_dma_stop(const struct stm32_uart_dma_def *dd) {
+  CLEAR_BIT(dd->ch->CR, DMA_SxCR_EN);
+  while (dd->ch->CR & DMA_SxCR_EN) {
+  }
+}
+
+static inline void stm32_uart_dma_clear_flags(
+    const struct stm32_uart_dma_def *dd) {
+  static const uint8_t shifts[4] = {0, 6, 16, 22};
+  uint32_t flags = (0x3dU << shifts[dd->index & 3]);
+  if (dd->index < 4) {
+    dd->dma->LIFCR = flags;
+  } else {
+    dd->dma->HIFCR = flags;
+  }
+}
+
+static inline uint16_t stm32_uart_dma_remaining(
+    const struct stm32_uart_dma_def *dd) {
+  return dd->ch->NDTR;
+}
+
+static void stm32_uart_dma_setup(const struct stm32_uart_dma_def *dd,
+                                 volatile void *src, uint8_t *dst,
+                                 uint16_t len) {
+  dd->ch->PAR = (uint32_t) src;
+  dd->ch->M0AR = (uint32_t) dst;
+  dd->ch->NDTR = len;
+  dd->ch->CR = (dd->sel * DMA_SxCR_CHSEL_0) | DMA_SxCR_MINC | DMA_SxCR_TCIE |
+               DMA_SxCR_EN;
+}
+#endif
+
+/* Set up the next transfer, if there is space. Ints must be disabled. */
+static void stm32_uart_dma_rx_start(struct mgos_uart_state *us) {
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  const struct stm32_uart_dma_def *dd = uds->rx_dma;
+  uint16_t len = cs_rbuf_dma_start(&uds->irx_buf, &uds->rx_dma_xfer);
+  if (len == 0) return;
+  stm32_uart_dma_stop(dd);
+  stm32_uart_dma_clear_flags(dd);
+  stm32_uart_dma_setup(dd, &uds->regs->RDR, uds->rx_dma_xfer.dst, len);
+}
+
+/*
+ * Commit data received so far to irx_buf and keep DMA going.
+ * Ints must be disabled. Returns true if there is new data.
+ */
+static bool stm32_uart_dma_rx_commit(struct mgos_uart_state *us) {
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  struct cs_rbuf *irxb = &uds->irx_buf;
+  uint16_t n = cs_rbuf_dma_commit(irxb, &uds->rx_dma_xfer,
+                                  stm32_uart_dma_remaining(uds->rx_dma));
+  us->stats.rx_bytes += n;
+  if (uds->rx_dma_xfer.dst == NULL) stm32_uart_dma_rx_start(us);
+  if (us->cfg.rx_fc_type == MGOS_UART_FC_SW &&
+      irxb->avail < UART_ISR_BUF_XOFF_THRESH && !us->xoff_sent) {
+    stm32_uart_tx_byte(us, MGOS_UART_XOFF_CHAR);
+    us->xoff_sent = true;
+  }
+  return (n > 0);
+}
+
+static void stm32_uart_dma_isr(struct mgos_uart_state *us) {
+  if (us == NULL) return;
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  if (uds->rx_dma == NULL) return;
+  us->stats.rx_ints++;
+  stm32_uart_dma_clear_flags(uds->rx_dma);
+  if (stm32_uart_dma_rx_commit(us)) {
+    mgos_uart_schedule_dispatcher(us->uart_no, true /* from_isr */);
+  }
+}
+
 void stm32_uart_putc(int uart_no, char c) {
   if (uart_no < 0 || uart_no >= MGOS_MAX_NUM_UARTS) return;
   stm32_uart_tx_byte(s_us[uart_no], c);
@@ -183,6 +308,12 @@ static void stm32_uart_isr(struct mgos_uart_state *us) {
       dispatch = true;
     }
   }
+  if ((ints & USART_ISR_IDLE) && (cr1 & USART_CR1_IDLEIE)) {
+    /* Line went idle, flush the partial DMA burst. */
+    stm32_uart_clear_idle_int(uds);
+    us->stats.rx_ints++;
+    if (uds->rx_dma != NULL && stm32_uart_dma_rx_commit(us)) dispatch = true;
+  }
 #ifdef USART_ISR_RTOF
   if ((ints & USART_ISR_RTOF) && (cr1 & USART_CR1_RTOIE)) {
     if (uds->irx_buf.used > 0) dispatch = true;
@@ -230,15 +361,75 @@ void stm32_uart8_int_handler(void) {
 }
 #endif
 
+void stm32_uart1_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[1]);
+}
+void stm32_uart2_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[2]);
+}
+void stm32_uart3_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[3]);
+}
+#ifdef UART4
+void stm32_uart4_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[4]);
+}
+#endif
+#ifdef UART5
+void stm32_uart5_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[5]);
+}
+#endif
+#ifdef USART6
+void stm32_uart6_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[6]);
+}
+#endif
+#ifdef UART7
+void stm32_uart7_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[7]);
+}
+#endif
+#ifdef UART8
+void stm32_uart8_dma_int_handler(void) {
+  stm32_uart_dma_isr(s_us[8]);
+}
+#endif
+
+static void stm32_uart_dma_rx_top(struct mgos_uart_state *us) {
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  struct cs_rbuf *irxb = &uds->irx_buf;
+  size_t rxb_free;
+  mgos_ints_disable();
+  /* Pick up what has arrived since the last idle or transfer completion. */
+  stm32_uart_dma_rx_commit(us);
+  while (irxb->used > 0 && (rxb_free = mgos_uart_rxb_free(us)) > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(irxb, rxb_free, &data);
+    mgos_ints_enable();
+    /* DMA only writes to the free space, this part can be copied out. */
+    cs_rbuf_append(&us->rx_buf, data, n);
+    mgos_ints_disable();
+    cs_rbuf_consume(irxb, n);
+  }
+  /* If irx_buf was full, DMA is stopped. Now there may be space again. */
+  if (uds->rx_dma_xfer.dst == NULL) stm32_uart_dma_rx_start(us);
+  mgos_ints_enable();
+}
+
 void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
   size_t rxb_free;
   struct cs_rbuf *irxb = &uds->irx_buf;
+  if (uds->rx_dma != NULL) {
+    stm32_uart_dma_rx_top(us);
+    return;
+  }
   while (irxb->used > 0 && (rxb_free = mgos_uart_rxb_free(us)) > 0) {
     uint8_t *data = NULL;
     CLEAR_BIT(uds->regs->CR1, USART_CR1_RXNEIE);
     uint16_t n = cs_rbuf_get(irxb, rxb_free, &data);
-    mbuf_append(&us->rx_buf, data, n);
+    cs_rbuf_append(&us->rx_buf, data, n);
     cs_rbuf_consume(irxb, n);
   }
   if (irxb->avail > 0 && us->rx_enabled) {
@@ -248,20 +439,23 @@ void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
 
 void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
-  struct mbuf *txb = &us->tx_buf;
+  cs_rbuf_t *txb = &us->tx_buf;
   struct cs_rbuf *itxb = &uds->itx_buf;
-  uint16_t n = MIN(txb->len, itxb->avail);
-  if (n > 0) {
+  if (txb->used > 0 && itxb->avail > 0) {
     CLEAR_BIT(uds->regs->CR1, USART_CR1_TXEIE);
-    cs_rbuf_append(itxb, txb->buf, n);
+    while (txb->used > 0 && itxb->avail > 0) {
+      uint8_t *data = NULL;
+      uint16_t n = cs_rbuf_get(txb, itxb->avail, &data);
+      cs_rbuf_append(itxb, data, n);
+      cs_rbuf_consume(txb, n);
+    }
   }
   if (itxb->used > 0) SET_BIT(uds->regs->CR1, USART_CR1_TXEIE);
-  mbuf_remove(txb, n);
 }
 
 void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
-  if (us->rx_enabled && uds->irx_buf.avail > 0) {
+  if (us->rx_enabled && uds->rx_dma == NULL && uds->irx_buf.avail > 0) {
     SET_BIT(uds->regs->CR1, USART_CR1_RXNEIE);
   }
   if (uds->itx_buf.used > 0) {
@@ -283,9 +477,9 @@ void mgos_uart_hal_flush_fifo(struct mgos_uart_state *us) {
 void mgos_uart_hal_set_rx_enabled(struct mgos_uart_state *us, bool enabled) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
   if (enabled) {
-    SET_BIT(uds->regs->CR1, (USART_CR1_RE | USART_CR1_RXNEIE));
+    SET_BIT(uds->regs->CR1, (USART_CR1_RE | uds->rx_int));
   } else {
-    CLEAR_BIT(uds->regs->CR1, (USART_CR1_RE | USART_CR1_RXNEIE));
+    CLEAR_BIT(uds->regs->CR1, (USART_CR1_RE | uds->rx_int));
   }
 }
 
@@ -411,6 +605,94 @@ void mgos_uart_hal_config_set_defaults(int uart_no,
   (void) pins;
 }
 
+static void (*stm32_uart_dma_int_handler(int uart_no))(void) {
+  switch (uart_no) {
+    case 1:
+      return stm32_uart1_dma_int_handler;
+    case 2:
+      return stm32_uart2_dma_int_handler;
+    case 3:
+      return stm32_uart3_dma_int_handler;
+#ifdef UART4
+    case 4:
+      return stm32_uart4_dma_int_handler;
+#endif
+#ifdef UART5
+    case 5:
+      return stm32_uart5_dma_int_handler;
+#endif
+#ifdef USART6
+    case 6:
+      return stm32_uart6_dma_int_handler;
+#endif
+#ifdef UART7
+    case 7:
+      return stm32_uart7_dma_int_handler;
+#endif
+#ifdef UART8
+    case 8:
+      return stm32_uart8_dma_int_handler;
+#endif
+  }
+  return NULL;
+}
+
+static void stm32_uart_dma_rx_init(struct mgos_uart_state *us,
+                                   const struct stm32_uart_dma_def *dd) {
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  if (dd->dma == DMA1) {
+    __HAL_RCC_DMA1_CLK_ENABLE();
+  } else {
+    __HAL_RCC_DMA2_CLK_ENABLE();
+  }
+#ifdef STM32L4
+  MODIFY_REG(dd->csel->CSELR, 0xfU << ((dd->index - 1) * 4),
+             (uint32_t) dd->sel << ((dd->index - 1) * 4));
+#endif
+  void (*handler)(void) = stm32_uart_dma_int_handler(us->uart_no);
+  stm32_set_int_handler(dd->irqn, handler);
+  (void) handler;
+  HAL_NVIC_SetPriority(dd->irqn, 10, 0);
+  HAL_NVIC_EnableIRQ(dd->irqn);
+  mgos_ints_disable();
+  uds->rx_dma = dd;
+  stm32_uart_dma_rx_start(us);
+  mgos_ints_enable();
+}
+
+static void stm32_uart_dma_rx_deinit(struct mgos_uart_state *us) {
+  struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
+  const struct stm32_uart_dma_def *dd = uds->rx_dma;
+  if (dd == NULL) return;
+  HAL_NVIC_DisableIRQ(dd->irqn);
+  mgos_ints_disable();
+  stm32_uart_dma_stop(dd);
+  /* Keep what has been received. */
+  cs_rbuf_dma_commit(&uds->irx_buf, &uds->rx_dma_xfer,
+                     stm32_uart_dma_remaining(dd));
+  uds->rx_dma_xfer.dst = NULL;
+  uds->rx_dma = NULL;
+  mgos_ints_enable();
+}
+
+/* Resize irx_buf, keeping as much of the data as fits. */
+static bool stm32_uart_irx_buf_resize(struct stm32_uart_state *uds,
+                                      uint16_t size) {
+  cs_rbuf_t nb;
+  if (uds->irx_buf.size == size) return true;
+  cs_rbuf_init(&nb, size);
+  if (nb.begin == NULL) return false;
+  while (uds->irx_buf.used > 0 && nb.avail > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(&uds->irx_buf, nb.avail, &data);
+    cs_rbuf_append(&nb, data, n);
+    cs_rbuf_consume(&uds->irx_buf, n);
+  }
+  cs_rbuf_deinit(&uds->irx_buf);
+  uds->irx_buf = nb;
+  return true;
+}
+
 bool mgos_uart_hal_configure(struct mgos_uart_state *us,
                              const struct mgos_uart_config *cfg) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
@@ -490,6 +772,16 @@ bool mgos_uart_hal_configure(struct mgos_uart_state *us,
 
   /* Disable for reconfig */
   CLEAR_BIT(regs->CR1, USART_CR1_UE);
+  stm32_uart_dma_rx_deinit(us);
+
+  const struct stm32_uart_dma_def *rx_dma = NULL;
+  if (cfg->dev.rx_dma && s_uart_defs[us->uart_no].rx_dma.ch != NULL) {
+    rx_dma = &s_uart_defs[us->uart_no].rx_dma;
+  }
+  if (!stm32_uart_irx_buf_resize(
+          uds, (rx_dma != NULL ? UART_DMA_RX_BUF_SIZE : UART_ISR_BUF_SIZE))) {
+    return false;
+  }
 
   uint32_t cr1 = USART_CR1_TE; /* Start with TX enabled */
   uint32_t cr2 = 0;
@@ -589,11 +881,14 @@ bool mgos_uart_hal_configure(struct mgos_uart_state *us,
   cr2 |= USART_CR2_RTOEN;
   regs->ICR = USART_ERROR_INTS;
 #endif
+  if (rx_dma != NULL) cr3 |= USART_CR3_DMAR;
+  uds->rx_int = (rx_dma != NULL ? USART_CR1_IDLEIE : USART_CR1_RXNEIE);
   regs->CR1 = cr1;
   regs->CR2 = cr2;
   regs->CR3 = cr3;
   regs->BRR = brr;
   SET_BIT(regs->CR1, USART_CR1_UE);
+  if (rx_dma != NULL) stm32_uart_dma_rx_init(us, rx_dma);
   return true;
 }
 
@@ -602,6 +897,7 @@ bool mgos_uart_hal_init(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds =
       (struct stm32_uart_state *) calloc(1, sizeof(*uds));
   uds->regs = s_uart_defs[us->uart_no].regs;
+  uds->rx_int = USART_CR1_RXNEIE;
   cs_rbuf_init(&uds->irx_buf, UART_ISR_BUF_SIZE);
   cs_rbuf_init(&uds->itx_buf, UART_ISR_BUF_SIZE);
   us->dev_data = uds;
@@ -612,6 +908,7 @@ bool mgos_uart_hal_init(struct mgos_uart_state *us) {
 void mgos_uart_hal_deinit(struct mgos_uart_state *us) {
   struct stm32_uart_state *uds = (struct stm32_uart_state *) us->dev_data;
   CLEAR_BIT(uds->regs->CR1, USART_CR1_UE);
+  stm32_uart_dma_rx_deinit(us);
   s_us[us->uart_no] = NULL;
   int irqn = 0;
   switch (us->uart_no) {
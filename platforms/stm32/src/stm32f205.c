@@ -31,6 +31,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 11, 7),
                 .rts = STM32_PIN('A', 12, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream2,
+                .index = 2,
+                .sel = 4,
+                .irqn = DMA2_Stream2_IRQn,
+            },
     },
     {
         .regs = USART2,
@@ -42,6 +50,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 0, 7),
                 .rts = STM32_PIN('A', 1, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream5,
+                .index = 5,
+                .sel = 4,
+                .irqn = DMA1_Stream5_IRQn,
+            },
     },
     {
         .regs = USART3,
@@ -53,6 +69,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('B', 13, 7),
                 .rts = STM32_PIN('B', 14, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream1,
+                .index = 1,
+                .sel = 4,
+                .irqn = DMA1_Stream1_IRQn,
+            },
     },
     {
         .regs = UART4,
@@ -61,6 +85,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .tx = STM32_PIN('C', 10, 8),
                 .rx = STM32_PIN('C', 11, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream2,
+                .index = 2,
+                .sel = 4,
+                .irqn = DMA1_Stream2_IRQn,
+            },
     },
     {
         .regs = UART5,
@@ -69,6 +101,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .tx = STM32_PIN('C', 12, 8),
                 .rx = STM32_PIN('D', 2, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream0,
+                .index = 0,
+                .sel = 4,
+                .irqn = DMA1_Stream0_IRQn,
+            },
     },
     {
         .regs = USART6,
@@ -80,5 +120,13 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('G', 15, 8),
                 .rts = STM32_PIN('G', 12, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream1,
+                .index = 1,
+                .sel = 5,
+                .irqn = DMA2_Stream1_IRQn,
+            },
     },
 };
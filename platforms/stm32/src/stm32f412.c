@@ -31,6 +31,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 11, 7),
                 .rts = STM32_PIN('A', 12, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream2,
+                .index = 2,
+                .sel = 4,
+                .irqn = DMA2_Stream2_IRQn,
+            },
     },
     {
         .regs = USART2,
@@ -42,6 +50,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 0, 7),
                 .rts = STM32_PIN('A', 1, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream5,
+                .index = 5,
+                .sel = 4,
+                .irqn = DMA1_Stream5_IRQn,
+            },
     },
     {
         .regs = USART3,
@@ -61,6 +77,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .rts = STM32_PIN('B', 14, 7),
 #endif
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream1,
+                .index = 1,
+                .sel = 4,
+                .irqn = DMA1_Stream1_IRQn,
+            },
     },
     {.regs = NULL},
     {.regs = NULL},
@@ -76,5 +100,13 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('G', 13, 8),
                 .rts = STM32_PIN('G', 12, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream1,
+                .index = 1,
+                .sel = 5,
+                .irqn = DMA2_Stream1_IRQn,
+            },
     },
 };
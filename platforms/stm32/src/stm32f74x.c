@@ -35,6 +35,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 11, 7),
                 .rts = STM32_PIN('A', 12, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream2,
+                .index = 2,
+                .sel = 4,
+                .irqn = DMA2_Stream2_IRQn,
+            },
     },
     {
         .regs = USART2,
@@ -46,6 +54,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 0, 7),
                 .rts = STM32_PIN('A', 1, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream5,
+                .index = 5,
+                .sel = 4,
+                .irqn = DMA1_Stream5_IRQn,
+            },
     },
     {
         .regs = USART3,
@@ -57,6 +73,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('D', 11, 7),
                 .rts = STM32_PIN('D', 12, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream1,
+                .index = 1,
+                .sel = 4,
+                .irqn = DMA1_Stream1_IRQn,
+            },
     },
     {
         .regs = UART4,
@@ -67,6 +91,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('B', 0, 8),
                 .rts = STM32_PIN('A', 15, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream2,
+                .index = 2,
+                .sel = 4,
+                .irqn = DMA1_Stream2_IRQn,
+            },
     },
     {
         .regs = UART5,
@@ -77,6 +109,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('C', 9, 7),
                 .rts = STM32_PIN('C', 8, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream0,
+                .index = 0,
+                .sel = 4,
+                .irqn = DMA1_Stream0_IRQn,
+            },
     },
     {
         .regs = USART6,
@@ -88,6 +128,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('G', 13, 8),
                 .rts = STM32_PIN('G', 12, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Stream1,
+                .index = 1,
+                .sel = 5,
+                .irqn = DMA2_Stream1_IRQn,
+            },
     },
     {
         .regs = UART7,
@@ -98,6 +146,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('F', 9, 8),
                 .rts = STM32_PIN('F', 8, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream3,
+                .index = 3,
+                .sel = 5,
+                .irqn = DMA1_Stream3_IRQn,
+            },
     },
     {
         .regs = UART8,
@@ -108,5 +164,13 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('D', 14, 8),
                 .rts = STM32_PIN('D', 15, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Stream6,
+                .index = 6,
+                .sel = 5,
+                .irqn = DMA1_Stream6_IRQn,
+            },
     },
 };
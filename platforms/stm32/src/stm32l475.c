@@ -31,6 +31,15 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('B', 4, 7),
                 .rts = STM32_PIN('B', 3, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Channel5,
+                .csel = DMA1_CSELR,
+                .index = 5,
+                .sel = 2,
+                .irqn = DMA1_Channel5_IRQn,
+            },
     },
     {
         .regs = USART2,
@@ -42,6 +51,15 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('A', 0, 7),
                 .rts = STM32_PIN('A', 1, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Channel6,
+                .csel = DMA1_CSELR,
+                .index = 6,
+                .sel = 2,
+                .irqn = DMA1_Channel6_IRQn,
+            },
     },
     {
         .regs = USART3,
@@ -53,6 +71,15 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('D', 11, 7),
                 .rts = STM32_PIN('D', 12, 7),
             },
+        .rx_dma =
+            {
+                .dma = DMA1,
+                .ch = DMA1_Channel3,
+                .csel = DMA1_CSELR,
+                .index = 3,
+                .sel = 2,
+                .irqn = DMA1_Channel3_IRQn,
+            },
     },
     {
         .regs = UART4,
@@ -64,6 +91,15 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('B', 7, 8),
                 .rts = STM32_PIN('A', 15, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Channel5,
+                .csel = DMA2_CSELR,
+                .index = 5,
+                .sel = 2,
+                .irqn = DMA2_Channel5_IRQn,
+            },
     },
     {
         .regs = UART5,
@@ -75,5 +111,14 @@ struct stm32_uart_def const s_uart_defs[MGOS_MAX_NUM_UARTS] = {
                 .cts = STM32_PIN('B', 5, 8),
                 .rts = STM32_PIN('B', 4, 8),
             },
+        .rx_dma =
+            {
+                .dma = DMA2,
+                .ch = DMA2_Channel2,
+                .csel = DMA2_CSELR,
+                .index = 2,
+                .sel = 2,
+                .irqn = DMA2_Channel2_IRQn,
+            },
     },
 };
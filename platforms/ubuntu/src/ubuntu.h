@@ -20,7 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "common/cs_dbg.h"
+#include "common/cs_pool.h"
 #include "mgos_system.h"
+#include "mgos_timers.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -73,6 +75,33 @@ bool ubuntu_wdt_enable(void);
 bool ubuntu_wdt_disable(void);
 void ubuntu_wdt_set_timeout(int secs);
 
+// Wake up the main loop if it is blocked waiting for events. Can be called
+// from any thread.
+void ubuntu_wakeup(void);
+
+// Run callbacks queued by mgos_invoke_cb(), returns the number of callbacks
+int ubuntu_cbs_run(void);
+
+// Occupancy of the mgos_invoke_cb() node pool
+void ubuntu_get_cbs_pool_stats(struct cs_pool_stats *stats);
+
+// Accuracy of an emulated HW timer, accumulated over all the times it was set.
+struct ubuntu_hw_timer_stats {
+  uint32_t num_fired;
+  uint32_t num_overruns;  // Expirations missed because the thread was late
+  // Relative to the last expiration covered by each firing.
+  int64_t total_lateness_us;
+  int64_t max_lateness_us;
+};
+
+// Returns false if id is not a valid HW timer id.
+bool ubuntu_hw_timers_get_stats(mgos_timer_id id,
+                                struct ubuntu_hw_timer_stats *stats);
+
+// Slave device of a pty-backed UART, e.g. /dev/pts/3. NULL if the UART is
+// not backed by a pty.
+const char *ubuntu_uart_get_pty_name(int uart_no);
+
 // Capabilities (drop privs, chroot, et al)
 bool ubuntu_cap_init(void);
 
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2019 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mgos_invoke_cb() queue.
+ *
+ * Producers (any thread) push nodes onto a lock-free LIFO stack, the main
+ * loop takes the whole stack with a single exchange and runs it in FIFO
+ * order. Nodes are recycled through a global free stack. The queue is only
+ * ever pushed to or taken as a whole, so it's not exposed to ABA.
+ * Each producer thread keeps a private cache of free nodes and refills it
+ * with up to UBUNTU_CBS_CHUNK_SIZE nodes at a time, so the common case
+ * touches no shared state except the queue head and the nodes freed by the
+ * main loop are shared fairly between producers. Refills are serialized by
+ * a mutex: with a single popper and pushers that never remove nodes, the
+ * free stack is not exposed to ABA either.
+ */
+
+#include <pthread.h>
+
+#include "ubuntu.h"
+
+#ifndef UBUNTU_CBS_CHUNK_SIZE
+#define UBUNTU_CBS_CHUNK_SIZE 32
+#endif
+
+struct cb_info {
+  void (*cb)(void *arg);
+  void *cb_arg;
+  struct cb_info *next;
+};
+
+static struct cb_info *s_cbs = NULL;
+static struct cb_info *s_cbs_free = NULL;
+static __thread struct cb_info *s_cbs_cache = NULL;
+
+static pthread_mutex_t s_cbs_refill_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t s_cbs_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_cbs_key;
+
+static struct cs_pool_stats s_cbs_stats;
+
+static void cbs_stats_add(uint32_t *v, int n) {
+  __atomic_add_fetch(v, n, __ATOMIC_RELAXED);
+}
+
+/* Returns true if the stack was empty. */
+static bool cbs_push_list(struct cb_info **head, struct cb_info *first,
+                          struct cb_info *last) {
+  struct cb_info *old = __atomic_load_n(head, __ATOMIC_RELAXED);
+  do {
+    last->next = old;
+  } while (!__atomic_compare_exchange_n(head, &old, first, true /* weak */,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return (old == NULL);
+}
+
+/* Return nodes cached by an exiting thread to the free stack. */
+static void cbs_thread_exit(void *arg) {
+  struct cb_info *first = s_cbs_cache, *last = first;
+  if (first == NULL) return;
+  while (last->next != NULL) last = last->next;
+  s_cbs_cache = NULL;
+  cbs_push_list(&s_cbs_free, first, last);
+  (void) arg;
+}
+
+static void cbs_key_init(void) {
+  pthread_key_create(&s_cbs_key, cbs_thread_exit);
+}
+
+/* Take up to UBUNTU_CBS_CHUNK_SIZE nodes off the free stack. */
+static struct cb_info *cbs_take_free(void) {
+  struct cb_info *list, *last = NULL;
+  pthread_mutex_lock(&s_cbs_refill_lock);
+  list = __atomic_load_n(&s_cbs_free, __ATOMIC_ACQUIRE);
+  do {
+    if (list == NULL) break;
+    /* Nodes below the head can't change under us, see above. */
+    last = list;
+    for (int n = 1; n < UBUNTU_CBS_CHUNK_SIZE && last->next != NULL; n++) {
+      last = last->next;
+    }
+  } while (!__atomic_compare_exchange_n(&s_cbs_free, &list, last->next,
+                                        true /* weak */, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE));
+  if (list != NULL) last->next = NULL;
+  pthread_mutex_unlock(&s_cbs_refill_lock);
+  return list;
+}
+
+static struct cb_info *cbs_refill(void) {
+  struct cb_info *list = cbs_take_free();
+  if (list == NULL) {
+    list = (struct cb_info *) calloc(UBUNTU_CBS_CHUNK_SIZE, sizeof(*list));
+    if (list == NULL) {
+      cbs_stats_add(&s_cbs_stats.num_failed, 1);
+      return NULL;
+    }
+    for (int i = 0; i < UBUNTU_CBS_CHUNK_SIZE - 1; i++) {
+      list[i].next = &list[i + 1];
+    }
+    cbs_stats_add(&s_cbs_stats.num_total, UBUNTU_CBS_CHUNK_SIZE);
+    cbs_stats_add(&s_cbs_stats.num_slabs, 1);
+  }
+  pthread_once(&s_cbs_key_once, cbs_key_init);
+  if (pthread_getspecific(s_cbs_key) == NULL) {
+    pthread_setspecific(s_cbs_key, &s_cbs_cache);
+  }
+  return list;
+}
+
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr) {
+  struct cb_info *cbi = s_cbs_cache;
+  if (cbi == NULL && (cbi = cbs_refill()) == NULL) return false;
+  s_cbs_cache = cbi->next;
+  cbi->cb = cb;
+  cbi->cb_arg = arg;
+  uint32_t used = __atomic_add_fetch(&s_cbs_stats.num_used, 1,
+                                     __ATOMIC_RELAXED);
+  uint32_t max_used = __atomic_load_n(&s_cbs_stats.max_used, __ATOMIC_RELAXED);
+  while (used > max_used &&
+         !__atomic_compare_exchange_n(&s_cbs_stats.max_used, &max_used, used,
+                                      true /* weak */, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+  /* Whoever makes the queue non-empty wakes up the main loop. */
+  if (cbs_push_list(&s_cbs, cbi, cbi)) ubuntu_wakeup();
+  (void) from_isr;
+  return true;
+}
+
+int ubuntu_cbs_run(void) {
+  struct cb_info *cbi = __atomic_exchange_n(&s_cbs, NULL, __ATOMIC_ACQUIRE);
+  if (cbi == NULL) return 0;
+  /* The stack is newest first, reverse it to run callbacks in order. */
+  struct cb_info *first = NULL, *last = cbi;
+  int n = 0;
+  while (cbi != NULL) {
+    struct cb_info *next = cbi->next;
+    cbi->next = first;
+    first = cbi;
+    cbi = next;
+    n++;
+  }
+  for (cbi = first; cbi != NULL; cbi = cbi->next) {
+    cbi->cb(cbi->cb_arg);
+  }
+  cbs_stats_add(&s_cbs_stats.num_used, -n);
+  cbs_push_list(&s_cbs_free, first, last);
+  return n;
+}
+
+void ubuntu_get_cbs_pool_stats(struct cs_pool_stats *stats) {
+  stats->num_total = __atomic_load_n(&s_cbs_stats.num_total, __ATOMIC_RELAXED);
+  stats->num_used = __atomic_load_n(&s_cbs_stats.num_used, __ATOMIC_RELAXED);
+  stats->max_used = __atomic_load_n(&s_cbs_stats.max_used, __ATOMIC_RELAXED);
+  stats->num_slabs = __atomic_load_n(&s_cbs_stats.num_slabs, __ATOMIC_RELAXED);
+  stats->num_failed =
+      __atomic_load_n(&s_cbs_stats.num_failed, __ATOMIC_RELAXED);
+}
@@ -15,25 +15,27 @@
  */
 
 #include <stdlib.h>
+#include <time.h>
 
 #include "mgos_hal.h"
 #include "mgos_mongoose.h"
 #include "mgos_net_hal.h"
 #include "mgos_time.h"
 
-static struct timeval s_boottime;
+/* Uptime runs on the monotonic clock: SW timers rely on it not jumping. */
+static struct timespec s_boottime;
 
 bool ubuntu_set_boottime(void) {
-  gettimeofday(&s_boottime, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &s_boottime);
   return true;
 }
 
 int64_t mgos_uptime_micros(void) {
-  struct timeval now;
+  struct timespec now;
 
-  gettimeofday(&now, NULL);
-  return (int64_t)(now.tv_sec * 1e6 + now.tv_usec -
-                   (s_boottime.tv_sec * 1e6 + s_boottime.tv_usec));
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)(now.tv_sec - s_boottime.tv_sec) * 1000000 +
+         (now.tv_nsec - s_boottime.tv_nsec) / 1000;
 }
 
 int mg_ssl_if_mbed_random(void *ctx, unsigned char *buf, size_t len) {
@@ -172,14 +172,26 @@ bool ubuntu_set_nsleep100(void) {
   return true;
 }
 
+// There are no interrupts, but HW timer callbacks run on a separate thread
+// and expect to be masked by mgos_ints_disable().
+static pthread_mutex_t s_ints_lock;
+static pthread_once_t s_ints_lock_once = PTHREAD_ONCE_INIT;
+
+static void ubuntu_ints_lock_init(void) {
+  pthread_mutexattr_t ma;
+  pthread_mutexattr_init(&ma);
+  pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&s_ints_lock, &ma);
+  pthread_mutexattr_destroy(&ma);
+}
+
 void mgos_ints_disable(void) {
-  // LOG(LL_INFO, ("Not implemented"));
-  return;
+  pthread_once(&s_ints_lock_once, ubuntu_ints_lock_init);
+  pthread_mutex_lock(&s_ints_lock);
 }
 
 void mgos_ints_enable(void) {
-  // LOG(LL_INFO, ("Not implemented"));
-  return;
+  pthread_mutex_unlock(&s_ints_lock);
 }
 
 uint32_t mgos_get_cpu_freq(void) {
@@ -14,66 +14,161 @@
  * limitations under the License.
  */
 
-#include <malloc.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "mgos_hw_timers_hal.h"
 #include "ubuntu.h"
 
-bool mgos_hw_timers_dev_set(struct mgos_hw_timer_info *ti, int usecs,
-                            int flags) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return true;
-
-  (void) ti;
-  (void) usecs;
-  (void) flags;
+// HW timers are emulated with timerfds, serviced by a dedicated thread which
+// plays the role of the interrupt handler. "Interrupts" are masked by
+// mgos_ints_disable(), so the callback never races with set/clear.
+
+struct ubuntu_hw_timer {
+  int fd;
+  int64_t period_us;    // 0 for one-shot timers
+  int64_t deadline_us;  // Expected time of the next expiration
+  struct ubuntu_hw_timer_stats stats;
+};
+
+static struct mgos_hw_timer_info *s_tis[MGOS_NUM_HW_TIMERS];
+static struct ubuntu_hw_timer s_hwts[MGOS_NUM_HW_TIMERS];
+static pthread_once_t s_thread_once = PTHREAD_ONCE_INIT;
+
+static int64_t ubuntu_mono_micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
-void mgos_hw_timers_isr(struct mgos_hw_timer_info *ti) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) ti;
+static void ubuntu_hw_timer_fire(int i) {
+  struct ubuntu_hw_timer *hwt = &s_hwts[i];
+  struct mgos_hw_timer_info *ti = s_tis[i];
+  uint64_t num_exp = 0;
+  mgos_ints_disable();
+  // Timer may have been cleared or re-armed since poll() returned, in which
+  // case the expiration count is reset and read() fails with EAGAIN.
+  if (read(hwt->fd, &num_exp, sizeof(num_exp)) == sizeof(num_exp) &&
+      ti->cb != NULL) {
+    // Missed expirations are overruns, lateness is from the last one.
+    hwt->deadline_us += hwt->period_us * (int64_t)(num_exp - 1);
+    int64_t lateness = ubuntu_mono_micros() - hwt->deadline_us;
+    hwt->stats.num_fired++;
+    hwt->stats.num_overruns += (uint32_t)(num_exp - 1);
+    hwt->stats.total_lateness_us += lateness;
+    if (lateness > hwt->stats.max_lateness_us) {
+      hwt->stats.max_lateness_us = lateness;
+    }
+    hwt->deadline_us += hwt->period_us;
+    mgos_hw_timers_isr(ti);
+  }
+  mgos_ints_enable();
 }
 
-void mgos_hw_timers_dev_isr_bottom(struct mgos_hw_timer_info *ti) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) ti;
+static void *ubuntu_hw_timers_thread(void *arg) {
+  struct pollfd pfds[MGOS_NUM_HW_TIMERS];
+  int i;
+  for (i = 0; i < MGOS_NUM_HW_TIMERS; i++) {
+    pfds[i].fd = s_hwts[i].fd;
+    pfds[i].events = POLLIN;
+  }
+  for (;;) {
+    if (poll(pfds, MGOS_NUM_HW_TIMERS, -1) < 0) {
+      if (errno == EINTR) continue;
+      LOG(LL_ERROR, ("poll: %s", strerror(errno)));
+      break;
+    }
+    for (i = 0; i < MGOS_NUM_HW_TIMERS; i++) {
+      if (pfds[i].revents & POLLIN) ubuntu_hw_timer_fire(i);
+    }
+  }
+  return NULL;
+
+  (void) arg;
 }
 
-void mgos_hw_timers_dev_clear(struct mgos_hw_timer_info *ti) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) ti;
+static void ubuntu_hw_timers_start_thread(void) {
+  pthread_t thread;
+  pthread_attr_t attr;
+  struct sched_param sp = {
+      .sched_priority = sched_get_priority_max(SCHED_FIFO),
+  };
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  pthread_attr_setschedparam(&attr, &sp);
+  if (pthread_create(&thread, &attr, ubuntu_hw_timers_thread, NULL) != 0) {
+    // Most likely we are not allowed to use real-time scheduling.
+    LOG(LL_WARN, ("Real-time priority not available, HW timers may jitter"));
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    if (pthread_create(&thread, &attr, ubuntu_hw_timers_thread, NULL) != 0) {
+      LOG(LL_ERROR, ("Failed to start HW timer thread"));
+    }
+  }
+  pthread_attr_destroy(&attr);
 }
 
-bool mgos_hw_timers_dev_init(struct mgos_hw_timer_info *ti) {
-  LOG(LL_INFO, ("Not implemented yet"));
+bool mgos_hw_timers_dev_set(struct mgos_hw_timer_info *ti, int usecs,
+                            int flags) {
+  struct ubuntu_hw_timer *hwt = &s_hwts[ti->id - 1];
+  struct itimerspec its;
+  if (usecs <= 0) return false;
+  pthread_once(&s_thread_once, ubuntu_hw_timers_start_thread);
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = usecs / 1000000;
+  its.it_value.tv_nsec = (usecs % 1000000) * 1000;
+  if (flags & MGOS_TIMER_REPEAT) its.it_interval = its.it_value;
+  mgos_ints_disable();
+  hwt->period_us = (flags & MGOS_TIMER_REPEAT) ? usecs : 0;
+  hwt->deadline_us = ubuntu_mono_micros() + usecs;
+  int res = timerfd_settime(hwt->fd, 0, &its, NULL);
+  mgos_ints_enable();
+  if (res != 0) {
+    LOG(LL_ERROR, ("timerfd_settime: %s", strerror(errno)));
+    return false;
+  }
   return true;
+}
 
+void mgos_hw_timers_dev_isr_bottom(struct mgos_hw_timer_info *ti) {
+  // Nothing to acknowledge, expiration was consumed by read().
   (void) ti;
 }
 
-enum mgos_init_result mgos_hw_timers_init(void) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return MGOS_INIT_OK;
+void mgos_hw_timers_dev_clear(struct mgos_hw_timer_info *ti) {
+  struct ubuntu_hw_timer *hwt = &s_hwts[ti->id - 1];
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  mgos_ints_disable();
+  timerfd_settime(hwt->fd, 0, &its, NULL);
+  mgos_ints_enable();
 }
 
-void mgos_hw_timers_deinit(void) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
+bool mgos_hw_timers_dev_init(struct mgos_hw_timer_info *ti) {
+  struct ubuntu_hw_timer *hwt = &s_hwts[ti->id - 1];
+  hwt->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (hwt->fd < 0) {
+    LOG(LL_ERROR, ("timerfd_create: %s", strerror(errno)));
+    return false;
+  }
+  s_tis[ti->id - 1] = ti;
+  return true;
 }
 
-void mgos_clear_hw_timer(mgos_timer_id id) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) id;
+bool ubuntu_hw_timers_get_stats(mgos_timer_id id,
+                                struct ubuntu_hw_timer_stats *stats) {
+  if (id < 1 || id > MGOS_NUM_HW_TIMERS) return false;
+  mgos_ints_disable();
+  memcpy(stats, &s_hwts[id - 1].stats, sizeof(*stats));
+  mgos_ints_enable();
+  return true;
 }
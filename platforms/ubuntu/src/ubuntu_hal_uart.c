@@ -14,72 +14,366 @@
  * limitations under the License.
  */
 
-#include <malloc.h>
+#define _GNU_SOURCE  // For the pty functions.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
 
+#include "mgos_mongoose.h"
+#include "mgos_sys_config.h"
+#include "mgos_time.h"
 #include "mgos_uart_hal.h"
 #include "ubuntu.h"
+#include "ubuntu_ipc.h"
 
-bool mgos_uart_hal_init(struct mgos_uart_state *us) {
-  LOG(LL_INFO, ("Not implemented yet"));
+// UARTs are backed by host terminal devices: a serial port (ubuntu.uartN.dev
+// set to e.g. /dev/ttyUSB0) or a pseudo-terminal (ubuntu.uartN.dev = "pty"),
+// whose slave end other programs can open to talk to the firmware.
+//
+// The device fd is added to the Mongoose manager, so the main loop wakes up
+// when there is data to read or room to write; no polling is involved.
+// Mongoose reads into recv_mbuf, which plays the role of the RX FIFO, and
+// stops reading when it reaches recv_mbuf_limit, throttling the sender.
+// TX writes straight to the device; whatever does not fit is left in
+// send_mbuf for Mongoose to finish when the device becomes writable.
+//
+// A UART without a device behaves like an unconnected port: output is
+// discarded and nothing is ever received.
+
+// How long mgos_uart_flush() waits for the device to accept data before
+// giving up, e.g. when nobody reads the pty or CTS is held low.
+#ifndef UBUNTU_UART_FLUSH_TIMEOUT_MS
+#define UBUNTU_UART_FLUSH_TIMEOUT_MS 1000
+#endif
+
+struct ubuntu_uart_state {
+  int fd;
+  struct mg_connection *nc;
+  // For ptys, we hold the slave end open so that the master does not get
+  // EIO while nobody else has it open.
+  int pty_slave_fd;
+  char *pty_name;
+};
+
+static const char *ubuntu_uart_dev_name(int uart_no) {
+  switch (uart_no) {
+    case 0:
+      return mgos_sys_config_get_ubuntu_uart0_dev();
+    case 1:
+      return mgos_sys_config_get_ubuntu_uart1_dev();
+  }
+  return NULL;
+}
+
+static void ubuntu_uart_close_pty(struct ubuntu_uart_state *uds) {
+  if (uds->pty_slave_fd >= 0) close(uds->pty_slave_fd);
+  free(uds->pty_name);
+  uds->pty_slave_fd = -1;
+  uds->pty_name = NULL;
+}
+
+static void ubuntu_uart_ev(struct mg_connection *nc, int ev, void *ev_data,
+                           void *user_data) {
+  struct mgos_uart_state *us = (struct mgos_uart_state *) user_data;
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  switch (ev) {
+    case MG_EV_RECV:
+      us->stats.ints++;
+      us->stats.rx_ints++;
+      mgos_uart_schedule_dispatcher(us->uart_no, false /* from_isr */);
+      break;
+    case MG_EV_SEND:
+      us->stats.ints++;
+      us->stats.tx_ints++;
+      us->stats.tx_bytes += *((int *) ev_data);
+      mgos_uart_schedule_dispatcher(us->uart_no, false /* from_isr */);
+      break;
+    case MG_EV_CLOSE:
+      // Mongoose has closed the fd, the next configure reopens the device.
+      LOG(LL_ERROR, ("UART%d: device closed", us->uart_no));
+      uds->nc = NULL;
+      uds->fd = -1;
+      ubuntu_uart_close_pty(uds);
+      break;
+  }
+  (void) nc;
+}
+
+static void ubuntu_uart_set_rx_limit(struct mgos_uart_state *us) {
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (uds->nc == NULL) return;
+  uds->nc->recv_mbuf_limit = (us->rx_enabled ? us->cfg.rx_buf_size : 0);
+}
+
+static bool ubuntu_uart_open(struct mgos_uart_state *us, const char *dev) {
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (strcmp(dev, "pty") == 0) {
+    const char *name;
+    uds->fd = ubuntu_ipc_open("/dev/ptmx", O_RDWR | O_NOCTTY);
+    if (uds->fd < 0 || grantpt(uds->fd) != 0 || unlockpt(uds->fd) != 0 ||
+        (name = ptsname(uds->fd)) == NULL) {
+      LOG(LL_ERROR, ("UART%d: failed to create pty: %d", us->uart_no, errno));
+      goto err;
+    }
+    uds->pty_name = strdup(name);
+    uds->pty_slave_fd = ubuntu_ipc_open(name, O_RDWR | O_NOCTTY);
+    if (uds->pty_slave_fd < 0) {
+      LOG(LL_ERROR, ("UART%d: failed to open %s", us->uart_no, name));
+      goto err;
+    }
+    LOG(LL_INFO, ("UART%d: %s", us->uart_no, name));
+  } else {
+    uds->fd = ubuntu_ipc_open(dev, O_RDWR | O_NOCTTY);
+    if (uds->fd < 0) {
+      LOG(LL_ERROR, ("UART%d: failed to open %s", us->uart_no, dev));
+      goto err;
+    }
+    LOG(LL_INFO, ("UART%d: %s", us->uart_no, dev));
+  }
+  uds->nc = mg_add_sock(mgos_get_mgr(), uds->fd, ubuntu_uart_ev, us);
+  if (uds->nc == NULL) goto err;
+  return true;
+
+err:
+  if (uds->fd >= 0) close(uds->fd);
+  uds->fd = -1;
+  ubuntu_uart_close_pty(uds);
+  return false;
+}
+
+static bool ubuntu_uart_baud_to_speed(int baud_rate, speed_t *speed) {
+  static const struct {
+    int baud_rate;
+    speed_t speed;
+  } s_speeds[] = {
+      {1200, B1200},       {2400, B2400},       {4800, B4800},
+      {9600, B9600},       {19200, B19200},     {38400, B38400},
+      {57600, B57600},     {115200, B115200},   {230400, B230400},
+      {460800, B460800},   {500000, B500000},   {576000, B576000},
+      {921600, B921600},   {1000000, B1000000}, {1152000, B1152000},
+      {1500000, B1500000}, {2000000, B2000000}, {2500000, B2500000},
+      {3000000, B3000000}, {3500000, B3500000}, {4000000, B4000000},
+  };
+  for (size_t i = 0; i < ARRAY_SIZE(s_speeds); i++) {
+    if (s_speeds[i].baud_rate == baud_rate) {
+      *speed = s_speeds[i].speed;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ubuntu_uart_set_termios(struct mgos_uart_state *us,
+                                    const struct mgos_uart_config *cfg) {
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  // Terminal settings of a pty live on the slave side.
+  int fd = (uds->pty_slave_fd >= 0 ? uds->pty_slave_fd : uds->fd);
+  struct termios t;
+  speed_t speed;
+  if (tcgetattr(fd, &t) != 0) {
+    LOG(LL_ERROR, ("UART%d: not a terminal", us->uart_no));
+    return false;
+  }
+  cfmakeraw(&t);
+  t.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+  t.c_cflag |= CLOCAL | CREAD;
+  switch (cfg->num_data_bits) {
+    case 5:
+      t.c_cflag |= CS5;
+      break;
+    case 6:
+      t.c_cflag |= CS6;
+      break;
+    case 7:
+      t.c_cflag |= CS7;
+      break;
+    case 8:
+      t.c_cflag |= CS8;
+      break;
+    default:
+      return false;
+  }
+  switch (cfg->parity) {
+    case MGOS_UART_PARITY_NONE:
+      break;
+    case MGOS_UART_PARITY_EVEN:
+      t.c_cflag |= PARENB;
+      break;
+    case MGOS_UART_PARITY_ODD:
+      t.c_cflag |= PARENB | PARODD;
+      break;
+  }
+  switch (cfg->stop_bits) {
+    case MGOS_UART_STOP_BITS_1:
+      break;
+    case MGOS_UART_STOP_BITS_2:
+      t.c_cflag |= CSTOPB;
+      break;
+    case MGOS_UART_STOP_BITS_1_5:
+      // Not supported by termios.
+      return false;
+  }
+  // termios cannot enable RTS and CTS separately.
+  if (cfg->rx_fc_type == MGOS_UART_FC_HW ||
+      cfg->tx_fc_type == MGOS_UART_FC_HW) {
+    t.c_cflag |= CRTSCTS;
+  }
+  if (!ubuntu_uart_baud_to_speed(cfg->baud_rate, &speed)) {
+    LOG(LL_ERROR, ("UART%d: unsupported baud rate %d", us->uart_no,
+                   cfg->baud_rate));
+    return false;
+  }
+  cfsetispeed(&t, speed);
+  cfsetospeed(&t, speed);
+  if (tcsetattr(fd, TCSANOW, &t) != 0) {
+    LOG(LL_ERROR, ("UART%d: tcsetattr failed: %d", us->uart_no, errno));
+    return false;
+  }
   return true;
+}
 
-  (void) us;
+bool mgos_uart_hal_init(struct mgos_uart_state *us) {
+  struct ubuntu_uart_state *uds =
+      (struct ubuntu_uart_state *) calloc(1, sizeof(*uds));
+  if (uds == NULL) return false;
+  uds->fd = uds->pty_slave_fd = -1;
+  us->dev_data = uds;
+  return true;
 }
 
 bool mgos_uart_hal_configure(struct mgos_uart_state *us,
                              const struct mgos_uart_config *cfg) {
-  LOG(LL_INFO, ("Not implemented yet"));
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (uds->fd < 0) {
+    const char *dev = ubuntu_uart_dev_name(us->uart_no);
+    if (dev == NULL || dev[0] == '\0') {
+      LOG(LL_INFO, ("UART%d: no device, set ubuntu.uart%d.dev to use it",
+                    us->uart_no, us->uart_no));
+      return true;
+    }
+    if (!ubuntu_uart_open(us, dev)) return false;
+  }
+  if (!ubuntu_uart_set_termios(us, cfg)) return false;
+  // mgos_uart_configure() only updates us->cfg after we return.
+  uds->nc->recv_mbuf_limit = (us->rx_enabled ? cfg->rx_buf_size : 0);
   return true;
-
-  (void) us;
-  (void) cfg;
 }
 
 void mgos_uart_hal_config_set_defaults(int uart_no,
                                        struct mgos_uart_config *cfg) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
   (void) uart_no;
   (void) cfg;
 }
 
 void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
-  //  LOG(LL_INFO, ("rx: Not implemented yet"));
-  return;
-
-  (void) us;
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (uds->nc == NULL) return;
+  struct mbuf *rxb = &uds->nc->recv_mbuf;
+  size_t n = MIN(rxb->len, mgos_uart_rxb_free(us));
+  if (n > 0) {
+    cs_rbuf_append(&us->rx_buf, rxb->buf, n);
+    mbuf_remove(rxb, n);
+    us->stats.rx_bytes += n;
+  }
+  if (rxb->len > 0 && us->cfg.rx_fc_type == MGOS_UART_FC_SW &&
+      !us->xoff_sent) {
+    // Out of band, ahead of anything that is queued for sending.
+    uint8_t xoff = MGOS_UART_XOFF_CHAR;
+    if (write(uds->fd, &xoff, 1) == 1) us->xoff_sent = true;
+  }
 }
 
 void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
-  //  LOG(LL_INFO, ("tx: Not implemented yet"));
-  return;
-
-  (void) us;
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  cs_rbuf_t *txb = &us->tx_buf;
+  if (uds->nc == NULL) {
+    cs_rbuf_clear(txb);
+    return;
+  }
+  struct mbuf *sb = &uds->nc->send_mbuf;
+  // What has been handed to Mongoose goes out first.
+  if (sb->len > 0) {
+    ssize_t n = write(uds->fd, sb->buf, sb->len);
+    if (n > 0) {
+      mbuf_remove(sb, n);
+      us->stats.tx_bytes += n;
+    }
+  }
+  while (sb->len == 0 && txb->used > 0) {
+    uint8_t *data = NULL;
+    uint16_t len = cs_rbuf_get(txb, txb->used, &data);
+    ssize_t n = write(uds->fd, data, len);
+    if (n < 0) n = 0;
+    us->stats.tx_bytes += n;
+    if (n < len) {
+      mg_send(uds->nc, data + n, len - n);
+      us->stats.tx_throttles++;
+    }
+    cs_rbuf_consume(txb, len);
+  }
 }
 
 void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
-  //  LOG(LL_INFO, ("bottom: Not implemented yet"));
-  return;
-
-  (void) us;
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (uds->nc == NULL) return;
+  ubuntu_uart_set_rx_limit(us);
+  // Mongoose will not tell us about data it has already read.
+  if (us->rx_enabled && uds->nc->recv_mbuf.len > 0 &&
+      mgos_uart_rxb_free(us) > 0) {
+    mgos_uart_schedule_dispatcher(us->uart_no, false /* from_isr */);
+  }
 }
 
 void mgos_uart_hal_flush_fifo(struct mgos_uart_state *us) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) us;
+  struct ubuntu_uart_state *uds = (struct ubuntu_uart_state *) us->dev_data;
+  if (uds->nc == NULL) return;
+  struct mbuf *sb = &uds->nc->send_mbuf;
+  // The deadline is pushed back whenever the device makes progress.
+  int64_t deadline =
+      mgos_uptime_micros() + UBUNTU_UART_FLUSH_TIMEOUT_MS * 1000LL;
+  while (sb->len > 0) {
+    int64_t left_ms = (deadline - mgos_uptime_micros()) / 1000;
+    if (left_ms <= 0) {
+      LOG(LL_WARN, ("UART%d: flush timed out, %d bytes pending", us->uart_no,
+                    (int) sb->len));
+      return;
+    }
+    struct pollfd pfd = {.fd = uds->fd, .events = POLLOUT};
+    if (poll(&pfd, 1, (int) MIN(left_ms, 100)) <= 0) continue;
+    ssize_t n = write(uds->fd, sb->buf, sb->len);
+    if (n > 0) {
+      mbuf_remove(sb, n);
+      us->stats.tx_bytes += n;
+      deadline = mgos_uptime_micros() + UBUNTU_UART_FLUSH_TIMEOUT_MS * 1000LL;
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      break;
+    }
+  }
+  // Ptys have no transmitter to wait for. tcdrain() could block forever with
+  // CTS held low, so wait for the output queue to empty, up to the deadline.
+  if (uds->pty_slave_fd >= 0) return;
+  int pending;
+  while (ioctl(uds->fd, TIOCOUTQ, &pending) == 0 && pending > 0 &&
+         mgos_uptime_micros() < deadline) {
+    usleep(1000);
+  }
 }
 
 void mgos_uart_hal_set_rx_enabled(struct mgos_uart_state *us, bool enabled) {
-  LOG(LL_INFO, ("Not implemented yet"));
-  return;
-
-  (void) us;
+  ubuntu_uart_set_rx_limit(us);
   (void) enabled;
 }
+
+const char *ubuntu_uart_get_pty_name(int uart_no) {
+  if (uart_no < 0 || uart_no >= MGOS_MAX_NUM_UARTS) return NULL;
+  struct mgos_uart_state *us = mgos_uart_hal_get_state(uart_no);
+  if (us == NULL) return NULL;
+  return ((struct ubuntu_uart_state *) us->dev_data)->pty_name;
+}
@@ -23,9 +23,12 @@
 struct ubuntu_pipe s_pipe;
 
 static int ubuntu_ipc_handle_open(const char *pathname, int flags) {
-  const char *patterns[] = {"/dev/i2c-*", "/dev/spidev*.*", "/proc/cpuinfo",
-                            "/sys/class/net/*/address", "/proc/net/route",
-                            NULL};
+  const char *patterns[] = {"/dev/i2c-*",    "/dev/spidev*.*",
+                            "/dev/ttyS*",    "/dev/ttyUSB*",
+                            "/dev/ttyACM*",  "/dev/ptmx",
+                            "/dev/pts/*",    "/proc/cpuinfo",
+                            "/sys/class/net/*/address",
+                            "/proc/net/route", NULL};
   int i;
   bool ok = false;
 
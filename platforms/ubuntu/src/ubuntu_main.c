@@ -17,7 +17,7 @@
 #include <signal.h>
 #include <sys/wait.h>
 
-#include "common/queue.h"
+#include "common/cs_wakeup.h"
 
 #include "mgos_debug_internal.h"
 #include "mgos_init_internal.h"
@@ -37,26 +37,49 @@ struct ubuntu_flags Flags;
 static bool mongoose_running = false;
 static pid_t s_parent, s_child;
 
-struct cb_info {
-  void (*cb)(void *arg);
-  void *cb_arg;
-  STAILQ_ENTRY(cb_info) next;
-};
-
-STAILQ_HEAD(s_cbs, cb_info) s_cbs = STAILQ_HEAD_INITIALIZER(s_cbs);
-struct mgos_rlock_type *s_cbs_lock = NULL;
 struct mgos_rlock_type *s_mgos_lock = NULL;
 
+/*
+ * Upper bound on how long the main loop blocks. Mongoose further limits it
+ * to the next timer deadline, and ubuntu_wakeup() interrupts it.
+ */
+#ifndef UBUNTU_MAX_POLL_MS
+#define UBUNTU_MAX_POLL_MS 1000
+#endif
+
+static struct cs_wakeup s_wakeup = {.rfd = -1, .wfd = -1};
+
 static void ubuntu_sigint_handler(int sig) {
   mongoose_running = false;
+  ubuntu_wakeup();
   (void) sig;
 }
 
+/* Mongoose has already consumed the wakeup by reading the fd. */
+static void ubuntu_wakeup_handler(struct mg_connection *nc, int ev,
+                                  void *ev_data, void *user_data) {
+  if (ev == MG_EV_RECV) {
+    mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+  } else if (ev == MG_EV_CLOSE) {
+    /* Closed by mongoose, don't signal a stale fd. */
+    s_wakeup.rfd = s_wakeup.wfd = -1;
+  }
+  (void) ev_data;
+  (void) user_data;
+}
+
+void ubuntu_wakeup(void) {
+  if (s_wakeup.wfd >= 0) cs_wakeup_signal(&s_wakeup);
+}
+
 static int ubuntu_mongoose(void) {
   enum mgos_init_result r;
 
-  s_cbs_lock = mgos_rlock_create();
   s_mgos_lock = mgos_rlock_create();
+  if (!cs_wakeup_init(&s_wakeup)) {
+    LOG(LL_ERROR, ("Failed to create wakeup fd"));
+    return -1;
+  }
 
   ubuntu_set_boottime();
   ubuntu_set_nsleep100();
@@ -70,39 +93,19 @@ static int ubuntu_mongoose(void) {
         ("mongoose_init=%d (expecting %d), exiting", r, MGOS_INIT_OK));
     return -3;
   }
+  mg_add_sock(mgos_get_mgr(), s_wakeup.rfd, ubuntu_wakeup_handler, NULL);
   mongoose_running = true;
   struct sigaction sa = {
       .sa_handler = ubuntu_sigint_handler,
   };
   sigaction(SIGINT, &sa, NULL);
   while (mongoose_running) {
-    mgos_rlock(s_cbs_lock);
-    while (!STAILQ_EMPTY(&s_cbs)) {
-      struct cb_info *cbi = STAILQ_FIRST(&s_cbs);
-      STAILQ_REMOVE_HEAD(&s_cbs, next);
-      mgos_runlock(s_cbs_lock);
-      cbi->cb(cbi->cb_arg);
-      free(cbi);
-      mgos_rlock(s_cbs_lock);
-    }
-    mgos_runlock(s_cbs_lock);
-    mongoose_poll(1);
+    ubuntu_cbs_run();
+    mongoose_poll(UBUNTU_MAX_POLL_MS);
   }
   return 0;
 }
 
-bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr) {
-  struct cb_info *cbi = (struct cb_info *) calloc(1, sizeof(*cbi));
-  if (cbi == NULL) return false;
-  cbi->cb = cb;
-  cbi->cb_arg = arg;
-  mgos_rlock(s_cbs_lock);
-  STAILQ_INSERT_TAIL(&s_cbs, cbi, next);
-  mgos_runlock(s_cbs_lock);
-  (void) from_isr;
-  return true;
-}
-
 static int ubuntu_main(void) {
   for (;;) {
     int wstatus;
@@ -160,16 +163,8 @@ int main(int argc, char *argv[]) {
   (void) argv;
 }
 
-static void dummy_handler(struct mg_connection *nc, int ev, void *ev_data,
-                          void *user_data) {
-  (void) nc;
-  (void) ev;
-  (void) ev_data;
-  (void) user_data;
-}
-
 void mongoose_schedule_poll(bool from_isr) {
-  mg_broadcast(mgos_get_mgr(), dummy_handler, NULL, 0);
+  ubuntu_wakeup();
   (void) from_isr;
 }
 
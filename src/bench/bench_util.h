@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CS_FW_SRC_BENCH_BENCH_UTIL_H_
+#define CS_FW_SRC_BENCH_BENCH_UTIL_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+/* Monotonic time in seconds. */
+static inline double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Emulated Mongoose poll loop (mgos_stubs.c): runs poll callbacks if a poll
+ * has been scheduled with mongoose_schedule_poll() or if force is set.
+ * Returns true if callbacks were run.
+ */
+bool bench_mgos_poll(bool force);
+
+#endif /* CS_FW_SRC_BENCH_BENCH_UTIL_H_ */
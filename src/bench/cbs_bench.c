@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mgos_invoke_cb() producer throughput on ubuntu, compared against the
+ * previous mutex-protected list, as the number of producer threads grows.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common/queue.h"
+
+#include "bench_util.h"
+#include "ubuntu.h"
+
+#define NUM_CBS_PER_THREAD 200000
+
+struct impl {
+  const char *name;
+  bool (*invoke_cb)(mgos_cb_t cb, void *arg, bool from_isr);
+  int (*run)(void);
+};
+
+/* Reference: the old recursive mutex + calloc'd STAILQ implementation. */
+struct ref_cb_info {
+  void (*cb)(void *arg);
+  void *cb_arg;
+  STAILQ_ENTRY(ref_cb_info) next;
+};
+
+static STAILQ_HEAD(ref_cbs, ref_cb_info) s_ref_cbs =
+    STAILQ_HEAD_INITIALIZER(s_ref_cbs);
+static pthread_mutex_t s_ref_lock;
+
+static bool ref_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr) {
+  pthread_mutex_lock(&s_ref_lock);
+  struct ref_cb_info *cbi = calloc(1, sizeof(*cbi));
+  if (cbi == NULL) {
+    pthread_mutex_unlock(&s_ref_lock);
+    return false;
+  }
+  cbi->cb = cb;
+  cbi->cb_arg = arg;
+  STAILQ_INSERT_TAIL(&s_ref_cbs, cbi, next);
+  pthread_mutex_unlock(&s_ref_lock);
+  (void) from_isr;
+  return true;
+}
+
+static int ref_run(void) {
+  int n = 0;
+  pthread_mutex_lock(&s_ref_lock);
+  while (!STAILQ_EMPTY(&s_ref_cbs)) {
+    struct ref_cb_info *cbi = STAILQ_FIRST(&s_ref_cbs);
+    STAILQ_REMOVE_HEAD(&s_ref_cbs, next);
+    pthread_mutex_unlock(&s_ref_lock);
+    cbi->cb(cbi->cb_arg);
+    pthread_mutex_lock(&s_ref_lock);
+    free(cbi);
+    n++;
+  }
+  pthread_mutex_unlock(&s_ref_lock);
+  return n;
+}
+
+static const struct impl s_impls[] = {
+    {"mutex", ref_invoke_cb, ref_run},
+    {"lock-free", mgos_invoke_cb, ubuntu_cbs_run},
+};
+
+/* The consumer below spins, it does not need to be woken up. */
+void ubuntu_wakeup(void) {
+}
+
+static const struct impl *s_impl;
+static long s_num_run = 0;
+
+static void count_cb(void *arg) {
+  s_num_run++;
+  (void) arg;
+}
+
+static void *producer(void *arg) {
+  for (int i = 0; i < NUM_CBS_PER_THREAD; i++) {
+    while (!s_impl->invoke_cb(count_cb, NULL, false)) {
+    }
+  }
+  (void) arg;
+  return NULL;
+}
+
+static double run_one(const struct impl *impl, int num_threads) {
+  pthread_t threads[16];
+  long total = (long) num_threads * NUM_CBS_PER_THREAD;
+  s_impl = impl;
+  s_num_run = 0;
+  double start = bench_now();
+  for (int i = 0; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, producer, NULL);
+  }
+  while (s_num_run < total) {
+    impl->run();
+  }
+  double elapsed = bench_now() - start;
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return total / elapsed;
+}
+
+int main(void) {
+  static const int thread_counts[] = {1, 2, 4, 8, 16};
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&s_ref_lock, &attr);
+
+  printf("%-10s %8s %14s\n", "impl", "threads", "cbs/s");
+  for (size_t j = 0; j < ARRAY_SIZE(s_impls); j++) {
+    for (size_t i = 0; i < ARRAY_SIZE(thread_counts); i++) {
+      double rate = run_one(&s_impls[j], thread_counts[i]);
+      printf("%-10s %8d %14.0f\n", s_impls[j].name, thread_counts[i], rate);
+    }
+  }
+  struct cs_pool_stats ps;
+  ubuntu_get_cbs_pool_stats(&ps);
+  printf("lock-free nodes: total %u, max used %u, chunks %u\n", ps.num_total,
+         ps.max_used, ps.num_slabs);
+  return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * cs_frbuf records per second on a file-backed store, one record at a time
+ * vs in batches, under different sync policies.
+ * Each round fills about half of the buffer and then drains it.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/cs_dbg.h"
+#include "common/cs_frbuf.h"
+#include "common/platform.h"
+
+#include "bench_util.h"
+
+#define BENCH_FILE "frbuf_bench.dat"
+#define BUF_SIZE 60000
+#define REC_SIZE 32
+#define RECS_PER_ROUND 800
+#define NUM_ROUNDS 50
+#define BATCH_SIZE 32
+
+struct config {
+  const char *name;
+  int batch;
+  struct cs_frbuf_sync_policy policy;
+};
+
+static const struct config s_configs[] = {
+    {"single, sync each", 1, {.max_records = 1, .max_ms = 0}},
+    {"single, sync /32", 1, {.max_records = 32, .max_ms = 0}},
+    {"single, sync 100ms", 1, {.max_records = 0, .max_ms = 100}},
+    {"single, explicit", 1, {.max_records = 0, .max_ms = 0}},
+    {"batch32, sync each", BATCH_SIZE, {.max_records = 1, .max_ms = 0}},
+    {"batch32, explicit", BATCH_SIZE, {.max_records = 0, .max_ms = 0}},
+};
+
+/* cs_frbuf uses cs_time() for time-based sync. */
+double cs_time(void) {
+  return bench_now();
+}
+
+/* Only errors are logged by cs_frbuf, pass them through. */
+int cs_log_print_prefix(enum cs_log_level level, const char *fname, int line) {
+  if (level > LL_ERROR) return 0;
+  fprintf(stderr, "%s:%d ", fname, line);
+  return 1;
+}
+
+void cs_log_printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+static void fill(struct cs_frbuf *b, const struct config *c, char *rec) {
+  struct mg_str recs[BATCH_SIZE];
+  for (int i = 0; i < RECS_PER_ROUND; i += c->batch) {
+    if (c->batch == 1) {
+      if (!cs_frbuf_append(b, rec, REC_SIZE)) abort();
+      continue;
+    }
+    for (int j = 0; j < c->batch; j++) {
+      recs[j].p = rec;
+      recs[j].len = REC_SIZE;
+    }
+    if (cs_frbuf_append_batch(b, recs, c->batch) != c->batch) abort();
+  }
+}
+
+static void drain(struct cs_frbuf *b, const struct config *c) {
+  struct mg_str recs[BATCH_SIZE];
+  for (int i = 0; i < RECS_PER_ROUND; i += c->batch) {
+    if (c->batch == 1) {
+      char *data = NULL;
+      if (cs_frbuf_get(b, &data) != REC_SIZE) abort();
+      free(data);
+      continue;
+    }
+    if (cs_frbuf_get_batch(b, recs, c->batch) != c->batch) abort();
+    for (int j = 0; j < c->batch; j++) free((char *) recs[j].p);
+  }
+}
+
+static void run_one(const struct config *c) {
+  char rec[REC_SIZE];
+  double append_time = 0, get_time = 0;
+  memset(rec, 'x', sizeof(rec));
+  remove(BENCH_FILE);
+  struct cs_frbuf *b = cs_frbuf_init(BENCH_FILE, BUF_SIZE);
+  if (b == NULL) abort();
+  cs_frbuf_set_sync_policy(b, &c->policy);
+  for (int r = 0; r < NUM_ROUNDS; r++) {
+    double start = bench_now();
+    fill(b, c, rec);
+    if (c->policy.max_records == 0 && c->policy.max_ms == 0) cs_frbuf_sync(b);
+    append_time += bench_now() - start;
+    start = bench_now();
+    drain(b, c);
+    if (c->policy.max_records == 0 && c->policy.max_ms == 0) cs_frbuf_sync(b);
+    get_time += bench_now() - start;
+  }
+  cs_frbuf_deinit(b);
+  remove(BENCH_FILE);
+  printf("%-20s %14.0f %14.0f\n", c->name,
+         RECS_PER_ROUND * NUM_ROUNDS / append_time,
+         RECS_PER_ROUND * NUM_ROUNDS / get_time);
+}
+
+int main(void) {
+  printf("%-20s %14s %14s\n", "mode", "append recs/s", "get recs/s");
+  for (size_t i = 0; i < ARRAY_SIZE(s_configs); i++) {
+    run_one(&s_configs[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Accuracy of the timerfd-based HW timer emulation on ubuntu: arms a
+ * periodic HW timer for a range of periods and prints what
+ * ubuntu_hw_timers_get_stats() reports.
+ *
+ * The reported numbers are checked against what the callback sees:
+ *  - the callback runs once per reported firing;
+ *  - firings and overruns together account for the elapsed time;
+ *  - reported lateness is never negative and never exceeds the lateness
+ *    measured in the callback, which runs after the stats are updated.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/platform.h"
+#include "mgos_hw_timers_hal.h"
+#include "ubuntu.h"
+
+#include "bench_util.h"
+
+#define RUN_SECONDS 0.5
+
+static const int s_periods_us[] = {100, 250, 1000, 5000};
+
+static pthread_mutex_t s_ints_lock;
+
+/* Normally reached through mgos_clear_timer(), which needs the SW timers. */
+void mgos_clear_hw_timer(mgos_timer_id id);
+
+static struct {
+  mgos_timer_id id;
+  int period_us;
+  double armed_at;
+  uint32_t base_expirations; /* Counted by the stats before this run */
+  uint32_t num_calls;
+  int64_t max_lateness_us;
+} s_ht;
+
+/* Stand-ins for ubuntu_hal_system.c and the log. */
+void mgos_ints_disable(void) {
+  pthread_mutex_lock(&s_ints_lock);
+}
+
+void mgos_ints_enable(void) {
+  pthread_mutex_unlock(&s_ints_lock);
+}
+
+int cs_log_print_prefix(enum cs_log_level level, const char *fname,
+                        int line) {
+  fprintf(stderr, "%s:%d ", fname, line);
+  (void) level;
+  return 1;
+}
+
+void cs_log_printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+static void timer_cb(void *arg) {
+  struct ubuntu_hw_timer_stats st;
+  double now = bench_now();
+  /* The stats already count this firing and the overruns before it. */
+  ubuntu_hw_timers_get_stats(s_ht.id, &st);
+  uint32_t n = st.num_fired + st.num_overruns - s_ht.base_expirations;
+  double deadline = s_ht.armed_at + s_ht.period_us * 1e-6 * n;
+  int64_t lateness_us = (int64_t)((now - deadline) * 1e6);
+  if (lateness_us > s_ht.max_lateness_us) s_ht.max_lateness_us = lateness_us;
+  s_ht.num_calls++;
+  (void) arg;
+}
+
+static bool run_one(int period_us) {
+  struct ubuntu_hw_timer_stats st0, st;
+  mgos_ints_disable();
+  s_ht.period_us = period_us;
+  s_ht.num_calls = 0;
+  s_ht.max_lateness_us = 0;
+  s_ht.armed_at = bench_now();
+  s_ht.id = mgos_set_hw_timer(period_us, MGOS_TIMER_REPEAT, timer_cb, NULL);
+  ubuntu_hw_timers_get_stats(s_ht.id, &st0);
+  s_ht.base_expirations = st0.num_fired + st0.num_overruns;
+  mgos_ints_enable();
+  if (s_ht.id == MGOS_INVALID_TIMER_ID) {
+    fprintf(stderr, "failed to set HW timer\n");
+    return false;
+  }
+  usleep(RUN_SECONDS * 1000000);
+  mgos_ints_disable();
+  double elapsed = bench_now() - s_ht.armed_at;
+  mgos_clear_hw_timer(s_ht.id);
+  ubuntu_hw_timers_get_stats(s_ht.id, &st);
+  mgos_ints_enable();
+
+  /* Stats accumulate over all the times a timer is set. */
+  uint32_t fired = st.num_fired - st0.num_fired;
+  uint32_t overruns = st.num_overruns - st0.num_overruns;
+  int64_t total_lateness_us = st.total_lateness_us - st0.total_lateness_us;
+  long expected = (long) (elapsed * 1e6 / period_us);
+  long expirations = (long) fired + overruns;
+  bool ok = (fired > 0 && fired == s_ht.num_calls &&
+             expirations <= expected &&
+             /* Expirations still pending when cleared are not counted. */
+             expirations >= expected - 1 - expected / 100 &&
+             total_lateness_us >= 0 && st.max_lateness_us >= 0 &&
+             (st.max_lateness_us <= s_ht.max_lateness_us ||
+              st.max_lateness_us <= st0.max_lateness_us));
+  printf("%9d %8u %9u %10.1f %10lld %6s\n", period_us, fired, overruns,
+         (fired > 0 ? (double) total_lateness_us / fired : 0),
+         (long long) st.max_lateness_us, (ok ? "ok" : "bad"));
+  return ok;
+}
+
+int main(void) {
+  pthread_mutexattr_t ma;
+  pthread_mutexattr_init(&ma);
+  pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&s_ints_lock, &ma);
+  pthread_mutexattr_destroy(&ma);
+  if (mgos_hw_timers_init() != MGOS_INIT_OK) {
+    fprintf(stderr, "init failed\n");
+    return 1;
+  }
+  bool ok = true;
+  printf("%9s %8s %9s %10s %10s %6s\n", "period us", "fired", "overruns",
+         "avg late", "max late", "stats");
+  for (size_t i = 0; i < ARRAY_SIZE(s_periods_us); i++) {
+    if (!run_one(s_periods_us[i])) ok = false;
+  }
+  mgos_hw_timers_deinit();
+  return (ok ? 0 : 1);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-ins for the parts of the firmware that benchmarks linking
+ * mgos_uart.c need: locks, a minimal emulation of the Mongoose poll loop
+ * and a few Mongoose helpers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mgos_mongoose.h"
+#include "mgos_system.h"
+
+#include "bench_util.h"
+
+#define MAX_POLL_CBS 8
+
+static struct {
+  mgos_poll_cb_t cb;
+  void *cb_arg;
+} s_poll_cbs[MAX_POLL_CBS];
+static int s_num_poll_cbs;
+static bool s_poll_scheduled;
+
+struct mgos_rlock_type *mgos_rlock_create(void) {
+  return NULL;
+}
+
+void mgos_rlock(struct mgos_rlock_type *l) {
+}
+
+void mgos_runlock(struct mgos_rlock_type *l) {
+}
+
+void mgos_add_poll_cb(mgos_poll_cb_t cb, void *cb_arg) {
+  if (s_num_poll_cbs == MAX_POLL_CBS) abort();
+  s_poll_cbs[s_num_poll_cbs].cb = cb;
+  s_poll_cbs[s_num_poll_cbs].cb_arg = cb_arg;
+  s_num_poll_cbs++;
+}
+
+void mongoose_schedule_poll(bool from_isr) {
+  s_poll_scheduled = true;
+  (void) from_isr;
+}
+
+bool bench_mgos_poll(bool force) {
+  if (!s_poll_scheduled && !force) return false;
+  s_poll_scheduled = false;
+  for (int i = 0; i < s_num_poll_cbs; i++) {
+    s_poll_cbs[i].cb(s_poll_cbs[i].cb_arg);
+  }
+  return true;
+}
+
+int mg_avprintf(char **buf, size_t size, const char *fmt, va_list ap) {
+  return vsnprintf(*buf, size, fmt, ap);
+}
+
+struct mg_str mg_mk_str_n(const char *s, size_t len) {
+  struct mg_str ret = {s, len};
+  return ret;
+}
+
+void mbuf_resize(struct mbuf *a, size_t new_size) {
+}
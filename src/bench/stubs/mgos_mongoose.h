@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for the Mongoose library header, enough for the benchmarks
+ * that link mgos_uart.c. The functions are implemented in mgos_stubs.c.
+ */
+
+#ifndef CS_FW_SRC_BENCH_STUBS_MGOS_MONGOOSE_H_
+#define CS_FW_SRC_BENCH_STUBS_MGOS_MONGOOSE_H_
+
+#include <stdbool.h>
+
+#include "common/mbuf.h"
+#include "common/mg_str.h"
+#include "common/str_util.h"
+
+typedef void (*mgos_poll_cb_t)(void *cb_arg);
+
+void mgos_add_poll_cb(mgos_poll_cb_t cb, void *cb_arg);
+
+void mongoose_schedule_poll(bool from_isr);
+
+#endif /* CS_FW_SRC_BENCH_STUBS_MGOS_MONGOOSE_H_ */
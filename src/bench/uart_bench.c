@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * UART throughput and latency through mgos_uart_write() -> HAL ->
+ * mgos_uart_read(), over the loopback HAL (UART0 -> UART1), with a sweep
+ * over buffer sizes, rx_linger_micros and flow control modes.
+ *
+ * For each configuration:
+ *  - throughput: UART0 sends THROUGHPUT_BYTES as fast as it can, UART1
+ *    reads in its dispatcher callback. Reports bytes/s, dispatcher
+ *    callback invocations per KB received, bytes lost and whether what was
+ *    received is the sent data with only gaps in it ("lost") or not
+ *    ("corrupted");
+ *  - latency: NUM_PINGS messages of PING_SIZE bytes are sent one at a time,
+ *    reports the time until each is fully read on the other end.
+ *
+ * Output is CSV, one line per configuration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgos_uart.h"
+#include "mgos_uart_hal.h"
+
+#include "bench_util.h"
+#include "uart_loopback_hal.h"
+
+#define THROUGHPUT_BYTES (1024 * 1024)
+#define WRITE_CHUNK_SIZE 1000
+#define NUM_PINGS 500
+#define PING_SIZE 16
+
+static const int s_buf_sizes[] = {64, 256, 1024, 4096};
+static const int s_lingers[] = {0, 15, 100, 1000};
+static const enum mgos_uart_fc_type s_fc_types[] = {
+    MGOS_UART_FC_NONE, MGOS_UART_FC_HW, MGOS_UART_FC_SW,
+};
+static const char *s_fc_names[] = {"none", "hw", "sw"};
+
+static uint8_t s_data[THROUGHPUT_BYTES];
+static size_t s_num_recd;
+static size_t s_data_pos; /* Position in s_data matched so far. */
+static bool s_corrupted;
+static unsigned long s_num_dispatches;
+
+/*
+ * Match received bytes against s_data, allowing for gaps where bytes were
+ * lost. Matching each byte at its earliest possible position finds a match
+ * if there is one, s_data is pseudo-random so corruption does not go
+ * unnoticed for long.
+ */
+static void check_data(const uint8_t *buf, size_t n) {
+  for (size_t i = 0; i < n && !s_corrupted; i++) {
+    while (s_data_pos < sizeof(s_data) && s_data[s_data_pos] != buf[i]) {
+      s_data_pos++;
+    }
+    if (s_data_pos == sizeof(s_data)) {
+      s_corrupted = true;
+    } else {
+      s_data_pos++;
+    }
+  }
+}
+
+static void rx_dispatcher(int uart_no, void *arg) {
+  uint8_t buf[512];
+  size_t n;
+  s_num_dispatches++;
+  while ((n = mgos_uart_read(uart_no, buf, sizeof(buf))) > 0) {
+    check_data(buf, n);
+    s_num_recd += n;
+  }
+}
+
+static void configure(int buf_size, int linger, enum mgos_uart_fc_type fc) {
+  for (int uart_no = 0; uart_no < 2; uart_no++) {
+    struct mgos_uart_config cfg;
+    mgos_uart_config_set_defaults(uart_no, &cfg);
+    cfg.rx_buf_size = cfg.tx_buf_size = buf_size;
+    cfg.rx_linger_micros = linger;
+    cfg.rx_fc_type = cfg.tx_fc_type = fc;
+    if (!mgos_uart_configure(uart_no, &cfg)) abort();
+    mgos_uart_set_rx_enabled(uart_no, true);
+  }
+  mgos_uart_set_dispatcher(1, rx_dispatcher, NULL);
+}
+
+static void run_loop(void) {
+  bench_mgos_poll(uart_loopback_pending());
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double da = *(const double *) a, db = *(const double *) b;
+  return (da < db ? -1 : (da > db ? 1 : 0));
+}
+
+static void run_one(int buf_size, int linger, int fci) {
+  configure(buf_size, linger, s_fc_types[fci]);
+  const struct mgos_uart_stats *st = mgos_uart_get_stats(1);
+  uint32_t overflows = st->rx_overflows;
+
+  /* Throughput */
+  size_t sent = 0;
+  s_num_recd = 0;
+  s_data_pos = 0;
+  s_corrupted = false;
+  s_num_dispatches = 0;
+  double start = bench_now();
+  while (sent < sizeof(s_data) || !uart_loopback_idle()) {
+    if (sent < sizeof(s_data)) {
+      struct mg_str s = {(const char *) s_data + sent,
+                         MIN(sizeof(s_data) - sent, WRITE_CHUNK_SIZE)};
+      sent += mgos_uart_writev_nb(0, &s, 1);
+    }
+    run_loop();
+  }
+  double elapsed = bench_now() - start;
+  unsigned long dispatches = s_num_dispatches;
+  overflows = st->rx_overflows - overflows;
+  size_t lost = sizeof(s_data) - MIN(s_num_recd, sizeof(s_data));
+  const char *data_status =
+      (s_corrupted || s_num_recd > sizeof(s_data) ? "corrupted"
+                                                   : (lost > 0 ? "lost" : "ok"));
+
+  /* Latency */
+  static double latencies[NUM_PINGS];
+  for (int i = 0; i < NUM_PINGS; i++) {
+    s_num_recd = s_data_pos = 0;
+    double t0 = bench_now();
+    mgos_uart_write(0, s_data, PING_SIZE);
+    while (s_num_recd < PING_SIZE) run_loop();
+    latencies[i] = bench_now() - t0;
+  }
+  qsort(latencies, NUM_PINGS, sizeof(latencies[0]), cmp_double);
+
+  size_t recd = sizeof(s_data) - lost;
+  printf("%d,%d,%s,%.0f,%.2f,%u,%zu,%s,%.1f,%.1f\n", buf_size, linger,
+         s_fc_names[fci], recd / elapsed,
+         (recd > 0 ? dispatches * 1024.0 / recd : 0), overflows, lost,
+         data_status, latencies[NUM_PINGS / 2] * 1e6,
+         latencies[NUM_PINGS * 99 / 100] * 1e6);
+}
+
+int main(void) {
+  /*
+   * Pseudo-random payload (see check_data) that does not contain XON/XOFF,
+   * so all modes carry the same.
+   */
+  uint32_t x = 2463534242;
+  for (size_t i = 0; i < sizeof(s_data); i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_data[i] = (uint8_t)(x >> 24);
+    if (s_data[i] == MGOS_UART_XON_CHAR || s_data[i] == MGOS_UART_XOFF_CHAR) {
+      s_data[i] = 'x';
+    }
+  }
+  printf(
+      "buf_size,linger_us,fc,bytes_per_s,dispatches_per_kb,rx_overflows,lost,"
+      "data,lat_p50_us,lat_p99_us\n");
+  for (size_t i = 0; i < ARRAY_SIZE(s_buf_sizes); i++) {
+    for (size_t j = 0; j < ARRAY_SIZE(s_lingers); j++) {
+      for (size_t k = 0; k < ARRAY_SIZE(s_fc_types); k++) {
+        run_one(s_buf_sizes[i], s_lingers[j], k);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * UART receive throughput with software flow control, through the generic
+ * UART code and a fake HAL that feeds data from memory:
+ *  - "none": no flow control, for reference;
+ *  - "sw-bytewise": the old read path, a per-byte XON/XOFF switch;
+ *  - "sw": XON/XOFF filtering at ingest, as done by mgos_uart.c now.
+ * Input is either clean or has a control character every 4 KB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgos_uart_hal.h"
+
+#include "bench_util.h"
+
+#define RX_BUF_SIZE 1024
+#define INPUT_SIZE (256 * 1024)
+#define NUM_ROUNDS 200
+
+static uint8_t s_input[INPUT_SIZE];
+static size_t s_input_pos;
+
+bool mgos_uart_hal_init(struct mgos_uart_state *us) {
+  return true;
+}
+
+bool mgos_uart_hal_configure(struct mgos_uart_state *us,
+                             const struct mgos_uart_config *cfg) {
+  return true;
+}
+
+void mgos_uart_hal_config_set_defaults(int uart_no,
+                                       struct mgos_uart_config *cfg) {
+}
+
+void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
+  cs_rbuf_t *rxb = &us->rx_buf;
+  while (s_input_pos < INPUT_SIZE && rxb->avail > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_contig_tail_space(rxb, &data);
+    if (n > rxb->avail) n = rxb->avail;
+    if (n > INPUT_SIZE - s_input_pos) n = INPUT_SIZE - s_input_pos;
+    memcpy(data, s_input + s_input_pos, n);
+    cs_rbuf_advance_tail(rxb, n);
+    s_input_pos += n;
+  }
+}
+
+void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
+}
+
+void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
+}
+
+void mgos_uart_hal_flush_fifo(struct mgos_uart_state *us) {
+}
+
+void mgos_uart_hal_set_rx_enabled(struct mgos_uart_state *us, bool enabled) {
+}
+
+/* The old mgos_uart_read() loop. */
+static size_t read_bytewise(struct mgos_uart_state *us, uint8_t *buf,
+                            size_t len) {
+  struct mg_str spans[2];
+  size_t j = 0, tr = mgos_uart_rx_peek(0, spans);
+  if (tr > len) tr = len;
+  for (size_t i = 0; i < tr; i++) {
+    uint8_t ch = (uint8_t)(i < spans[0].len ? spans[0].p[i]
+                                            : spans[1].p[i - spans[0].len]);
+    switch (ch) {
+      case MGOS_UART_XON_CHAR:
+        us->xoff_recd = false;
+        break;
+      case MGOS_UART_XOFF_CHAR:
+        us->xoff_recd = true;
+        break;
+      default:
+        buf[j++] = ch;
+        break;
+    }
+  }
+  mgos_uart_rx_consume(0, tr);
+  return tr;
+}
+
+static void run_one(const char *name, enum mgos_uart_fc_type fc, bool bytewise,
+                    bool with_fc_chars) {
+  static uint8_t out[RX_BUF_SIZE];
+  struct mgos_uart_config cfg;
+  mgos_uart_config_set_defaults(0, &cfg);
+  cfg.rx_buf_size = RX_BUF_SIZE;
+  cfg.tx_fc_type = fc;
+  mgos_uart_configure(0, &cfg);
+  mgos_uart_set_rx_enabled(0, true);
+  struct mgos_uart_state *us = mgos_uart_hal_get_state(0);
+
+  for (size_t i = 0; i < INPUT_SIZE; i++) {
+    s_input[i] = (uint8_t)(i * 7 + 1);
+    if (s_input[i] == MGOS_UART_XON_CHAR || s_input[i] == MGOS_UART_XOFF_CHAR) {
+      s_input[i] = 'x';
+    }
+  }
+  if (with_fc_chars) {
+    for (size_t i = 4096; i < INPUT_SIZE; i += 4096) {
+      s_input[i] = MGOS_UART_XON_CHAR;
+    }
+  }
+
+  double start = bench_now();
+  for (int i = 0; i < NUM_ROUNDS; i++) {
+    s_input_pos = 0;
+    while (s_input_pos < INPUT_SIZE || us->rx_buf.used > 0) {
+      if (bytewise) {
+        read_bytewise(us, out, sizeof(out));
+      } else {
+        mgos_uart_read(0, out, sizeof(out));
+      }
+    }
+  }
+  double elapsed = bench_now() - start;
+  printf("%-12s %-8s %10.1f\n", name, (with_fc_chars ? "4K" : "clean"),
+         (double) INPUT_SIZE * NUM_ROUNDS / elapsed / 1e6);
+}
+
+int main(void) {
+  printf("%-12s %-8s %10s\n", "mode", "fc chars", "MB/s");
+  for (int with_fc_chars = 0; with_fc_chars <= 1; with_fc_chars++) {
+    run_one("none", MGOS_UART_FC_NONE, false, with_fc_chars);
+    run_one("sw-bytewise", MGOS_UART_FC_NONE, true, with_fc_chars);
+    run_one("sw", MGOS_UART_FC_SW, false, with_fc_chars);
+  }
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uart_loopback_hal.h"
+
+#include "mgos_uart_hal.h"
+
+#include "bench_util.h"
+
+#define LB_FIFO_SIZE 128
+#define LB_RX_FIFO_FULL_THRESH 120
+#define LB_ISR_BUF_SIZE 256
+/* Receiver with software flow control sends XOFF when it can take less. */
+#define LB_XOFF_THRESH LB_FIFO_SIZE
+
+struct lb_uart {
+  cs_rbuf_t fifo;       /* The hardware RX FIFO */
+  cs_rbuf_t isr_rx_buf; /* Filled by the "ISR", emptied by the dispatcher */
+  double last_rx;
+};
+
+static struct lb_uart s_lb[MGOS_MAX_NUM_UARTS];
+
+static struct mgos_uart_state *lb_peer(const struct mgos_uart_state *us) {
+  int peer_no = us->uart_no ^ 1;
+  if (peer_no >= MGOS_MAX_NUM_UARTS) return NULL;
+  return mgos_uart_hal_get_state(peer_no);
+}
+
+/* How many bytes the UART can take in right now. */
+static size_t lb_capacity(const struct mgos_uart_state *us) {
+  const struct lb_uart *l = (const struct lb_uart *) us->dev_data;
+  return l->fifo.avail + l->isr_rx_buf.avail;
+}
+
+/* RX interrupt: move data from the FIFO to the ISR buffer. */
+static void lb_rx_isr(struct mgos_uart_state *us) {
+  struct lb_uart *l = (struct lb_uart *) us->dev_data;
+  us->stats.ints++;
+  us->stats.rx_ints++;
+  while (l->fifo.used > 0 && l->isr_rx_buf.avail > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(&l->fifo, l->isr_rx_buf.avail, &data);
+    cs_rbuf_append(&l->isr_rx_buf, data, n);
+    cs_rbuf_consume(&l->fifo, n);
+  }
+}
+
+/* Put data on the wire, returns the number of bytes received by the peer. */
+static size_t lb_deliver(struct mgos_uart_state *us, const uint8_t *data,
+                         size_t len, bool urgent) {
+  struct mgos_uart_state *peer = lb_peer(us);
+  if (peer == NULL) return len;
+  struct lb_uart *pl = (struct lb_uart *) peer->dev_data;
+  size_t delivered = 0;
+  for (;;) {
+    uint16_t n = MIN(len - delivered, pl->fifo.avail);
+    cs_rbuf_append(&pl->fifo, data + delivered, n);
+    delivered += n;
+    if (pl->fifo.used >= LB_RX_FIFO_FULL_THRESH || urgent) {
+      uint16_t used = pl->fifo.used;
+      lb_rx_isr(peer);
+      /* Peer is full, the rest is lost. */
+      if (pl->fifo.used == used && delivered < len) break;
+    }
+    if (delivered == len) break;
+  }
+  pl->last_rx = bench_now();
+  if (delivered < len) peer->stats.rx_overflows += len - delivered;
+  if (peer->cfg.rx_fc_type == MGOS_UART_FC_SW && !peer->xoff_sent &&
+      lb_capacity(peer) < LB_XOFF_THRESH) {
+    uint8_t xoff = MGOS_UART_XOFF_CHAR;
+    lb_deliver(peer, &xoff, 1, true /* urgent */);
+    peer->xoff_sent = true;
+  }
+  mgos_uart_schedule_dispatcher(peer->uart_no, true /* from_isr */);
+  return delivered;
+}
+
+bool mgos_uart_hal_init(struct mgos_uart_state *us) {
+  struct lb_uart *l = &s_lb[us->uart_no];
+  cs_rbuf_init(&l->fifo, LB_FIFO_SIZE);
+  cs_rbuf_init(&l->isr_rx_buf, LB_ISR_BUF_SIZE);
+  us->dev_data = l;
+  return true;
+}
+
+bool mgos_uart_hal_configure(struct mgos_uart_state *us,
+                             const struct mgos_uart_config *cfg) {
+  return true;
+}
+
+void mgos_uart_hal_config_set_defaults(int uart_no,
+                                       struct mgos_uart_config *cfg) {
+}
+
+void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
+  struct lb_uart *l = (struct lb_uart *) us->dev_data;
+  size_t rxb_free;
+  if (l->fifo.used > 0) {
+    if ((bench_now() - l->last_rx) * 1e6 >= us->cfg.rx_linger_micros) {
+      lb_rx_isr(us);
+    } else {
+      us->stats.rx_linger_conts++;
+    }
+  }
+  while (l->isr_rx_buf.used > 0 && (rxb_free = mgos_uart_rxb_free(us)) > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(&l->isr_rx_buf, rxb_free, &data);
+    cs_rbuf_append(&us->rx_buf, data, n);
+    cs_rbuf_consume(&l->isr_rx_buf, n);
+    us->stats.rx_bytes += n;
+  }
+}
+
+void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
+  struct mgos_uart_state *peer = lb_peer(us);
+  cs_rbuf_t *txb = &us->tx_buf;
+  size_t max = LB_FIFO_SIZE;
+  if (peer != NULL && us->cfg.tx_fc_type == MGOS_UART_FC_HW &&
+      peer->cfg.rx_fc_type == MGOS_UART_FC_HW) {
+    max = MIN(max, lb_capacity(peer));
+  }
+  if (txb->used > 0 && max > 0) {
+    us->stats.ints++;
+    us->stats.tx_ints++;
+  }
+  while (txb->used > 0 && max > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(txb, max, &data);
+    lb_deliver(us, data, n, false /* urgent */);
+    cs_rbuf_consume(txb, n);
+    us->stats.tx_bytes += n;
+    max -= n;
+  }
+}
+
+void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
+  struct lb_uart *l = (struct lb_uart *) us->dev_data;
+  /* RX data waiting for space in rx_buf, TX empty interrupt. */
+  if ((l->isr_rx_buf.used > 0 && mgos_uart_rxb_free(us) > 0) ||
+      (us->tx_buf.used > 0 && !us->xoff_recd)) {
+    mgos_uart_schedule_dispatcher(us->uart_no, true /* from_isr */);
+  }
+}
+
+void mgos_uart_hal_flush_fifo(struct mgos_uart_state *us) {
+}
+
+void mgos_uart_hal_set_rx_enabled(struct mgos_uart_state *us, bool enabled) {
+}
+
+bool uart_loopback_pending(void) {
+  double now = bench_now();
+  for (int i = 0; i < MGOS_MAX_NUM_UARTS; i++) {
+    const struct mgos_uart_state *us = mgos_uart_hal_get_state(i);
+    if (us == NULL || s_lb[i].fifo.used == 0) continue;
+    if ((now - s_lb[i].last_rx) * 1e6 >= us->cfg.rx_linger_micros) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool uart_loopback_idle(void) {
+  for (int i = 0; i < MGOS_MAX_NUM_UARTS; i++) {
+    const struct mgos_uart_state *us = mgos_uart_hal_get_state(i);
+    if (us == NULL) continue;
+    if (s_lb[i].fifo.used > 0 || s_lb[i].isr_rx_buf.used > 0 ||
+        us->rx_buf.used > 0 || us->tx_buf.used > 0) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CS_FW_SRC_BENCH_UART_LOOPBACK_HAL_H_
+#define CS_FW_SRC_BENCH_UART_LOOPBACK_HAL_H_
+
+#include <stdbool.h>
+
+/*
+ * Loopback UART HAL: UARTs 0 and 1 (2 and 3, etc.) are connected to each
+ * other by an in-memory wire. Each UART has an RX FIFO which is emptied
+ * into an ISR buffer right away once it reaches the threshold, and by the
+ * dispatcher once no new data has arrived for rx_linger_micros. The
+ * dispatcher moves data from the ISR buffer to rx_buf.
+ * Without flow control, data that does not fit is lost and counted as
+ * rx_overflows. With hardware flow control the sender stops when the
+ * receiver is full. With software flow control the receiver sends XOFF
+ * when it is about to be full.
+ */
+
+/* Returns true if the dispatcher has work to do that no event will
+ * trigger: lingering RX data whose time is up. */
+bool uart_loopback_pending(void);
+
+/* Returns true if there is no data anywhere between the two ends. */
+bool uart_loopback_idle(void);
+
+#endif /* CS_FW_SRC_BENCH_UART_LOOPBACK_HAL_H_ */
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Event loop idle CPU and wake-to-callback latency for:
+ *  - "spin-1ms": the old ubuntu loop, polling with a 1 ms timeout and
+ *    picking up work on the next iteration;
+ *  - "socketpair": a blocking poll woken by a socketpair write, which is
+ *    what mg_broadcast() does (without the handler dispatch);
+ *  - "wakeup": a blocking poll woken by cs_wakeup (eventfd on Linux).
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/cs_wakeup.h"
+#include "common/platform.h"
+
+#include "bench_util.h"
+
+#define IDLE_SECONDS 2
+#define NUM_WAKEUPS 2000
+
+enum mode {
+  MODE_SPIN,
+  MODE_SOCKETPAIR,
+  MODE_WAKEUP,
+};
+
+static const char *s_mode_names[] = {"spin-1ms", "socketpair", "wakeup"};
+
+static enum mode s_mode;
+static struct cs_wakeup s_wakeup;
+static int s_sp[2];
+static volatile int s_running;
+static int s_pending, s_done;
+static double s_posted_at;
+static double s_latencies[NUM_WAKEUPS];
+static volatile long s_loops;
+
+static void loop_wait(void) {
+  struct pollfd pfd = {.fd = -1, .events = POLLIN};
+  int timeout = 1000;
+  switch (s_mode) {
+    case MODE_SPIN:
+      timeout = 1;
+      break;
+    case MODE_SOCKETPAIR:
+      pfd.fd = s_sp[1];
+      break;
+    case MODE_WAKEUP:
+      pfd.fd = s_wakeup.rfd;
+      break;
+  }
+  if (poll(&pfd, 1, timeout) > 0) {
+    if (s_mode == MODE_SOCKETPAIR) {
+      char buf[64];
+      if (recv(s_sp[1], buf, sizeof(buf), 0) < 0) abort();
+    } else {
+      cs_wakeup_drain(&s_wakeup);
+    }
+  }
+}
+
+static void loop_signal(void) {
+  switch (s_mode) {
+    case MODE_SPIN:
+      break;
+    case MODE_SOCKETPAIR: {
+      char c = 0;
+      if (send(s_sp[0], &c, 1, 0) < 0) abort();
+      break;
+    }
+    case MODE_WAKEUP:
+      cs_wakeup_signal(&s_wakeup);
+      break;
+  }
+}
+
+static double thread_cpu_time(pthread_t t) {
+  clockid_t cid;
+  struct timespec ts;
+  pthread_getcpuclockid(t, &cid);
+  clock_gettime(cid, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The event loop: runs "callbacks" posted by the producer. */
+static void *loop_thread(void *arg) {
+  while (s_running) {
+    if (__atomic_exchange_n(&s_pending, 0, __ATOMIC_ACQUIRE)) {
+      int i = __atomic_load_n(&s_done, __ATOMIC_RELAXED);
+      s_latencies[i] = bench_now() - s_posted_at;
+      __atomic_store_n(&s_done, i + 1, __ATOMIC_RELEASE);
+    }
+    loop_wait();
+    s_loops++;
+  }
+  (void) arg;
+  return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double da = *(const double *) a, db = *(const double *) b;
+  return (da < db ? -1 : (da > db ? 1 : 0));
+}
+
+static void run_one(enum mode mode) {
+  pthread_t t;
+
+  s_mode = mode;
+  s_done = 0;
+  s_loops = 0;
+  s_running = 1;
+  pthread_create(&t, NULL, loop_thread, NULL);
+  double cpu = thread_cpu_time(t);
+  usleep(IDLE_SECONDS * 1000000);
+  cpu = thread_cpu_time(t) - cpu;
+  long idle_loops = s_loops;
+
+  /* Post NUM_WAKEUPS callbacks one at a time, with gaps so the loop is
+   * idle each time. */
+  for (int i = 0; i < NUM_WAKEUPS; i++) {
+    s_posted_at = bench_now();
+    __atomic_store_n(&s_pending, 1, __ATOMIC_RELEASE);
+    loop_signal();
+    while (__atomic_load_n(&s_done, __ATOMIC_ACQUIRE) == i) usleep(50);
+    usleep(200);
+  }
+
+  s_running = 0;
+  loop_signal();
+  pthread_join(t, NULL);
+
+  qsort(s_latencies, NUM_WAKEUPS, sizeof(s_latencies[0]), cmp_double);
+  double sum = 0;
+  for (int i = 0; i < NUM_WAKEUPS; i++) sum += s_latencies[i];
+  printf("%-11s %12.1f %12.3f %10.1f %10.1f %10.1f\n", s_mode_names[mode],
+         idle_loops / (double) IDLE_SECONDS, cpu * 1000 / IDLE_SECONDS,
+         sum / NUM_WAKEUPS * 1e6, s_latencies[NUM_WAKEUPS / 2] * 1e6,
+         s_latencies[NUM_WAKEUPS * 99 / 100] * 1e6);
+}
+
+int main(void) {
+  if (!cs_wakeup_init(&s_wakeup) ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, s_sp) != 0) {
+    fprintf(stderr, "init failed\n");
+    return 1;
+  }
+  printf("%-11s %12s %12s %10s %10s %10s\n", "mode", "idle loops/s",
+         "cpu ms/s", "avg us", "p50 us", "p99 us");
+  for (size_t i = 0; i < ARRAY_SIZE(s_mode_names); i++) {
+    run_one((enum mode) i);
+  }
+  cs_wakeup_deinit(&s_wakeup);
+  return 0;
+}
@@ -16,8 +16,11 @@
  */
 
 #include "common/cs_frbuf.h"
+#include "common/cs_crc32.h"
 #include "common/cs_dbg.h"
+#include "common/cs_time.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,162 +29,597 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
-#define MAGIC 0x3142 /* B1 */
-#define FILE_HDR_SIZE sizeof(struct cs_frbuf_file_hdr)
-#define REC_HDR_SIZE sizeof(struct cs_frbuf_rec_hdr)
+/* Make sure synced data has reached the storage, not just the OS. */
+#ifndef CS_FRBUF_ENABLE_FSYNC
+#define CS_FRBUF_ENABLE_FSYNC (CS_PLATFORM == CS_P_UNIX)
+#endif
+
+#define MAGIC_V1 0x3142 /* B1 */
+#define MAGIC_V2 0x3242 /* B2 */
 
-struct cs_frbuf_file_hdr {
+/* v1: 16-bit offsets, record header is just the length. */
+struct cs_frbuf_file_hdr_v1 {
   uint16_t magic;
   uint16_t size, used;
   uint16_t head, tail;
 };
 
-struct cs_frbuf_rec_hdr {
+struct cs_frbuf_rec_hdr_v1 {
   uint16_t len;
 };
 
+/*
+ * v2: 32-bit offsets, records carry a sequence number and a CRC.
+ * There are two copies of the file header, written alternately, so that
+ * a torn header write leaves the previous one intact. On open, the newest
+ * valid copy is used and records appended after it was written (those that
+ * follow the tail with the expected sequence numbers and a good CRC) are
+ * picked up.
+ */
+struct cs_frbuf_file_hdr_v2 {
+  uint16_t magic;
+  uint16_t reserved;
+  uint32_t gen; /* Incremented on every write, the newer copy wins. */
+  uint32_t size, used;
+  uint32_t head, tail;
+  uint32_t seq; /* Sequence number of the next record to be appended. */
+  uint32_t crc; /* Of all the above. */
+};
+
+struct cs_frbuf_rec_hdr_v2 {
+  uint32_t len;
+  uint32_t seq;
+  uint32_t crc; /* Of len, seq and data. */
+};
+
+#define V1_DATA_OFF sizeof(struct cs_frbuf_file_hdr_v1)
+#define V2_DATA_OFF (2 * sizeof(struct cs_frbuf_file_hdr_v2))
+
+/* Buffer state, same for both formats. Offsets are relative to the data. */
+struct cs_frbuf_state {
+  uint32_t size, used;
+  uint32_t head, tail;
+  uint32_t seq;
+};
+
 struct cs_frbuf {
   FILE *fp;
-  struct cs_frbuf_file_hdr hdr;
+  enum cs_frbuf_format format;
+  uint32_t data_off;     /* File offset of the data area. */
+  uint32_t rec_hdr_size; /* Size of the record header. */
+  uint32_t gen;          /* Generation of the last v2 header written. */
+  struct cs_frbuf_state hdr;
+  struct cs_frbuf_state synced; /* State as last written to the file. */
+  struct cs_frbuf_sync_policy policy;
+  uint32_t num_unsynced; /* Records appended or consumed since last sync. */
+  double unsynced_since; /* cs_time() of the first unsynced change. */
+  uint32_t rd_pos;       /* Total bytes of records removed, for cursors. */
+  uint32_t rd_seq;       /* Total number of records removed. */
+  long fpos;             /* Current file position, -1 if not known. */
+  bool writing;          /* Last access was a write. */
 };
 
+/*
+ * Sequential accesses in the same direction do not seek: fseek() flushes
+ * stdio buffers, skipping it lets consecutive record writes go out together.
+ * Switching between reading and writing requires a seek.
+ */
+static void cs_fseek(struct cs_frbuf *b, size_t offset, bool write) {
+  if (b->fpos == (long) offset && b->writing == write) return;
+  fseek(b->fp, offset, SEEK_SET);
+  b->fpos = offset;
+  b->writing = write;
+}
+
 static size_t cs_pread(struct cs_frbuf *b, size_t offset, size_t size,
                        void *buf) {
-  fseek(b->fp, offset, SEEK_SET);
-  return fread(buf, 1, size, b->fp);
+  cs_fseek(b, offset, false /* write */);
+  size_t n = fread(buf, 1, size, b->fp);
+  b->fpos = (n == size ? b->fpos + (long) n : -1);
+  return n;
 }
 
 static size_t cs_pwrite(struct cs_frbuf *b, size_t offset, size_t size,
                         const void *buf) {
-  fseek(b->fp, offset, SEEK_SET);
-  return fwrite(buf, 1, size, b->fp);
+  cs_fseek(b, offset, true /* write */);
+  size_t n = fwrite(buf, 1, size, b->fp);
+  b->fpos = (n == size ? b->fpos + (long) n : -1);
+  return n;
 }
 
-static size_t write_hdr(struct cs_frbuf *b) {
-  if (b->hdr.used == 0) {
-    b->hdr.head = b->hdr.tail = 0;
+static bool cs_fflush(struct cs_frbuf *b) {
+  if (fflush(b->fp) != 0) return false;
+#if CS_FRBUF_ENABLE_FSYNC
+  if (fsync(fileno(b->fp)) != 0) return false;
+#endif
+  return true;
+}
+
+static uint32_t hdr_v2_crc(const struct cs_frbuf_file_hdr_v2 *h) {
+  return cs_crc32(0, h, offsetof(struct cs_frbuf_file_hdr_v2, crc));
+}
+
+static bool write_hdr(struct cs_frbuf *b) {
+  struct cs_frbuf_state st = b->hdr;
+  /* Empty buffer is stored rewound, the next append rewinds it in memory. */
+  if (st.used == 0) {
+    st.head = st.tail = 0;
+  }
+  if (b->format == CS_FRBUF_FORMAT_V1) {
+    struct cs_frbuf_file_hdr_v1 h = {
+        .magic = MAGIC_V1,
+        .size = st.size,
+        .used = st.used,
+        .head = st.head,
+        .tail = st.tail,
+    };
+    if (cs_pwrite(b, 0, sizeof(h), &h) != sizeof(h)) return false;
+  } else {
+    struct cs_frbuf_file_hdr_v2 h = {
+        .magic = MAGIC_V2,
+        .reserved = 0,
+        .gen = b->gen + 1,
+        .size = st.size,
+        .used = st.used,
+        .head = st.head,
+        .tail = st.tail,
+        .seq = st.seq,
+    };
+    h.crc = hdr_v2_crc(&h);
+    if (cs_pwrite(b, (h.gen % 2) * sizeof(h), sizeof(h), &h) != sizeof(h)) {
+      return false;
+    }
+    b->gen = h.gen;
+  }
+  b->synced = st;
+  return true;
+}
+
+static bool read_hdr_v2(struct cs_frbuf *b, int slot,
+                        struct cs_frbuf_file_hdr_v2 *h) {
+  return (cs_pread(b, slot * sizeof(*h), sizeof(*h), h) == sizeof(*h) &&
+          h->magic == MAGIC_V2 && h->crc == hdr_v2_crc(h));
+}
+
+static void set_format(struct cs_frbuf *b, enum cs_frbuf_format format) {
+  b->format = format;
+  if (format == CS_FRBUF_FORMAT_V1) {
+    b->data_off = V1_DATA_OFF;
+    b->rec_hdr_size = sizeof(struct cs_frbuf_rec_hdr_v1);
+  } else {
+    b->data_off = V2_DATA_OFF;
+    b->rec_hdr_size = sizeof(struct cs_frbuf_rec_hdr_v2);
+  }
+}
+
+static void frbuf_recover(struct cs_frbuf *b);
+
+/* Load an existing buffer. Returns false if it's invalid or empty. */
+static bool frbuf_load(struct cs_frbuf *b) {
+  uint16_t magic = 0;
+  fseek(b->fp, 0, SEEK_END);
+  long fsize = ftell(b->fp);
+  if (cs_pread(b, 0, sizeof(magic), &magic) != sizeof(magic)) return false;
+  if (magic == MAGIC_V1) {
+    struct cs_frbuf_file_hdr_v1 h;
+    if (cs_pread(b, 0, sizeof(h), &h) != sizeof(h)) return false;
+    set_format(b, CS_FRBUF_FORMAT_V1);
+    b->hdr.size = h.size;
+    b->hdr.used = h.used;
+    b->hdr.head = h.head;
+    b->hdr.tail = h.tail;
+    b->hdr.seq = 0;
+  } else {
+    struct cs_frbuf_file_hdr_v2 h0, h1, *h;
+    bool v0 = read_hdr_v2(b, 0, &h0), v1 = read_hdr_v2(b, 1, &h1);
+    if (v0 && v1) {
+      h = ((int32_t)(h1.gen - h0.gen) > 0 ? &h1 : &h0);
+    } else if (v0 || v1) {
+      h = (v0 ? &h0 : &h1);
+    } else {
+      return false;
+    }
+    set_format(b, CS_FRBUF_FORMAT_V2);
+    b->gen = h->gen;
+    b->hdr.size = h->size;
+    b->hdr.used = h->used;
+    b->hdr.head = h->head;
+    b->hdr.tail = h->tail;
+    b->hdr.seq = h->seq;
+  }
+  if (b->hdr.size <= b->rec_hdr_size || b->hdr.used > b->hdr.size ||
+      b->hdr.head > b->hdr.size || b->hdr.tail > b->hdr.size) {
+    return false;
   }
-  return cs_pwrite(b, 0, FILE_HDR_SIZE, &b->hdr);
+  b->synced = b->hdr;
+  if (b->format == CS_FRBUF_FORMAT_V2) frbuf_recover(b);
+  /* Truncate the empty buffer */
+  return !(fsize > (long) b->data_off && b->hdr.used == 0);
 }
 
-struct cs_frbuf *cs_frbuf_init(const char *fname, uint16_t size) {
-  struct cs_frbuf *b = malloc(sizeof(*b));
+struct cs_frbuf *cs_frbuf_init(const char *fname, uint32_t size) {
+  return cs_frbuf_init_format(fname, size, CS_FRBUF_FORMAT_V2);
+}
+
+struct cs_frbuf *cs_frbuf_init_format(const char *fname, uint32_t size,
+                                      enum cs_frbuf_format format) {
+  struct cs_frbuf *b = calloc(1, sizeof(*b));
   if (b == NULL) return NULL;
+  b->policy.max_records = 1;
+  b->policy.max_ms = 0;
+  b->fpos = -1;
   b->fp = fopen(fname, "r+");
-  b->hdr.size = 0;
-  if (b->fp != NULL) {
-    fseek(b->fp, 0, SEEK_END);
-    long fsize = ftell(b->fp);
-    if (fsize >= (long) FILE_HDR_SIZE) {
-      fseek(b->fp, 0, SEEK_SET);
-      size_t nr = fread(&b->hdr, FILE_HDR_SIZE, 1, b->fp);
-      if (nr != 1 || b->hdr.magic != MAGIC ||
-          (fsize > (long) FILE_HDR_SIZE && b->hdr.used == 0)) {
-        /* Truncate the empty or invalid buffer */
-        b->hdr.size = 0;
-        fclose(b->fp);
-        b->fp = NULL;
-      }
-    }
+  if (b->fp != NULL && !frbuf_load(b)) {
+    /* Start over with the empty or invalid buffer */
+    fclose(b->fp);
+    b->fp = NULL;
   }
-  if (b->hdr.size == 0) {
-    if (b->fp == NULL) {
-      b->fp = fopen(fname, "w+");
-      if (b->fp == NULL) return false;
+  if (b->fp == NULL) {
+    set_format(b, format);
+    if (size <= b->data_off + b->rec_hdr_size ||
+        (format == CS_FRBUF_FORMAT_V1 && size - b->data_off > UINT16_MAX)) {
+      cs_frbuf_deinit(b);
+      return NULL;
     }
-    b->hdr.magic = MAGIC;
-    b->hdr.size = size - FILE_HDR_SIZE;
-    b->hdr.used = 0;
-    b->hdr.head = b->hdr.tail = 0;
-    if (write_hdr(b) != FILE_HDR_SIZE) {
+    b->fp = fopen(fname, "w+");
+    b->fpos = -1;
+    b->gen = 0;
+    memset(&b->hdr, 0, sizeof(b->hdr));
+    b->hdr.size = size - b->data_off;
+    if (b->fp == NULL || !write_hdr(b)) {
       cs_frbuf_deinit(b);
-      b = NULL;
+      return NULL;
     }
   }
-  if (b != NULL) fflush(b->fp);
+  fflush(b->fp);
   return b;
 }
 
 void cs_frbuf_deinit(struct cs_frbuf *b) {
-  if (b->fp != NULL) fclose(b->fp);
+  if (b->fp != NULL) {
+    cs_frbuf_sync(b);
+    fclose(b->fp);
+  }
   memset(b, 0, sizeof(*b));
   free(b);
 }
 
+bool cs_frbuf_sync(struct cs_frbuf *b) {
+  if (b->num_unsynced == 0) return true;
+  /* Records must be on disk before the header that refers to them. */
+  if (b->format == CS_FRBUF_FORMAT_V2 && !cs_fflush(b)) return false;
+  if (!write_hdr(b) || !cs_fflush(b)) return false;
+  b->num_unsynced = 0;
+  return true;
+}
+
+void cs_frbuf_set_sync_policy(struct cs_frbuf *b,
+                              const struct cs_frbuf_sync_policy *policy) {
+  b->policy = *policy;
+}
+
+/* Account for n records appended or consumed, sync if the policy says so. */
+static bool cs_frbuf_changed(struct cs_frbuf *b, uint32_t n) {
+  if (n == 0) return true;
+  if (b->num_unsynced == 0 && b->policy.max_ms > 0) {
+    b->unsynced_since = cs_time();
+  }
+  b->num_unsynced += n;
+  if (b->policy.max_records > 0 && b->num_unsynced >= b->policy.max_records) {
+    return cs_frbuf_sync(b);
+  }
+  if (b->policy.max_ms > 0) {
+    double elapsed = cs_time() - b->unsynced_since;
+    /* Wall time may be stepped back, sync then too. */
+    if (elapsed * 1000 >= b->policy.max_ms || elapsed < 0) {
+      return cs_frbuf_sync(b);
+    }
+  }
+  return true;
+}
+
+static int frbuf_get(struct cs_frbuf *b, char **data);
+
+/*
+ * Whether the region overlaps records in use according to the header in the
+ * file. Those are either still in use or consumed but not synced yet.
+ */
+static bool overlaps_synced_used(const struct cs_frbuf *b, size_t offset,
+                                 size_t size) {
+  size_t h = b->synced.head, t = b->synced.tail;
+  if (b->synced.used == 0) return false;
+  if (h < t) return (offset < t && offset + size > h);
+  return (offset < t || offset + size > h);
+}
+
 static size_t dpwrite(struct cs_frbuf *b, size_t offset, size_t size,
                       const void *buf) {
   /* If the region to be written overwrites current head record, throw away
    * until it doesn't. */
-  while (b->hdr.used > 0 && offset <= b->hdr.head &&
-         (offset + size > b->hdr.head)) {
-    int len = cs_frbuf_get(b, NULL);
-    if (len <= 0) return 0;
+  uint32_t discarded = 0;
+  while (b->hdr.used > 0) {
+    /* If the header doesn't fit at the end, the head record is at 0. */
+    size_t head = b->hdr.head;
+    if (b->hdr.size - head < b->rec_hdr_size) head = 0;
+    if (!(offset <= head && offset + size > head)) break;
+    int len = frbuf_get(b, NULL);
+    /* A corrupted record empties the buffer, carry on then. */
+    if (len <= 0 && b->hdr.used > 0) return 0;
+    discarded++;
+  }
+  /* The header in the file must not point at data that is about to be
+   * overwritten, so the new head is persisted first. */
+  b->num_unsynced += discarded;
+  if (discarded > 0 || overlaps_synced_used(b, offset, size)) {
+    if (!cs_frbuf_sync(b)) return 0;
   }
-  return cs_pwrite(b, offset + FILE_HDR_SIZE, size, buf);
+  return cs_pwrite(b, offset + b->data_off, size, buf);
+}
+
+static uint32_t rec_crc(const struct cs_frbuf_rec_hdr_v2 *rh) {
+  return cs_crc32(0, rh, offsetof(struct cs_frbuf_rec_hdr_v2, crc));
 }
 
-bool cs_frbuf_append(struct cs_frbuf *b, const void *data, uint16_t len) {
+/* Append a record without syncing. */
+static bool frbuf_append(struct cs_frbuf *b, const void *data, uint32_t len) {
+  struct cs_frbuf_rec_hdr_v1 rh1;
+  struct cs_frbuf_rec_hdr_v2 rh2;
+  const void *rhdr = &rh1;
+  uint32_t rhs = b->rec_hdr_size;
   if (len == 0) return false;
-  len = MIN(len, b->hdr.size - REC_HDR_SIZE);
-  if (b->hdr.size - b->hdr.tail < (uint16_t) REC_HDR_SIZE) b->hdr.tail = 0;
-  struct cs_frbuf_rec_hdr rhdr = {.len = len};
-  if (dpwrite(b, b->hdr.tail, REC_HDR_SIZE, &rhdr) != REC_HDR_SIZE) {
+  /* v1 record header can't describe it, refuse rather than truncate. */
+  if (b->format == CS_FRBUF_FORMAT_V1 && len > UINT16_MAX) return false;
+  if (b->hdr.used == 0) b->hdr.head = b->hdr.tail = 0;
+  len = MIN(len, b->hdr.size - rhs);
+  if (b->hdr.size - b->hdr.tail < rhs) b->hdr.tail = 0;
+  if (b->format == CS_FRBUF_FORMAT_V1) {
+    rh1.len = len;
+  } else {
+    rh2.len = len;
+    rh2.seq = b->hdr.seq;
+    rh2.crc = cs_crc32(rec_crc(&rh2), data, len);
+    rhdr = &rh2;
+  }
+  if (dpwrite(b, b->hdr.tail, rhs, rhdr) != rhs) {
     return false;
   }
-  uint16_t to_write1 = MIN(len, b->hdr.size - b->hdr.tail - REC_HDR_SIZE);
+  uint32_t to_write1 = MIN(len, b->hdr.size - b->hdr.tail - rhs);
   if (to_write1 > 0) {
-    if (dpwrite(b, b->hdr.tail + REC_HDR_SIZE, to_write1, data) != to_write1) {
+    if (dpwrite(b, b->hdr.tail + rhs, to_write1, data) != to_write1) {
       return false;
     }
   }
   if (to_write1 < len) {
-    uint16_t to_write2 = len - to_write1;
+    uint32_t to_write2 = len - to_write1;
     if (dpwrite(b, 0, to_write2, ((char *) data) + to_write1) != to_write2) {
       return false;
     }
     b->hdr.tail = to_write2;
   } else {
-    b->hdr.tail += (REC_HDR_SIZE + to_write1);
+    b->hdr.tail += (rhs + to_write1);
   }
-  b->hdr.used += (REC_HDR_SIZE + len);
-  if (write_hdr(b) != FILE_HDR_SIZE) return false;
-  fflush(b->fp);
+  b->hdr.used += (rhs + len);
+  b->hdr.seq++;
   return true;
 }
 
+bool cs_frbuf_append(struct cs_frbuf *b, const void *data, uint32_t len) {
+  if (!frbuf_append(b, data, len)) return false;
+  return cs_frbuf_changed(b, 1);
+}
+
+int cs_frbuf_append_batch(struct cs_frbuf *b, const struct mg_str *recs,
+                          int num) {
+  int i;
+  for (i = 0; i < num; i++) {
+    uint32_t len = (uint32_t) MIN(recs[i].len, UINT32_MAX);
+    if (!frbuf_append(b, recs[i].p, len)) break;
+  }
+  cs_frbuf_changed(b, i);
+  return i;
+}
+
 static size_t dpread(struct cs_frbuf *b, size_t offset, size_t size,
                      void *buf) {
-  return cs_pread(b, offset + FILE_HDR_SIZE, size, buf);
+  return cs_pread(b, offset + b->data_off, size, buf);
 }
 
-int cs_frbuf_get(struct cs_frbuf *b, char **data) {
+/*
+ * Read the header of the record at *pos. If it does not fit at the end
+ * of the buffer, the record is at the start and *pos is updated.
+ * v1 headers are returned with zero seq and crc.
+ */
+static int read_rec_hdr(struct cs_frbuf *b, uint32_t *pos,
+                        struct cs_frbuf_rec_hdr_v2 *rh) {
+  if (b->hdr.size - *pos < b->rec_hdr_size) *pos = 0;
+  if (b->format == CS_FRBUF_FORMAT_V1) {
+    struct cs_frbuf_rec_hdr_v1 rh1;
+    if (dpread(b, *pos, sizeof(rh1), &rh1) != sizeof(rh1)) return -1;
+    rh->len = rh1.len;
+    rh->seq = rh->crc = 0;
+  } else {
+    if (dpread(b, *pos, sizeof(*rh), rh) != sizeof(*rh)) return -1;
+    if (rh->len > b->hdr.size - b->rec_hdr_size) return -6;
+  }
+  return 0;
+}
+
+/*
+ * Read data of the record at pos into dst, unless it's NULL, and check its
+ * CRC (v2 only) if dst is given or verify is set.
+ * Stores position of the next record in *next.
+ */
+static int read_rec_data(struct cs_frbuf *b, uint32_t pos,
+                         const struct cs_frbuf_rec_hdr_v2 *rh, char *dst,
+                         bool verify, uint32_t *next) {
+  uint32_t len = rh->len, crc = 0;
+  char tmp[64];
+  verify = (b->format == CS_FRBUF_FORMAT_V2 && (verify || dst != NULL));
+  if (verify) crc = rec_crc(rh);
+  if (dst == NULL && !verify) {
+    /* Only skipping over, no need to read the data. */
+    uint32_t to_skip1 = MIN(len, b->hdr.size - pos - b->rec_hdr_size);
+    *next = (to_skip1 < len ? len - to_skip1 : pos + b->rec_hdr_size + len);
+    return 0;
+  }
+  /* At most two segments: up to the end of the buffer and from the start. */
+  uint32_t off = pos + b->rec_hdr_size, done = 0;
+  while (done < len) {
+    if (off == b->hdr.size) off = 0;
+    uint32_t n = MIN(len - done, b->hdr.size - off);
+    char *p = (dst != NULL ? dst + done : tmp);
+    if (dst == NULL) n = MIN(n, sizeof(tmp));
+    if (dpread(b, off, n, p) != n) return (off == 0 ? -4 : -3);
+    if (verify) crc = cs_crc32(crc, p, n);
+    off += n;
+    done += n;
+  }
+  if (verify && crc != rh->crc) return -6;
+  *next = off;
+  return 0;
+}
+
+/*
+ * Drop the corrupted record at pos (abs_pos in rd_pos terms) and all the
+ * records after it. If that empties the buffer, the tail is left alone:
+ * an append may be in progress there.
+ */
+static void frbuf_truncate(struct cs_frbuf *b, uint32_t pos, uint32_t abs_pos) {
+  LOG(LL_ERROR, ("Bad record at %lu, dropping %lu bytes", (unsigned long) pos,
+                 (unsigned long) (b->hdr.used - (abs_pos - b->rd_pos))));
+  b->hdr.used = abs_pos - b->rd_pos;
+  if (b->hdr.used == 0) {
+    b->hdr.head = b->hdr.tail;
+  } else {
+    b->hdr.tail = pos;
+  }
+  b->num_unsynced++;
+  cs_frbuf_sync(b);
+}
+
+/* Get and remove a record without syncing. */
+static int frbuf_get(struct cs_frbuf *b, char **data) {
+  struct cs_frbuf_rec_hdr_v2 rh;
+  uint32_t head = b->hdr.head, next = 0;
+  int res;
   if (b->hdr.used == 0) return 0;
-  if (b->hdr.size - b->hdr.head < (uint16_t) REC_HDR_SIZE) b->hdr.head = 0;
-  struct cs_frbuf_rec_hdr rhdr;
-  if (dpread(b, b->hdr.head, REC_HDR_SIZE, &rhdr) != REC_HDR_SIZE) {
-    return -1;
+  if ((res = read_rec_hdr(b, &head, &rh)) != 0) {
+    if (res == -6) frbuf_truncate(b, head, b->rd_pos);
+    return res;
   }
+  b->hdr.head = head;
   if (data != NULL) {
-    *data = malloc(rhdr.len);
+    *data = malloc(rh.len);
     if (*data == NULL) return -2;
   }
-  uint16_t to_read1 = MIN(rhdr.len, b->hdr.size - b->hdr.head - REC_HDR_SIZE);
-  if (to_read1 > 0 && data != NULL) {
-    if (dpread(b, b->hdr.head + REC_HDR_SIZE, to_read1, *data) != to_read1) {
-      return -3;
+  res = read_rec_data(b, head, &rh, (data != NULL ? *data : NULL),
+                      false /* verify */, &next);
+  if (res != 0) {
+    if (data != NULL) {
+      free(*data);
+      *data = NULL;
     }
+    if (res == -6) frbuf_truncate(b, head, b->rd_pos);
+    return res;
   }
-  if (to_read1 < rhdr.len) {
-    uint16_t to_read2 = rhdr.len - to_read1;
-    if (data != NULL) {
-      if (dpread(b, 0, to_read2, *data + to_read1) != to_read2) return -4;
+  b->hdr.head = next;
+  b->hdr.used -= (b->rec_hdr_size + rh.len);
+  b->rd_pos += (b->rec_hdr_size + rh.len);
+  b->rd_seq++;
+  return rh.len;
+}
+
+int cs_frbuf_get(struct cs_frbuf *b, char **data) {
+  int len = frbuf_get(b, data);
+  if (len > 0 && !cs_frbuf_changed(b, 1)) return -5;
+  return len;
+}
+
+int cs_frbuf_get_batch(struct cs_frbuf *b, struct mg_str *recs, int max) {
+  int i, len = 0;
+  for (i = 0; i < max; i++) {
+    char *data = NULL;
+    len = frbuf_get(b, &data);
+    if (len <= 0) break;
+    recs[i].p = data;
+    recs[i].len = len;
+  }
+  cs_frbuf_changed(b, i);
+  return (i == 0 && len < 0 ? len : i);
+}
+
+/* Pick up records appended after the header was last written. */
+static void frbuf_recover(struct cs_frbuf *b) {
+  struct cs_frbuf_rec_hdr_v2 rh;
+  uint32_t n = 0;
+  while (true) {
+    uint32_t pos = b->hdr.tail, next = 0;
+    if (b->hdr.used == 0) pos = 0;
+    if (read_rec_hdr(b, &pos, &rh) != 0 || rh.len == 0 ||
+        rh.seq != b->hdr.seq ||
+        b->rec_hdr_size + rh.len > b->hdr.size - b->hdr.used ||
+        read_rec_data(b, pos, &rh, NULL, true /* verify */, &next) != 0) {
+      break;
     }
-    b->hdr.head = to_read2;
-  } else {
-    b->hdr.head += (REC_HDR_SIZE + to_read1);
+    if (b->hdr.used == 0) b->hdr.head = 0;
+    b->hdr.tail = next;
+    b->hdr.used += (b->rec_hdr_size + rh.len);
+    b->hdr.seq++;
+    n++;
   }
-  b->hdr.used -= (REC_HDR_SIZE + rhdr.len);
-  if (write_hdr(b) != FILE_HDR_SIZE) return -5;
-  fflush(b->fp);
-  return rhdr.len;
+  if (n > 0) {
+    LOG(LL_INFO, ("Recovered %lu records", (unsigned long) n));
+    b->num_unsynced += n;
+    cs_frbuf_sync(b);
+  }
+}
+
+void cs_frbuf_cursor_reset(const struct cs_frbuf *b,
+                           struct cs_frbuf_cursor *c) {
+  c->head = b->hdr.head;
+  c->pos = b->rd_pos;
+  c->seq = b->rd_seq;
+}
+
+int cs_frbuf_peek(struct cs_frbuf *b, struct cs_frbuf_cursor *c,
+                  struct mg_str *recs, int max, char *buf, size_t buf_size) {
+  int i, res = 0;
+  size_t buf_used = 0;
+  /* Records before the cursor are gone: consumed with cs_frbuf_get or
+   * discarded to make room. Start over from the head. */
+  if (c->pos - b->rd_pos > b->hdr.used) cs_frbuf_cursor_reset(b, c);
+  /* At the head, which may have been rewound if the buffer was empty. */
+  if (c->pos == b->rd_pos) c->head = b->hdr.head;
+  for (i = 0; i < max && c->pos - b->rd_pos < b->hdr.used; i++) {
+    struct cs_frbuf_rec_hdr_v2 rh;
+    uint32_t pos = c->head, next = 0;
+    if ((res = read_rec_hdr(b, &pos, &rh)) != 0) break;
+    if (rh.len > buf_size - buf_used) {
+      res = (i == 0 ? -2 : 0);
+      break;
+    }
+    res = read_rec_data(b, pos, &rh, buf + buf_used, false /* verify */,
+                        &next);
+    if (res != 0) break;
+    recs[i].p = buf + buf_used;
+    recs[i].len = rh.len;
+    buf_used += rh.len;
+    c->head = next;
+    c->pos += (b->rec_hdr_size + rh.len);
+    c->seq++;
+  }
+  if (res == -6) frbuf_truncate(b, c->head, c->pos);
+  return (i == 0 && res < 0 ? res : i);
+}
+
+bool cs_frbuf_commit(struct cs_frbuf *b, const struct cs_frbuf_cursor *c) {
+  uint32_t n = c->pos - b->rd_pos;
+  /* Already removed, possibly to make room for new records. */
+  if (n == 0 || n > b->hdr.used) return true;
+  uint32_t num = c->seq - b->rd_seq;
+  b->hdr.head = c->head;
+  b->hdr.used -= n;
+  b->rd_pos = c->pos;
+  b->rd_seq = c->seq;
+  return cs_frbuf_changed(b, num);
 }
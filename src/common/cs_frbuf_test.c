@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cs_dbg.h"
 #include "test_main.h"
@@ -26,6 +28,26 @@ struct cs_frbuf_file_hdr {
   uint16_t head, tail;
 };
 
+#define MAGIC_V2 0x3242 /* B2 */
+struct cs_frbuf_file_hdr_v2 {
+  uint16_t magic;
+  uint16_t reserved;
+  uint32_t gen;
+  uint32_t size, used;
+  uint32_t head, tail;
+  uint32_t seq;
+  uint32_t crc;
+};
+#define V2_DATA_OFF (2 * sizeof(struct cs_frbuf_file_hdr_v2))
+#define V2_REC_HDR_SIZE 12
+
+#define SNAPSHOT_FILE "cs_frbuf_test_snapshot.dat"
+#define CRASH_FILE "cs_frbuf_test_crash.dat"
+
+static struct cs_frbuf *frbuf_init_v1(uint32_t size) {
+  return cs_frbuf_init_format(TEST_FILE, size, CS_FRBUF_FORMAT_V1);
+}
+
 #define ASSERT_FILE_EQ(expected_header, expected_data)                \
   do {                                                                \
     FILE *fp = fopen(TEST_FILE, "r");                                 \
@@ -51,6 +73,21 @@ struct cs_frbuf_file_hdr {
     fclose(fp);                                                       \
   } while (0)
 
+#define ASSERT_FILE_HDR_EQ(expected_header)                           \
+  do {                                                                \
+    FILE *fp = fopen(TEST_FILE, "r");                                 \
+    if (fp == NULL) FAIL("unable to open file", __LINE__);            \
+    struct cs_frbuf_file_hdr hdr, *h = &hdr;                          \
+    ASSERT_EQ(fread(h, sizeof(*h), 1, fp), 1);                        \
+    ASSERT_EQ(h->magic, MAGIC);                                       \
+    char *hbuf;                                                       \
+    asprintf(&hbuf, "s:%u u:%u h:%u t:%u", h->size, h->used, h->head, \
+             h->tail);                                                \
+    ASSERT_STREQ(hbuf, expected_header);                              \
+    free(hbuf);                                                       \
+    fclose(fp);                                                       \
+  } while (0)
+
 #define ASSERT_FRBUF_GET(b, expected_data)  \
   do {                                      \
     char *data;                             \
@@ -66,7 +103,7 @@ struct cs_frbuf_file_hdr {
   } while (0)
 
 static const char *test_frbuf_init_clean(void) {
-  struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+  struct cs_frbuf *b = frbuf_init_v1(100);
   ASSERT_FILE_EQ("s:90 u:0 h:0 t:0", "");
   cs_frbuf_deinit(b);
   ASSERT_FILE_EQ("s:90 u:0 h:0 t:0", "");
@@ -75,14 +112,14 @@ static const char *test_frbuf_init_clean(void) {
 
 static const char *test_frbuf_simple(void) {
   {
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    struct cs_frbuf *b = frbuf_init_v1(100);
     ASSERT_FILE_EQ("s:90 u:0 h:0 t:0", "");
     ASSERT(cs_frbuf_append(b, "AAAAA", 5));
     ASSERT_FILE_EQ("s:90 u:7 h:0 t:7", "05004141414141");
     cs_frbuf_deinit(b);
   }
   {
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    struct cs_frbuf *b = frbuf_init_v1(100);
     /* Previous state has been restored. */
     ASSERT_FILE_EQ("s:90 u:7 h:0 t:7", "05004141414141");
     ASSERT_FRBUF_GET(b, "AAAAA");
@@ -96,7 +133,7 @@ static const char *test_frbuf_simple(void) {
     cs_frbuf_deinit(b);
   }
   {
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    struct cs_frbuf *b = frbuf_init_v1(100);
     /* Empty buffer is truncated on next init. */
     ASSERT_FILE_EQ("s:90 u:0 h:0 t:0", "");
     cs_frbuf_deinit(b);
@@ -106,7 +143,7 @@ static const char *test_frbuf_simple(void) {
 
 static const char *test_frbuf_wrap(void) {
   { /* Last record ends exactly at the end of the buffer */
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 22);
+    struct cs_frbuf *b = frbuf_init_v1(22);
     ASSERT(cs_frbuf_append(b, "AAAAA", 5));
     ASSERT(cs_frbuf_append(b, "BBB", 3));
     ASSERT(cs_frbuf_append(b, "CC", 2)); /* AAAAA is discarded to make room. */
@@ -117,7 +154,7 @@ static const char *test_frbuf_wrap(void) {
   }
   remove(TEST_FILE);
   { /* Only one byte is available at the end, record header doesn't fit. */
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 22);
+    struct cs_frbuf *b = frbuf_init_v1(22);
     ASSERT(cs_frbuf_append(b, "AAAAA", 5));
     ASSERT(cs_frbuf_append(b, "BB", 2));
     ASSERT(cs_frbuf_append(b, "CC", 2));
@@ -126,7 +163,7 @@ static const char *test_frbuf_wrap(void) {
   }
   remove(TEST_FILE);
   { /* Header fits at the end, data is wrapped around. */
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 22);
+    struct cs_frbuf *b = frbuf_init_v1(22);
     ASSERT(cs_frbuf_append(b, "AAAAA", 5));
     ASSERT(cs_frbuf_append(b, "B", 1));
     ASSERT(cs_frbuf_append(b, "CC", 2));
@@ -137,7 +174,7 @@ static const char *test_frbuf_wrap(void) {
   }
   remove(TEST_FILE);
   { /* Header and some data fit at the end, the rest is wrapped around. */
-    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 22);
+    struct cs_frbuf *b = frbuf_init_v1(22);
     ASSERT(cs_frbuf_append(b, "AAAA", 4));
     ASSERT(cs_frbuf_append(b, "B", 1));
     ASSERT(cs_frbuf_append(b, "CC", 2));
@@ -150,6 +187,423 @@ static const char *test_frbuf_wrap(void) {
   return NULL;
 }
 
+static const char *test_frbuf_batch(void) {
+  struct mg_str recs[5] = {
+      MG_MK_STR("AAA"), MG_MK_STR("BB"), MG_MK_STR("C"),
+  };
+  struct cs_frbuf *b = frbuf_init_v1(100);
+  ASSERT_EQ(cs_frbuf_append_batch(b, recs, 3), 3);
+  ASSERT_FILE_EQ("s:90 u:12 h:0 t:12", "030041414102004242010043");
+  memset(recs, 0, sizeof(recs));
+  ASSERT_EQ(cs_frbuf_get_batch(b, recs, 2), 2);
+  ASSERT_FILE_HDR_EQ("s:90 u:3 h:9 t:12");
+  ASSERT_STREQ_NZ(recs[0].p, "AAA");
+  ASSERT_EQ(recs[0].len, 3);
+  ASSERT_STREQ_NZ(recs[1].p, "BB");
+  ASSERT_EQ(recs[1].len, 2);
+  free((char *) recs[0].p);
+  free((char *) recs[1].p);
+  ASSERT_EQ(cs_frbuf_get_batch(b, recs, 5), 1);
+  ASSERT_FILE_HDR_EQ("s:90 u:0 h:0 t:0");
+  ASSERT_STREQ_NZ(recs[0].p, "C");
+  free((char *) recs[0].p);
+  ASSERT_EQ(cs_frbuf_get_batch(b, recs, 5), 0);
+  /* An empty record stops the batch. */
+  struct mg_str recs2[2] = {MG_MK_STR("DD"), MG_MK_STR("")};
+  ASSERT_EQ(cs_frbuf_append_batch(b, recs2, 2), 1);
+  ASSERT_FILE_HDR_EQ("s:90 u:4 h:0 t:4");
+  cs_frbuf_deinit(b);
+  return NULL;
+}
+
+static const char *test_frbuf_sync_policy(void) {
+  {
+    struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 0};
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    ASSERT_FILE_HDR_EQ("s:90 u:0 h:0 t:0");
+    ASSERT(cs_frbuf_sync(b));
+    ASSERT_FILE_EQ("s:90 u:12 h:0 t:12", "050041414141410300424242");
+    ASSERT_FRBUF_GET(b, "AAAAA");
+    ASSERT_FILE_HDR_EQ("s:90 u:12 h:0 t:12");
+    cs_frbuf_deinit(b);
+    ASSERT_FILE_HDR_EQ("s:90 u:5 h:7 t:12");
+  }
+  remove(TEST_FILE);
+  {
+    struct cs_frbuf_sync_policy p = {.max_records = 3, .max_ms = 0};
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT(cs_frbuf_append(b, "A", 1));
+    ASSERT(cs_frbuf_append(b, "B", 1));
+    ASSERT_FILE_HDR_EQ("s:90 u:0 h:0 t:0");
+    ASSERT_FRBUF_GET(b, "A");
+    ASSERT_FILE_HDR_EQ("s:90 u:3 h:3 t:6");
+    cs_frbuf_deinit(b);
+  }
+  remove(TEST_FILE);
+  {
+    struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 50};
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT(cs_frbuf_append(b, "A", 1));
+    ASSERT_FILE_HDR_EQ("s:90 u:0 h:0 t:0");
+    usleep(60000);
+    ASSERT(cs_frbuf_append(b, "B", 1));
+    ASSERT_FILE_HDR_EQ("s:90 u:6 h:0 t:6");
+    cs_frbuf_deinit(b);
+  }
+  remove(TEST_FILE);
+  { /* Discarding records to make room is persisted before overwriting. */
+    struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 0};
+    struct cs_frbuf *b = frbuf_init_v1(22);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    ASSERT(cs_frbuf_append(b, "CC", 2));
+    ASSERT_FILE_HDR_EQ("s:12 u:5 h:7 t:0");
+    cs_frbuf_deinit(b);
+    ASSERT_FILE_EQ("s:12 u:9 h:7 t:4", "020043434141410300424242");
+  }
+  remove(TEST_FILE);
+  { /* So is consuming records whose space is about to be reused. */
+    struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 0};
+    struct cs_frbuf *b = frbuf_init_v1(22);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT(cs_frbuf_append(b, "AAA", 3));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    ASSERT(cs_frbuf_sync(b));
+    ASSERT_FRBUF_GET(b, "AAA");
+    ASSERT_FILE_HDR_EQ("s:12 u:10 h:0 t:10");
+    ASSERT(cs_frbuf_append(b, "CC", 2));
+    ASSERT_FILE_HDR_EQ("s:12 u:5 h:5 t:10");
+    cs_frbuf_deinit(b);
+    ASSERT_FILE_EQ("s:12 u:9 h:5 t:2", "434341414103004242420200");
+  }
+  return NULL;
+}
+
+static const char *test_frbuf_cursor(void) {
+  struct cs_frbuf_cursor c;
+  struct mg_str recs[4];
+  char buf[8];
+  {
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    cs_frbuf_cursor_reset(b, &c);
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 0);
+    ASSERT(cs_frbuf_append(b, "AAA", 3));
+    ASSERT(cs_frbuf_append(b, "BB", 2));
+    ASSERT(cs_frbuf_append(b, "C", 1));
+    ASSERT(cs_frbuf_append(b, "DDDD", 4));
+    /* The rest does not fit in buf. */
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 3);
+    ASSERT_PTREQ(recs[0].p, buf);
+    ASSERT_EQ(recs[0].len, 3);
+    ASSERT_STREQ_NZ(recs[0].p, "AAA");
+    ASSERT_STREQ_NZ(recs[1].p, "BB");
+    ASSERT_STREQ_NZ(recs[2].p, "C");
+    ASSERT_EQ(recs[2].len, 1);
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, 3), -2);
+    /* Nothing is removed until committed. */
+    ASSERT_FILE_HDR_EQ("s:90 u:18 h:0 t:18");
+    ASSERT(cs_frbuf_commit(b, &c));
+    ASSERT_FILE_HDR_EQ("s:90 u:6 h:12 t:18");
+    ASSERT(cs_frbuf_commit(b, &c));
+    ASSERT_FILE_HDR_EQ("s:90 u:6 h:12 t:18");
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "DDDD");
+    cs_frbuf_deinit(b);
+  }
+  { /* Peeked records that were not committed are returned again. */
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    cs_frbuf_cursor_reset(b, &c);
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "DDDD");
+    ASSERT(cs_frbuf_append(b, "E", 1));
+    /* Removed by someone else: commit does nothing, peek goes on. */
+    ASSERT_FRBUF_GET(b, "DDDD");
+    ASSERT(cs_frbuf_commit(b, &c));
+    ASSERT_FILE_HDR_EQ("s:90 u:3 h:18 t:21");
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "E");
+    ASSERT(cs_frbuf_commit(b, &c));
+    ASSERT_FILE_HDR_EQ("s:90 u:0 h:0 t:0");
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 0);
+    /* The buffer has been rewound, the cursor follows. */
+    ASSERT(cs_frbuf_append(b, "FF", 2));
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "FF");
+    cs_frbuf_deinit(b);
+  }
+  remove(TEST_FILE);
+  { /* Peeked records discarded to make room for new ones. */
+    struct cs_frbuf *b = frbuf_init_v1(22);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    cs_frbuf_cursor_reset(b, &c);
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 1, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "AAAAA");
+    ASSERT(cs_frbuf_append(b, "CC", 2));
+    ASSERT(cs_frbuf_append(b, "DDDDDDD", 7));
+    ASSERT_FILE_HDR_EQ("s:12 u:9 h:4 t:1");
+    ASSERT(cs_frbuf_commit(b, &c));
+    ASSERT_FILE_HDR_EQ("s:12 u:9 h:4 t:1");
+    ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 4, buf, sizeof(buf)), 1);
+    ASSERT_STREQ_NZ(recs[0].p, "DDDDDDD");
+    cs_frbuf_deinit(b);
+  }
+  return NULL;
+}
+
+static long file_size(const char *fname) {
+  FILE *fp = fopen(fname, "r");
+  if (fp == NULL) return -1;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+/* Snapshot of the file as it would be found after a power cut. */
+static void copy_file(const char *from, const char *to) {
+  char buf[256];
+  size_t n;
+  FILE *in = fopen(from, "r"), *out = fopen(to, "w");
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+}
+
+static void flip_byte(const char *fname, long offset) {
+  FILE *fp = fopen(fname, "r+");
+  fseek(fp, offset, SEEK_SET);
+  int c = fgetc(fp);
+  fseek(fp, offset, SEEK_SET);
+  fputc(c ^ 0xff, fp);
+  fclose(fp);
+}
+
+/* Offset of the file header copy with the newest generation. */
+static long newest_hdr_v2_offset(const char *fname) {
+  struct cs_frbuf_file_hdr_v2 h[2];
+  FILE *fp = fopen(fname, "r");
+  if (fread(h, sizeof(h), 1, fp) != 1) memset(h, 0, sizeof(h));
+  fclose(fp);
+  return (h[1].gen > h[0].gen ? (long) sizeof(h[0]) : 0);
+}
+
+static const char *test_frbuf_v2_simple(void) {
+  {
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    ASSERT(b != NULL);
+    ASSERT_EQ(file_size(TEST_FILE), V2_DATA_OFF);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    ASSERT_EQ(file_size(TEST_FILE), V2_DATA_OFF + 2 * V2_REC_HDR_SIZE + 8);
+    cs_frbuf_deinit(b);
+  }
+  {
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    ASSERT_FRBUF_GET(b, "AAAAA");
+    ASSERT_FRBUF_GET(b, "BBB");
+    ASSERT_FRBUF_GET(b, NULL);
+    cs_frbuf_deinit(b);
+  }
+  /* Too small. */
+  remove(TEST_FILE);
+  ASSERT(cs_frbuf_init(TEST_FILE, V2_DATA_OFF + V2_REC_HDR_SIZE) == NULL);
+  return NULL;
+}
+
+static const char *test_frbuf_v2_large(void) {
+  struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 0};
+  const uint32_t size = 4 * 1024 * 1024, num = 70000;
+  char rec[50], *data = NULL;
+  uint32_t i, first = 0;
+  {
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, size);
+    ASSERT(b != NULL);
+    cs_frbuf_set_sync_policy(b, &p);
+    for (i = 0; i < num; i++) {
+      memset(rec, 0, sizeof(rec));
+      snprintf(rec, sizeof(rec), "%u", (unsigned) i);
+      ASSERT(cs_frbuf_append(b, rec, sizeof(rec)));
+    }
+    cs_frbuf_deinit(b);
+  }
+  ASSERT_GT(file_size(TEST_FILE), size - V2_REC_HDR_SIZE);
+  {
+    /* The oldest records have been overwritten, the rest are in order. */
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 100);
+    cs_frbuf_set_sync_policy(b, &p);
+    ASSERT_EQ(cs_frbuf_get(b, &data), sizeof(rec));
+    first = strtoul(data, NULL, 10);
+    free(data);
+    ASSERT_GT(first, 0);
+    ASSERT_LT(first, num - (size - V2_DATA_OFF) / (V2_REC_HDR_SIZE + 50) + 2);
+    for (i = first + 1; i < num; i++) {
+      ASSERT_EQ(cs_frbuf_get(b, &data), sizeof(rec));
+      ASSERT_EQ(strtoul(data, NULL, 10), i);
+      free(data);
+    }
+    ASSERT_FRBUF_GET(b, NULL);
+    cs_frbuf_deinit(b);
+  }
+  return NULL;
+}
+
+static const char *test_frbuf_long_records(void) {
+  const uint32_t len = 100000;
+  char *rec = malloc(len), *data = NULL;
+  struct mg_str recs[2] = {{"A", 1}, {rec, len}};
+  uint32_t i;
+  for (i = 0; i < len; i++) rec[i] = (char) (i * 7);
+  {
+    /* v2 stores records over 64K in full. */
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 256 * 1024);
+    ASSERT(cs_frbuf_append(b, rec, len));
+    ASSERT_EQ(cs_frbuf_append_batch(b, recs, 2), 2);
+    ASSERT_EQ(cs_frbuf_get(b, &data), len);
+    ASSERT(memcmp(data, rec, len) == 0);
+    free(data);
+    ASSERT_FRBUF_GET(b, "A");
+    ASSERT_EQ(cs_frbuf_get(b, &data), len);
+    ASSERT(memcmp(data, rec, len) == 0);
+    free(data);
+    cs_frbuf_deinit(b);
+  }
+  remove(TEST_FILE);
+  {
+    /* v1 can't, they are refused. */
+    struct cs_frbuf *b = frbuf_init_v1(60000);
+    ASSERT(!cs_frbuf_append(b, rec, len));
+    ASSERT_EQ(cs_frbuf_append_batch(b, recs, 2), 1);
+    ASSERT_FRBUF_GET(b, "A");
+    ASSERT_FRBUF_GET(b, NULL);
+    cs_frbuf_deinit(b);
+  }
+  free(rec);
+  return NULL;
+}
+
+static const char *test_frbuf_v2_recovery(void) {
+  struct cs_frbuf_sync_policy p = {.max_records = 0, .max_ms = 0};
+  struct cs_frbuf_cursor c;
+  struct mg_str recs[1];
+  char buf[8];
+  struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 200);
+  cs_frbuf_set_sync_policy(b, &p);
+  ASSERT(cs_frbuf_append(b, "A", 1));
+  ASSERT(cs_frbuf_sync(b));
+  ASSERT(cs_frbuf_append(b, "BB", 2));
+  ASSERT(cs_frbuf_sync(b));
+  ASSERT(cs_frbuf_append(b, "CCC", 3));
+  ASSERT(cs_frbuf_append(b, "DDDD", 4));
+  /* Reading flushes the records written so far, but not the header. */
+  cs_frbuf_cursor_reset(b, &c);
+  ASSERT_EQ(cs_frbuf_peek(b, &c, recs, 1, buf, sizeof(buf)), 1);
+  copy_file(TEST_FILE, SNAPSHOT_FILE);
+  cs_frbuf_deinit(b);
+
+  copy_file(SNAPSHOT_FILE, CRASH_FILE);
+
+  /* Records appended after the last header write are picked up. */
+  {
+    struct cs_frbuf *b2 = cs_frbuf_init(CRASH_FILE, 200);
+    ASSERT_FRBUF_GET(b2, "A");
+    ASSERT_FRBUF_GET(b2, "BB");
+    ASSERT_FRBUF_GET(b2, "CCC");
+    ASSERT_FRBUF_GET(b2, "DDDD");
+    ASSERT_FRBUF_GET(b2, NULL);
+    cs_frbuf_deinit(b2);
+  }
+
+  /* Torn header write: the previous copy is used. */
+  copy_file(SNAPSHOT_FILE, CRASH_FILE);
+  flip_byte(CRASH_FILE, newest_hdr_v2_offset(CRASH_FILE) + 8);
+  {
+    struct cs_frbuf *b2 = cs_frbuf_init(CRASH_FILE, 200);
+    ASSERT_FRBUF_GET(b2, "A");
+    ASSERT_FRBUF_GET(b2, "BB");
+    ASSERT_FRBUF_GET(b2, "CCC");
+    ASSERT_FRBUF_GET(b2, "DDDD");
+    ASSERT_FRBUF_GET(b2, NULL);
+    cs_frbuf_deinit(b2);
+  }
+
+  /* Torn record write: recovery stops before it. */
+  copy_file(SNAPSHOT_FILE, CRASH_FILE);
+  flip_byte(CRASH_FILE, newest_hdr_v2_offset(CRASH_FILE) + 8);
+  flip_byte(CRASH_FILE, V2_DATA_OFF + 3 * V2_REC_HDR_SIZE + 3 + 1);
+  {
+    struct cs_frbuf *b2 = cs_frbuf_init(CRASH_FILE, 200);
+    ASSERT_FRBUF_GET(b2, "A");
+    ASSERT_FRBUF_GET(b2, "BB");
+    ASSERT_FRBUF_GET(b2, NULL);
+    cs_frbuf_deinit(b2);
+  }
+  remove(SNAPSHOT_FILE);
+  remove(CRASH_FILE);
+  return NULL;
+}
+
+static const char *test_frbuf_v2_crc(void) {
+  char *data = NULL;
+  {
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 200);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    ASSERT(cs_frbuf_append(b, "CC", 2));
+    cs_frbuf_deinit(b);
+  }
+  flip_byte(TEST_FILE, V2_DATA_OFF + 2 * V2_REC_HDR_SIZE + 5 + 1);
+  {
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 200);
+    ASSERT_FRBUF_GET(b, "AAAAA");
+    /* The corrupted record and everything after it is dropped. */
+    ASSERT_EQ(cs_frbuf_get(b, &data), -6);
+    ASSERT(data == NULL);
+    ASSERT_FRBUF_GET(b, NULL);
+    ASSERT(cs_frbuf_append(b, "DD", 2));
+    ASSERT_FRBUF_GET(b, "DD");
+    cs_frbuf_deinit(b);
+  }
+  return NULL;
+}
+
+static const char *test_frbuf_v1_load(void) {
+  {
+    struct cs_frbuf *b = frbuf_init_v1(100);
+    ASSERT(cs_frbuf_append(b, "AAAAA", 5));
+    ASSERT(cs_frbuf_append(b, "BBB", 3));
+    cs_frbuf_deinit(b);
+  }
+  {
+    /* Existing v1 buffer is used as is. */
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 1000);
+    ASSERT_FILE_EQ("s:90 u:12 h:0 t:12", "050041414141410300424242");
+    ASSERT_FRBUF_GET(b, "AAAAA");
+    ASSERT(cs_frbuf_append(b, "CC", 2));
+    ASSERT_FRBUF_GET(b, "BBB");
+    ASSERT_FRBUF_GET(b, "CC");
+    cs_frbuf_deinit(b);
+  }
+  {
+    /* Once drained, it is replaced with a v2 one. */
+    struct cs_frbuf *b = cs_frbuf_init(TEST_FILE, 1000);
+    ASSERT_EQ(file_size(TEST_FILE), V2_DATA_OFF);
+    ASSERT(cs_frbuf_append(b, "DD", 2));
+    ASSERT_FRBUF_GET(b, "DD");
+    cs_frbuf_deinit(b);
+  }
+  /* v1 buffers can't be larger than 64K. */
+  remove(TEST_FILE);
+  ASSERT(frbuf_init_v1(100000) == NULL);
+  return NULL;
+}
+
 void tests_setup(void) {
 }
 
@@ -160,6 +614,25 @@ const char *tests_run(const char *filter, double *total_elapsed) {
   RUN_TEST(test_frbuf_simple);
   remove(TEST_FILE);
   RUN_TEST(test_frbuf_wrap);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_batch);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_sync_policy);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_cursor);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_v2_simple);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_v2_large);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_long_records);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_v2_recovery);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_v2_crc);
+  remove(TEST_FILE);
+  RUN_TEST(test_frbuf_v1_load);
+  remove(TEST_FILE);
   return NULL;
 }
 
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/cs_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Objects are aligned to accommodate doubles and 64-bit ints. */
+#define CS_POOL_ALIGN 8
+#define CS_POOL_ROUND_UP(x) (((x) + CS_POOL_ALIGN - 1) & ~(CS_POOL_ALIGN - 1))
+
+struct cs_pool_slab {
+  struct cs_pool_slab *next;
+};
+
+#define SLAB_HDR_SIZE CS_POOL_ROUND_UP(sizeof(struct cs_pool_slab))
+
+static size_t cs_pool_slot_size(const struct cs_pool *p) {
+  size_t size = p->obj_size;
+  if (size < sizeof(void *)) size = sizeof(void *);
+  return CS_POOL_ROUND_UP(size);
+}
+
+void cs_pool_init(struct cs_pool *p, size_t obj_size, uint16_t prealloc,
+                  uint16_t grow) {
+  memset(p, 0, sizeof(*p));
+  p->obj_size = obj_size;
+  p->prealloc = prealloc;
+  p->grow = grow;
+}
+
+void cs_pool_deinit(struct cs_pool *p) {
+  struct cs_pool_slab *s, *next;
+  for (s = p->slabs; s != NULL; s = next) {
+    next = s->next;
+    free(s);
+  }
+  cs_pool_init(p, p->obj_size, p->prealloc, p->grow);
+}
+
+static int cs_pool_add_slab(struct cs_pool *p, uint16_t num_objs) {
+  size_t slot_size = cs_pool_slot_size(p);
+  struct cs_pool_slab *s;
+  uint8_t *obj;
+  uint16_t i;
+  if (num_objs == 0) return 0;
+  s = (struct cs_pool_slab *) malloc(SLAB_HDR_SIZE + num_objs * slot_size);
+  if (s == NULL) return 0;
+  s->next = p->slabs;
+  p->slabs = s;
+  /* Chain the new objects in front of the free list. */
+  obj = ((uint8_t *) s) + SLAB_HDR_SIZE + (num_objs - 1) * slot_size;
+  for (i = 0; i < num_objs; i++, obj -= slot_size) {
+    *((void **) obj) = p->free_list;
+    p->free_list = obj;
+  }
+  p->stats.num_total += num_objs;
+  p->stats.num_slabs++;
+  return 1;
+}
+
+void *cs_pool_alloc(struct cs_pool *p) {
+  void *obj;
+  if (p->free_list == NULL &&
+      !cs_pool_add_slab(p, (p->slabs == NULL && p->prealloc > 0 ? p->prealloc
+                                                                 : p->grow))) {
+    p->stats.num_failed++;
+    return NULL;
+  }
+  obj = p->free_list;
+  p->free_list = *((void **) obj);
+  memset(obj, 0, p->obj_size);
+  p->stats.num_used++;
+  if (p->stats.num_used > p->stats.max_used) {
+    p->stats.max_used = p->stats.num_used;
+  }
+  return obj;
+}
+
+void cs_pool_free(struct cs_pool *p, void *obj) {
+  if (obj == NULL) return;
+  *((void **) obj) = p->free_list;
+  p->free_list = obj;
+  p->stats.num_used--;
+}
+
+void cs_pool_get_stats(const struct cs_pool *p, struct cs_pool_stats *stats) {
+  memcpy(stats, &p->stats, sizeof(*stats));
+}
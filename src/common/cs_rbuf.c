@@ -22,7 +22,28 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-void cs_rbuf_init(cs_rbuf_t *b, uint16_t size) {
+/* Wrap a pointer in [begin, begin + 2 * size) back into the buffer. */
+static inline uint8_t *cs_rbuf_wrap(const cs_rbuf_t *b, uint8_t *p) {
+#if CS_RBUF_ENABLE_POW2
+  return b->begin + ((size_t)(p - b->begin) & (b->size - 1));
+#else
+  return (p >= b->end ? p - b->size : p);
+#endif
+}
+
+#if CS_RBUF_ENABLE_POW2
+static cs_rbuf_size_t cs_rbuf_pow2_size(cs_rbuf_size_t size) {
+  cs_rbuf_size_t p = 1;
+  if (size == 0) return 0;
+  while (p < size && (cs_rbuf_size_t)(p << 1) != 0) p <<= 1;
+  return p;
+}
+#endif
+
+void cs_rbuf_init(cs_rbuf_t *b, cs_rbuf_size_t size) {
+#if CS_RBUF_ENABLE_POW2
+  size = cs_rbuf_pow2_size(size);
+#endif
   b->begin = calloc(1, size);
   b->size = size;
   cs_rbuf_clear(b);
@@ -40,58 +61,216 @@ void cs_rbuf_clear(cs_rbuf_t *b) {
   b->head = b->tail = b->begin;
 }
 
-void cs_rbuf_append(cs_rbuf_t *b, const void *data, uint16_t len) {
-  uint8_t *p = (uint8_t *) data;
+void cs_rbuf_append(cs_rbuf_t *b, const void *data, cs_rbuf_size_t len) {
+  const uint8_t *p = (const uint8_t *) data;
+  cs_rbuf_size_t n;
+  if (len == 0) return;
+  /* At most two segments: up to the end of the buffer and from the start. */
+  n = MIN(len, (cs_rbuf_size_t)(b->end - b->tail));
+  memcpy(b->tail, p, n);
+  if (len > n) memcpy(b->begin, p + n, len - n);
+  b->tail = cs_rbuf_wrap(b, b->tail + len);
   b->used += len;
   b->avail -= len;
-  for (; len > 0; len--, p++) {
-    *b->tail++ = *p;
-    if (b->tail >= b->end) b->tail = b->begin;
-  }
 }
 
 void cs_rbuf_append_one(cs_rbuf_t *b, uint8_t byte) {
-  *b->tail++ = byte;
-  if (b->tail >= b->end) b->tail = b->begin;
+  *b->tail = byte;
+  b->tail = cs_rbuf_wrap(b, b->tail + 1);
   b->used++;
   b->avail--;
 }
 
-uint8_t cs_rbuf_at(cs_rbuf_t *b, uint16_t i) {
-  uint8_t *p = b->head + i;
-  if (p >= b->end) p = b->begin + (p - b->end);
-  return *p;
+uint8_t cs_rbuf_at(cs_rbuf_t *b, cs_rbuf_size_t i) {
+  return *cs_rbuf_wrap(b, b->head + i);
 }
 
-uint16_t cs_rbuf_get(cs_rbuf_t *b, uint16_t max, uint8_t **data) {
-  uint8_t *start = b->head + b->in_flight;
-  if (start >= b->end) start = b->begin + (start - b->end);
+cs_rbuf_size_t cs_rbuf_get(cs_rbuf_t *b, cs_rbuf_size_t max, uint8_t **data) {
+  uint8_t *start = cs_rbuf_wrap(b, b->head + b->in_flight);
   *data = start;
-  uint16_t len = b->used - b->in_flight;
+  cs_rbuf_size_t len = b->used - b->in_flight;
   if (start + len > b->end) len = b->end - start;
   if (len > max) len = max;
   b->in_flight += len;
   return len;
 }
 
-void cs_rbuf_consume(cs_rbuf_t *b, uint16_t len) {
-  b->head += len;
-  if (b->head >= b->end) b->head = b->begin + (b->head - b->end);
+void cs_rbuf_consume(cs_rbuf_t *b, cs_rbuf_size_t len) {
+  b->head = cs_rbuf_wrap(b, b->head + len);
   b->used -= len;
   b->avail += len;
   b->in_flight -= len;
   if (b->used == 0) b->head = b->tail = b->begin;
 }
 
-uint16_t cs_rbuf_contig_tail_space(cs_rbuf_t *b, uint8_t **data) {
+cs_rbuf_size_t cs_rbuf_contig_tail_space(cs_rbuf_t *b, uint8_t **data) {
   *data = b->tail;
   return (b->tail > b->head || b->used == 0 ? b->end - b->tail
                                             : b->head - b->tail);
 }
 
-void cs_rbuf_advance_tail(cs_rbuf_t *b, uint16_t len) {
-  b->tail += len;
-  if (b->tail >= b->end) b->tail = b->begin + (b->tail - b->end);
+void cs_rbuf_advance_tail(cs_rbuf_t *b, cs_rbuf_size_t len) {
+  b->tail = cs_rbuf_wrap(b, b->tail + len);
   b->used += len;
   b->avail -= len;
 }
+
+cs_rbuf_size_t cs_rbuf_peek(const cs_rbuf_t *b, void *dst, cs_rbuf_size_t len) {
+  uint8_t *d = (uint8_t *) dst;
+  cs_rbuf_size_t n;
+  len = MIN(len, b->used);
+  if (len == 0) return 0;
+  n = MIN(len, (cs_rbuf_size_t)(b->end - b->head));
+  memcpy(d, b->head, n);
+  if (len > n) memcpy(d + n, b->begin, len - n);
+  return len;
+}
+
+cs_rbuf_size_t cs_rbuf_read(cs_rbuf_t *b, void *dst, cs_rbuf_size_t len) {
+  len = cs_rbuf_peek(b, dst, len);
+  b->head = cs_rbuf_wrap(b, b->head + len);
+  b->used -= len;
+  b->avail += len;
+  if (b->used == 0) b->head = b->tail = b->begin;
+  return len;
+}
+
+cs_rbuf_size_t cs_rbuf_dma_start(cs_rbuf_t *b, cs_rbuf_dma_t *d) {
+  uint8_t *tail = NULL;
+  d->len = cs_rbuf_contig_tail_space(b, &tail);
+  d->dst = (d->len > 0 ? tail : NULL);
+  d->done = 0;
+  return d->len;
+}
+
+cs_rbuf_size_t cs_rbuf_dma_commit(cs_rbuf_t *b, cs_rbuf_dma_t *d,
+                                  cs_rbuf_size_t remaining) {
+  if (d->dst == NULL || remaining > d->len) return 0;
+  cs_rbuf_size_t n = d->len - remaining - d->done;
+  if (n > 0) {
+    /* If the consumer has emptied the ring, it has been rewound. */
+    if (b->used == 0) b->head = b->tail = d->dst + d->done;
+    cs_rbuf_advance_tail(b, n);
+    d->done += n;
+  }
+  if (d->done == d->len) d->dst = NULL;
+  return n;
+}
+
+#ifdef _MSC_VER
+/* Aligned 32-bit accesses are atomic and MSVC's volatile is acquire/release. */
+#define SPSC_LOAD_ACQ(p) (*(const volatile uint32_t *) (p))
+#define SPSC_STORE_REL(p, v) (*(volatile uint32_t *) (p) = (v))
+#else
+#define SPSC_LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SPSC_STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* Own index: only this side writes it, a plain read will do. */
+#define SPSC_LOAD_OWN(p) (*(p))
+
+static inline uint32_t spsc_advance(const cs_rbuf_spsc_t *b, uint32_t i,
+                                    uint32_t n) {
+  i += n;
+  return (i >= 2 * (uint32_t) b->size ? i - 2 * (uint32_t) b->size : i);
+}
+
+static inline uint32_t spsc_pos(const cs_rbuf_spsc_t *b, uint32_t i) {
+  return (i >= b->size ? i - b->size : i);
+}
+
+static inline cs_rbuf_size_t spsc_used(const cs_rbuf_spsc_t *b, uint32_t head,
+                                       uint32_t tail) {
+  return (cs_rbuf_size_t)(tail >= head ? tail - head
+                                       : tail + 2 * (uint32_t) b->size - head);
+}
+
+void cs_rbuf_spsc_init(cs_rbuf_spsc_t *b, cs_rbuf_size_t size) {
+#if CS_RBUF_ENABLE_POW2
+  size = cs_rbuf_pow2_size(size);
+#endif
+  b->buf = calloc(1, size);
+  b->size = (b->buf != NULL ? size : 0);
+  cs_rbuf_spsc_clear(b);
+}
+
+void cs_rbuf_spsc_deinit(cs_rbuf_spsc_t *b) {
+  free(b->buf);
+  memset(b, 0, sizeof(*b));
+}
+
+void cs_rbuf_spsc_clear(cs_rbuf_spsc_t *b) {
+  b->head = b->tail = 0;
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_avail(const cs_rbuf_spsc_t *b) {
+  return b->size - spsc_used(b, SPSC_LOAD_ACQ(&b->head),
+                             SPSC_LOAD_OWN(&b->tail));
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_write(cs_rbuf_spsc_t *b, const void *data,
+                                  cs_rbuf_size_t len) {
+  const uint8_t *p = (const uint8_t *) data;
+  uint32_t tail = SPSC_LOAD_OWN(&b->tail);
+  cs_rbuf_size_t n, avail = cs_rbuf_spsc_avail(b);
+  uint32_t pos = spsc_pos(b, tail);
+  len = MIN(len, avail);
+  if (len == 0) return 0;
+  n = MIN(len, (cs_rbuf_size_t)(b->size - pos));
+  memcpy(b->buf + pos, p, n);
+  if (len > n) memcpy(b->buf, p + n, len - n);
+  SPSC_STORE_REL(&b->tail, spsc_advance(b, tail, len));
+  return len;
+}
+
+bool cs_rbuf_spsc_append_one(cs_rbuf_spsc_t *b, uint8_t byte) {
+  uint32_t tail = SPSC_LOAD_OWN(&b->tail);
+  if (spsc_used(b, SPSC_LOAD_ACQ(&b->head), tail) == b->size) return false;
+  b->buf[spsc_pos(b, tail)] = byte;
+  SPSC_STORE_REL(&b->tail, spsc_advance(b, tail, 1));
+  return true;
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_contig_tail_space(const cs_rbuf_spsc_t *b,
+                                              uint8_t **data) {
+  uint32_t pos = spsc_pos(b, SPSC_LOAD_OWN(&b->tail));
+  cs_rbuf_size_t avail = cs_rbuf_spsc_avail(b);
+  *data = b->buf + pos;
+  return MIN(avail, (cs_rbuf_size_t)(b->size - pos));
+}
+
+void cs_rbuf_spsc_advance_tail(cs_rbuf_spsc_t *b, cs_rbuf_size_t len) {
+  SPSC_STORE_REL(&b->tail, spsc_advance(b, SPSC_LOAD_OWN(&b->tail), len));
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_used(const cs_rbuf_spsc_t *b) {
+  return spsc_used(b, SPSC_LOAD_OWN(&b->head), SPSC_LOAD_ACQ(&b->tail));
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_read(cs_rbuf_spsc_t *b, void *dst,
+                                 cs_rbuf_size_t len) {
+  uint8_t *d = (uint8_t *) dst;
+  uint32_t head = SPSC_LOAD_OWN(&b->head);
+  uint32_t pos = spsc_pos(b, head);
+  cs_rbuf_size_t n;
+  len = MIN(len, cs_rbuf_spsc_used(b));
+  if (len == 0) return 0;
+  n = MIN(len, (cs_rbuf_size_t)(b->size - pos));
+  memcpy(d, b->buf + pos, n);
+  if (len > n) memcpy(d + n, b->buf, len - n);
+  SPSC_STORE_REL(&b->head, spsc_advance(b, head, len));
+  return len;
+}
+
+cs_rbuf_size_t cs_rbuf_spsc_get(const cs_rbuf_spsc_t *b, cs_rbuf_size_t max,
+                                uint8_t **data) {
+  uint32_t pos = spsc_pos(b, SPSC_LOAD_OWN(&b->head));
+  cs_rbuf_size_t len = cs_rbuf_spsc_used(b);
+  *data = b->buf + pos;
+  len = MIN(len, (cs_rbuf_size_t)(b->size - pos));
+  return MIN(len, max);
+}
+
+void cs_rbuf_spsc_consume(cs_rbuf_spsc_t *b, cs_rbuf_size_t len) {
+  SPSC_STORE_REL(&b->head, spsc_advance(b, SPSC_LOAD_OWN(&b->head), len));
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/cs_wakeup.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+static void cs_wakeup_set_fds(struct cs_wakeup *w, int fds[2]) {
+  for (int i = 0; i < 2; i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  w->rfd = fds[0];
+  w->wfd = fds[1];
+}
+
+bool cs_wakeup_init(struct cs_wakeup *w) {
+#ifdef __linux__
+  w->rfd = w->wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return (w->rfd >= 0);
+#else
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  cs_wakeup_set_fds(w, fds);
+  return true;
+#endif
+}
+
+bool cs_wakeup_init_socket(struct cs_wakeup *w) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return false;
+  cs_wakeup_set_fds(w, fds);
+  return true;
+}
+
+void cs_wakeup_deinit(struct cs_wakeup *w) {
+  if (w->wfd != w->rfd) close(w->wfd);
+  close(w->rfd);
+  w->rfd = w->wfd = -1;
+}
+
+void cs_wakeup_signal(struct cs_wakeup *w) {
+  int saved_errno = errno;
+#ifdef __linux__
+  uint64_t v = 1;
+#else
+  uint8_t v = 1;
+#endif
+  /* A full pipe or a saturated counter is already signalled. */
+  ssize_t n = write(w->wfd, &v, sizeof(v));
+  errno = saved_errno;
+  (void) n;
+}
+
+bool cs_wakeup_drain(struct cs_wakeup *w) {
+  uint8_t buf[64];
+  bool res = false;
+  /* eventfd is reset by one read, a pipe may need several. */
+  while (read(w->rfd, buf, sizeof(buf)) > 0) res = true;
+  return res;
+}
+
+#endif /* _WIN32 */
@@ -15,10 +15,20 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
 #include <string.h>
-
+#ifndef _WIN32
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+#include "common/cs_pool.h"
+#include "common/cs_rbuf.h"
 #include "common/cs_time.h"
 #include "common/cs_varint.h"
+#include "common/cs_wakeup.h"
 #include "common/mg_str.h"
 #include "common/str_util.h"
 #include "common/test_main.h"
@@ -191,6 +201,362 @@ static const char *test_cs_varint(void) {
   return NULL;
 }
 
+static const char *test_cs_pool(void) {
+  struct cs_pool_stats st;
+  struct cs_pool p = CS_POOL_INIT(sizeof(double) + 1, 4, 3);
+  void *objs[10];
+  int i;
+
+  for (i = 0; i < 10; i++) {
+    objs[i] = cs_pool_alloc(&p);
+    ASSERT(objs[i] != NULL);
+    ASSERT_EQ(((uintptr_t) objs[i]) % sizeof(double), 0);
+    memset(objs[i], 0xff, sizeof(double) + 1);
+  }
+  cs_pool_get_stats(&p, &st);
+  ASSERT_EQ(st.num_total, 4 + 3 + 3);
+  ASSERT_EQ(st.num_slabs, 3);
+  ASSERT_EQ(st.num_used, 10);
+  for (i = 0; i < 10; i++) cs_pool_free(&p, objs[i]);
+  cs_pool_get_stats(&p, &st);
+  ASSERT_EQ(st.num_used, 0);
+  ASSERT_EQ(st.max_used, 10);
+  /* Objects are recycled and come back zeroed. */
+  objs[0] = cs_pool_alloc(&p);
+  ASSERT_EQ(*((uint8_t *) objs[0] + sizeof(double)), 0);
+  cs_pool_get_stats(&p, &st);
+  ASSERT_EQ(st.num_slabs, 3);
+  cs_pool_deinit(&p);
+
+  /* Non-growing pool */
+  cs_pool_init(&p, 3, 2, 0);
+  ASSERT(cs_pool_alloc(&p) != NULL);
+  ASSERT(cs_pool_alloc(&p) != NULL);
+  ASSERT(cs_pool_alloc(&p) == NULL);
+  cs_pool_get_stats(&p, &st);
+  ASSERT_EQ(st.num_failed, 1);
+  cs_pool_deinit(&p);
+
+  return NULL;
+}
+
+static const char *test_cs_rbuf(void) {
+  cs_rbuf_t b;
+  uint8_t in[200], out[200], *data = NULL;
+  uint8_t ref[1000];
+  int ref_head = 0, ref_tail = 0, i, j;
+
+  cs_rbuf_init(&b, 37);
+#if CS_RBUF_ENABLE_POW2
+  ASSERT_EQ(b.size, 64);
+#else
+  ASSERT_EQ(b.size, 37);
+#endif
+  ASSERT_EQ(b.avail, b.size);
+
+  /* Wrapping append, peek and read. */
+  memset(in, 'a', sizeof(in));
+  cs_rbuf_append(&b, in, b.size - 5);
+  ASSERT_EQ(cs_rbuf_read(&b, out, b.size - 10), b.size - 10);
+  for (i = 0; i < 10; i++) in[i] = i;
+  cs_rbuf_append(&b, in, 10);
+  ASSERT_EQ(b.used, 15);
+  ASSERT_PTREQ(b.tail, b.begin + 5);
+  ASSERT_EQ(cs_rbuf_at(&b, 6), 1);
+  ASSERT_EQ(cs_rbuf_peek(&b, out, sizeof(out)), 15);
+  ASSERT_EQ(b.used, 15);
+  ASSERT_EQ(memcmp(out, "aaaaa", 5), 0);
+  ASSERT_EQ(memcmp(out + 5, in, 10), 0);
+  ASSERT_EQ(cs_rbuf_read(&b, out, 7), 7);
+  ASSERT_EQ(out[5], 0);
+  ASSERT_EQ(out[6], 1);
+  ASSERT_EQ(cs_rbuf_read(&b, out, sizeof(out)), 8);
+  ASSERT_EQ(out[7], 9);
+  ASSERT_EQ(b.used, 0);
+  ASSERT_EQ(b.avail, b.size);
+  ASSERT_PTREQ(b.head, b.begin);
+  ASSERT_EQ(cs_rbuf_read(&b, out, sizeof(out)), 0);
+
+  /* Random operations against a reference. */
+  srand(1);
+  for (i = 0; i < 10000; i++) {
+    int n = rand() % (b.size + 1);
+    switch (rand() % 3) {
+      case 0:
+        if (n > b.avail) n = b.avail;
+        for (j = 0; j < n; j++) in[j] = ref[ref_tail++ % 1000] = rand();
+        cs_rbuf_append(&b, in, n);
+        break;
+      case 1:
+        n = cs_rbuf_read(&b, out, n);
+        for (j = 0; j < n; j++) ASSERT_EQ(out[j], ref[ref_head++ % 1000]);
+        break;
+      case 2:
+        n = cs_rbuf_get(&b, n, &data);
+        for (j = 0; j < n; j++) ASSERT_EQ(data[j], ref[ref_head++ % 1000]);
+        cs_rbuf_consume(&b, n);
+        break;
+    }
+    ASSERT_EQ(b.used, ref_tail - ref_head);
+    ASSERT_EQ(b.used + b.avail, b.size);
+  }
+
+  cs_rbuf_deinit(&b);
+  return NULL;
+}
+
+/* Simulated DMA engine: a destination pointer and a remaining count. */
+struct sim_dma {
+  uint8_t *p;
+  uint16_t remaining;
+  uint8_t next;
+};
+
+static void sim_dma_start(struct sim_dma *dma, cs_rbuf_t *b, cs_rbuf_dma_t *d) {
+  dma->remaining = cs_rbuf_dma_start(b, d);
+  dma->p = d->dst;
+}
+
+static void sim_dma_rx(struct sim_dma *dma, int n) {
+  for (; n > 0 && dma->remaining > 0; n--, dma->remaining--) {
+    *dma->p++ = dma->next++;
+  }
+}
+
+static const char *test_cs_rbuf_dma(void) {
+  cs_rbuf_t b;
+  cs_rbuf_dma_t d;
+  struct sim_dma dma = {.next = 0};
+  uint8_t *data = NULL, expected = 0;
+  int i, total = 0;
+
+  cs_rbuf_init(&b, 16);
+  sim_dma_start(&dma, &b, &d);
+  ASSERT_EQ(d.len, 16);
+  ASSERT_PTREQ(d.dst, b.begin);
+
+  /* Partial burst, as flushed on line idle. */
+  sim_dma_rx(&dma, 5);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, dma.remaining), 5);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, dma.remaining), 0);
+  ASSERT_EQ(b.used, 5);
+  ASSERT_EQ(b.avail, 11);
+
+  /* Consumer empties the ring and it is rewound, transfer carries on. */
+  ASSERT_EQ(cs_rbuf_get(&b, 16, &data), 5);
+  cs_rbuf_consume(&b, 5);
+  ASSERT_PTREQ(b.tail, b.begin);
+  sim_dma_rx(&dma, 3);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, dma.remaining), 3);
+  ASSERT_EQ(b.used, 3);
+  ASSERT_EQ(cs_rbuf_at(&b, 0), 5);
+  ASSERT_EQ(cs_rbuf_at(&b, 2), 7);
+
+  /* Transfer completes, tail wraps. */
+  sim_dma_rx(&dma, 100);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, dma.remaining), 8);
+  ASSERT(d.dst == NULL);
+  ASSERT_PTREQ(b.tail, b.begin);
+  ASSERT_EQ(b.used, 11);
+
+  /* Next transfer only gets the space up to the head. */
+  sim_dma_start(&dma, &b, &d);
+  ASSERT_EQ(d.len, 5);
+  sim_dma_rx(&dma, 100);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, dma.remaining), 5);
+  ASSERT_EQ(b.avail, 0);
+  ASSERT_EQ(cs_rbuf_dma_start(&b, &d), 0);
+  ASSERT(d.dst == NULL);
+  ASSERT_EQ(cs_rbuf_dma_commit(&b, &d, 0), 0);
+
+  /* Random bursts against a random consumer, data must come out in order. */
+  cs_rbuf_clear(&b);
+  dma.next = expected = 0;
+  sim_dma_start(&dma, &b, &d);
+  srand(42);
+  for (i = 0; i < 10000; i++) {
+    uint16_t n;
+    if (d.dst == NULL) sim_dma_start(&dma, &b, &d);
+    sim_dma_rx(&dma, rand() % 7);
+    if (rand() % 3 == 0) cs_rbuf_dma_commit(&b, &d, dma.remaining);
+    n = cs_rbuf_get(&b, rand() % 9, &data);
+    total += n;
+    while (n-- > 0) ASSERT_EQ(*data++, expected++);
+    cs_rbuf_consume(&b, b.in_flight);
+    ASSERT_EQ(b.used + b.avail, b.size);
+  }
+  ASSERT(total > 10000);
+
+  cs_rbuf_deinit(&b);
+  return NULL;
+}
+
+static const char *test_cs_rbuf_spsc(void) {
+  cs_rbuf_spsc_t b;
+  uint8_t buf[16], *data = NULL;
+  int i;
+
+  cs_rbuf_spsc_init(&b, 8);
+  ASSERT_EQ(cs_rbuf_spsc_used(&b), 0);
+  ASSERT_EQ(cs_rbuf_spsc_avail(&b), 8);
+  ASSERT_EQ(cs_rbuf_spsc_get(&b, 8, &data), 0);
+  ASSERT_EQ(cs_rbuf_spsc_read(&b, buf, sizeof(buf)), 0);
+
+  /* Fill up: writes are truncated to the free space. */
+  ASSERT_EQ(cs_rbuf_spsc_write(&b, "abcdef", 6), 6);
+  ASSERT(cs_rbuf_spsc_append_one(&b, 'g'));
+  ASSERT_EQ(cs_rbuf_spsc_write(&b, "hijk", 4), 1);
+  ASSERT(!cs_rbuf_spsc_append_one(&b, 'x'));
+  ASSERT_EQ(cs_rbuf_spsc_used(&b), 8);
+  ASSERT_EQ(cs_rbuf_spsc_avail(&b), 0);
+
+  /* Zero-copy read of part of it, then wrap the tail around. */
+  ASSERT_EQ(cs_rbuf_spsc_get(&b, 3, &data), 3);
+  ASSERT_EQ(memcmp(data, "abc", 3), 0);
+  cs_rbuf_spsc_consume(&b, 3);
+  ASSERT_EQ(cs_rbuf_spsc_avail(&b), 3);
+  ASSERT_EQ(cs_rbuf_spsc_contig_tail_space(&b, &data), 3);
+  ASSERT_EQ(cs_rbuf_spsc_write(&b, "1234", 4), 3);
+  ASSERT_EQ(cs_rbuf_spsc_get(&b, 8, &data), 5);
+  ASSERT_EQ(memcmp(data, "defgh", 5), 0);
+  ASSERT_EQ(cs_rbuf_spsc_read(&b, buf, sizeof(buf)), 8);
+  ASSERT_EQ(memcmp(buf, "defgh123", 8), 0);
+  ASSERT_EQ(cs_rbuf_spsc_used(&b), 0);
+
+  /* In-place fill stops at the end of the buffer. */
+  ASSERT_EQ(cs_rbuf_spsc_contig_tail_space(&b, &data), 5);
+  memcpy(data, "vwxyz", 5);
+  cs_rbuf_spsc_advance_tail(&b, 5);
+  ASSERT_EQ(cs_rbuf_spsc_contig_tail_space(&b, &data), 3);
+  ASSERT_PTREQ(data, b.buf);
+  ASSERT_EQ(cs_rbuf_spsc_read(&b, buf, 2), 2);
+  ASSERT_EQ(memcmp(buf, "vw", 2), 0);
+  ASSERT_EQ(cs_rbuf_spsc_used(&b), 3);
+
+  /* Many laps around the buffer, to exercise index wrapping. */
+  cs_rbuf_spsc_clear(&b);
+  for (i = 0; i < 100; i++) {
+    uint8_t c = (uint8_t) i;
+    ASSERT_EQ(cs_rbuf_spsc_write(&b, buf, (uint16_t)(i % 5)), i % 5);
+    ASSERT(cs_rbuf_spsc_append_one(&b, c));
+    ASSERT_EQ(cs_rbuf_spsc_read(&b, buf, (uint16_t)(i % 5)), i % 5);
+    ASSERT_EQ(cs_rbuf_spsc_read(&b, buf + 8, 1), 1);
+    ASSERT_EQ(buf[8], c);
+    ASSERT_EQ(cs_rbuf_spsc_used(&b), 0);
+  }
+
+  cs_rbuf_spsc_deinit(&b);
+  return NULL;
+}
+
+#ifndef _WIN32
+#define SPSC_STRESS_BYTES 2000000
+
+/*
+ * Producer runs in its own thread and appends a known byte sequence using
+ * all three ways of writing. Build with -fsanitize=thread
+ * (make unit_test_tsan) to check for data races.
+ */
+static void *spsc_producer(void *arg) {
+  cs_rbuf_spsc_t *b = (cs_rbuf_spsc_t *) arg;
+  uint8_t chunk[37], next = 0;
+  unsigned int seed = 1;
+  int sent = 0;
+  while (sent < SPSC_STRESS_BYTES) {
+    uint16_t i, n = (uint16_t)(rand_r(&seed) % sizeof(chunk)) + 1;
+    uint8_t *data = NULL;
+    if (n > SPSC_STRESS_BYTES - sent) n = SPSC_STRESS_BYTES - sent;
+    switch (rand_r(&seed) % 3) {
+      case 0:
+        for (i = 0; i < n; i++) chunk[i] = (uint8_t)(next + i);
+        n = cs_rbuf_spsc_write(b, chunk, n);
+        break;
+      case 1:
+        n = (cs_rbuf_spsc_append_one(b, next) ? 1 : 0);
+        break;
+      case 2:
+        i = cs_rbuf_spsc_contig_tail_space(b, &data);
+        if (n > i) n = i;
+        for (i = 0; i < n; i++) data[i] = (uint8_t)(next + i);
+        cs_rbuf_spsc_advance_tail(b, n);
+        break;
+    }
+    if (n == 0) sched_yield();
+    next += n;
+    sent += n;
+  }
+  return NULL;
+}
+
+static const char *test_cs_rbuf_spsc_threads(void) {
+  cs_rbuf_spsc_t b;
+  pthread_t t;
+  uint8_t buf[29], *data = NULL, expected = 0;
+  unsigned int seed = 2;
+  int received = 0;
+
+  cs_rbuf_spsc_init(&b, 61);
+  ASSERT_EQ(pthread_create(&t, NULL, spsc_producer, &b), 0);
+  while (received < SPSC_STRESS_BYTES) {
+    uint16_t i, n;
+    if (rand_r(&seed) % 2 == 0) {
+      n = cs_rbuf_spsc_read(&b, buf, (uint16_t)(rand_r(&seed) % sizeof(buf)));
+      for (i = 0; i < n; i++) ASSERT_EQ(buf[i], expected++);
+    } else {
+      n = cs_rbuf_spsc_get(&b, (uint16_t)(rand_r(&seed) % 64), &data);
+      for (i = 0; i < n; i++) ASSERT_EQ(data[i], expected++);
+      cs_rbuf_spsc_consume(&b, n);
+    }
+    if (n == 0) sched_yield();
+    received += n;
+  }
+  ASSERT_EQ(pthread_join(t, NULL), 0);
+  ASSERT_EQ(cs_rbuf_spsc_used(&b), 0);
+  cs_rbuf_spsc_deinit(&b);
+  return NULL;
+}
+#endif
+
+#ifndef _WIN32
+static bool wakeup_readable(struct cs_wakeup *w) {
+  struct pollfd pfd = {.fd = w->rfd, .events = POLLIN};
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+static const char *test_cs_wakeup(void) {
+  struct cs_wakeup w;
+  ASSERT(cs_wakeup_init(&w));
+  ASSERT(!wakeup_readable(&w));
+  ASSERT(!cs_wakeup_drain(&w));
+  /* Multiple signals collapse into one wakeup. */
+  cs_wakeup_signal(&w);
+  cs_wakeup_signal(&w);
+  cs_wakeup_signal(&w);
+  ASSERT(wakeup_readable(&w));
+  ASSERT(cs_wakeup_drain(&w));
+  ASSERT(!wakeup_readable(&w));
+  ASSERT(!cs_wakeup_drain(&w));
+  cs_wakeup_signal(&w);
+  ASSERT(wakeup_readable(&w));
+  cs_wakeup_deinit(&w);
+
+  /* Socket variant can be read with recv(). */
+  char buf[16];
+  ASSERT(cs_wakeup_init_socket(&w));
+  ASSERT(w.rfd != w.wfd);
+  ASSERT(!wakeup_readable(&w));
+  cs_wakeup_signal(&w);
+  cs_wakeup_signal(&w);
+  ASSERT(wakeup_readable(&w));
+  ASSERT(recv(w.rfd, buf, sizeof(buf), 0) > 0);
+  cs_wakeup_signal(&w);
+  ASSERT(cs_wakeup_drain(&w));
+  ASSERT(!wakeup_readable(&w));
+  cs_wakeup_deinit(&w);
+  return NULL;
+}
+#endif
+
 static const char *test_cs_timegm(void) {
   struct tm t;
   time_t now = time(NULL);
@@ -358,6 +724,14 @@ const char *tests_run(const char *filter) {
   RUN_TEST(test_testutil);
   RUN_TEST(test_c_snprintf);
   RUN_TEST(test_cs_varint);
+  RUN_TEST(test_cs_pool);
+  RUN_TEST(test_cs_rbuf);
+  RUN_TEST(test_cs_rbuf_dma);
+  RUN_TEST(test_cs_rbuf_spsc);
+#ifndef _WIN32
+  RUN_TEST(test_cs_rbuf_spsc_threads);
+  RUN_TEST(test_cs_wakeup);
+#endif
   RUN_TEST(test_cs_timegm);
   RUN_TEST(test_mg_match_prefix);
   RUN_TEST(test_mg_mk_str);
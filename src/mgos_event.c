@@ -16,28 +16,69 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "mgos_event.h"
 
 #include "common/cs_dbg.h"
 #include "common/queue.h"
 
-struct handler {
-  int ev;
+#include "mgos_system.h"
+
+#ifndef MGOS_EVENT_HANDLERS_HASH_BITS
+#define MGOS_EVENT_HANDLERS_HASH_BITS 5
+#endif
+#define MGOS_EVENT_HANDLERS_HASH_SIZE (1 << MGOS_EVENT_HANDLERS_HASH_BITS)
+
+/* Size of the queue used by mgos_event_post(), must be a power of 2. */
+#ifndef MGOS_EVENT_POST_BUF_SIZE
+#define MGOS_EVENT_POST_BUF_SIZE 1024
+#endif
+/* Max number of posted events delivered before yielding to the main loop. */
+#ifndef MGOS_EVENT_POST_BATCH
+#define MGOS_EVENT_POST_BATCH 16
+#endif
 
+#if (MGOS_EVENT_POST_BUF_SIZE & (MGOS_EVENT_POST_BUF_SIZE - 1)) != 0
+#error MGOS_EVENT_POST_BUF_SIZE must be a power of 2
+#endif
+
+/* Skip records span up to the rest of the buffer, see posted_event.len. */
+#if MGOS_EVENT_POST_BUF_SIZE > 65536
+#error MGOS_EVENT_POST_BUF_SIZE must not exceed 65536
+#endif
+
+#ifndef IRAM
+#define IRAM
+#endif
+
+struct handler {
   mgos_event_handler_t cb;
   void *userdata;
 
   /*
-   * If set, the event handler is intended for all events from
-   * `ev & ~0xff` to `ev | 0xff`
+   * Registration sequence number, used to keep the most recently added
+   * handler first when exact and group handlers are merged on dispatch.
    */
-  bool group;
+  uint32_t seq;
 
   SLIST_ENTRY(handler) next;
 };
 
+/*
+ * All handlers registered for the same key: either the exact event number
+ * or, if `group` is set, the base number of a group of events from
+ * `ev & ~0xff` to `ev | 0xff`. Handlers are kept newest first.
+ */
+struct handler_list {
+  int ev;
+  bool group;
+  SLIST_HEAD(handlers, handler) handlers;
+  SLIST_ENTRY(handler_list) next;
+};
+
 struct event {
   int ev;
   const char *name;
@@ -45,8 +86,48 @@ struct event {
 };
 
 static SLIST_HEAD(s_events, event) s_events = SLIST_HEAD_INITIALIZER(s_events);
-static SLIST_HEAD(s_handlers,
-                  handler) s_handlers = SLIST_HEAD_INITIALIZER(s_handlers);
+static SLIST_HEAD(handler_lists, handler_list)
+    s_handlers[MGOS_EVENT_HANDLERS_HASH_SIZE];
+static uint32_t s_handler_seq = 0;
+
+/*
+ * Record header in the post queue. Records are 8-byte aligned and never
+ * wrap: if there is not enough room at the end of the buffer, a `skip`
+ * record fills it up and the event goes at the start.
+ */
+struct posted_event {
+  int ev;
+  uint16_t len;
+  uint8_t skip;
+  volatile uint8_t ready;
+};
+
+#define POSTED_EVENT_ALIGN 8
+#define POSTED_EVENT_SIZE(len)                                           \
+  ((sizeof(struct posted_event) + (len) + POSTED_EVENT_ALIGN - 1) & \
+   ~(POSTED_EVENT_ALIGN - 1))
+
+/*
+ * Producers reserve space and commit records under mgos_ints_disable(),
+ * the payload copy and handler invocation happen outside of it.
+ * Head and tail are free-running offsets.
+ */
+static uint64_t s_post_buf[MGOS_EVENT_POST_BUF_SIZE / sizeof(uint64_t)];
+static uint32_t s_post_head = 0, s_post_tail = 0;
+static bool s_post_scheduled = false;
+
+static inline unsigned int handlers_hash(int ev, bool group) {
+  uint32_t k = ((uint32_t) ev) ^ (group ? 1 : 0);
+  return (k * 2654435761U) >> (32 - MGOS_EVENT_HANDLERS_HASH_BITS);
+}
+
+static struct handler_list *find_handlers(int ev, bool group) {
+  struct handler_list *hl;
+  SLIST_FOREACH(hl, &s_handlers[handlers_hash(ev, group)], next) {
+    if (hl->ev == ev && hl->group == group) return hl;
+  }
+  return NULL;
+}
 
 bool mgos_event_register_base(int ev, const char *name) {
   struct event *e;
@@ -66,18 +147,28 @@ bool mgos_event_register_base(int ev, const char *name) {
 
 static bool add_handler(int ev, mgos_event_handler_t cb, void *userdata,
                         bool group) {
+  /* When adding a group handler, make sure `ev` is a base event number */
+  if (group) {
+    ev &= ~0xff;
+  }
   struct handler *h = calloc(1, sizeof(*h));
   if (h == NULL) return false;
-  h->ev = ev;
+  struct handler_list *hl = find_handlers(ev, group);
+  if (hl == NULL) {
+    hl = calloc(1, sizeof(*hl));
+    if (hl == NULL) {
+      free(h);
+      return false;
+    }
+    hl->ev = ev;
+    hl->group = group;
+    SLIST_INIT(&hl->handlers);
+    SLIST_INSERT_HEAD(&s_handlers[handlers_hash(ev, group)], hl, next);
+  }
   h->cb = cb;
   h->userdata = userdata;
-  h->group = group;
-
-  /* When adding a group handler, make sure `ev` is a base event number */
-  if (group) {
-    h->ev &= ~0xff;
-  }
-  SLIST_INSERT_HEAD(&s_handlers, h, next);
+  h->seq = s_handler_seq++;
+  SLIST_INSERT_HEAD(&hl->handlers, h, next);
   return true;
 }
 
@@ -92,21 +183,20 @@ bool mgos_event_add_group_handler(int evgrp, mgos_event_handler_t cb,
 
 static bool remove_handler(int ev, mgos_event_handler_t cb, void *userdata,
                            bool group) {
-  struct handler *ph = NULL, *h = NULL, *th;
-  SLIST_FOREACH_SAFE(h, &s_handlers, next, th) {
-    if (h->ev == ev && h->group == group && h->cb == cb &&
-        h->userdata == userdata) {
-      break;
-    }
-    ph = h;
+  struct handler_list *hl = find_handlers(ev, group);
+  if (hl == NULL) return false;
+  struct handler *h;
+  SLIST_FOREACH(h, &hl->handlers, next) {
+    if (h->cb == cb && h->userdata == userdata) break;
   }
   if (h == NULL) return false;
-  if (ph == NULL) {
-    SLIST_REMOVE_HEAD(&s_handlers, next);
-  } else {
-    SLIST_REMOVE_AFTER(ph, next);
-  }
+  SLIST_REMOVE(&hl->handlers, h, handler, next);
   free(h);
+  if (SLIST_EMPTY(&hl->handlers)) {
+    SLIST_REMOVE(&s_handlers[handlers_hash(ev, group)], hl, handler_list,
+                 next);
+    free(hl);
+  }
   return true;
 }
 
@@ -121,13 +211,28 @@ bool mgos_event_remove_group_handler(int evgrp, mgos_event_handler_t cb,
 }
 
 int mgos_event_trigger(int ev, void *ev_data) {
-  struct handler *h, *te;
+  struct handler_list *ehl = find_handlers(ev, false);
+  struct handler_list *ghl = find_handlers(ev & ~0xff, true);
+  struct handler *eh = (ehl != NULL ? SLIST_FIRST(&ehl->handlers) : NULL);
+  struct handler *gh = (ghl != NULL ? SLIST_FIRST(&ghl->handlers) : NULL);
   int count = 0;
-  SLIST_FOREACH_SAFE(h, &s_handlers, next, te) {
-    if (h->ev == ev || (h->group && ev >= h->ev && ev <= (h->ev | 0xff))) {
-      h->cb(ev, ev_data, h->userdata);
-      count++;
+  /*
+   * Both lists are newest first; merge them by sequence number so that
+   * handlers are invoked in the same order regardless of their kind.
+   * The next pointer is taken before the call, so a handler may remove
+   * itself.
+   */
+  while (eh != NULL || gh != NULL) {
+    struct handler *h;
+    if (gh == NULL || (eh != NULL && (int32_t)(eh->seq - gh->seq) > 0)) {
+      h = eh;
+      eh = SLIST_NEXT(eh, next);
+    } else {
+      h = gh;
+      gh = SLIST_NEXT(gh, next);
     }
+    h->cb(ev, ev_data, h->userdata);
+    count++;
   }
   if (ev != MGOS_EVENT_LOG) {
     const uint8_t *u = (uint8_t *) &ev;
@@ -137,3 +242,95 @@ int mgos_event_trigger(int ev, void *ev_data) {
   }
   return count;
 }
+
+static inline struct posted_event *posted_event_at(uint32_t off) {
+  return (struct posted_event *) (((uint8_t *) s_post_buf) +
+                                  (off & (MGOS_EVENT_POST_BUF_SIZE - 1)));
+}
+
+static void mgos_event_post_cb(void *arg);
+
+/* Make sure the queue will be drained. */
+static IRAM bool mgos_event_post_schedule(bool from_isr) {
+  mgos_ints_disable();
+  bool scheduled = s_post_scheduled;
+  s_post_scheduled = true;
+  mgos_ints_enable();
+  if (scheduled) return true;
+  if (mgos_invoke_cb(mgos_event_post_cb, NULL, from_isr)) return true;
+  mgos_ints_disable();
+  s_post_scheduled = false;
+  mgos_ints_enable();
+  return false;
+}
+
+static void mgos_event_post_cb(void *arg) {
+  int n = 0;
+  mgos_ints_disable();
+  s_post_scheduled = false;
+  while (s_post_tail != s_post_head) {
+    struct posted_event *pe = posted_event_at(s_post_tail);
+    if (!pe->ready) break; /* Still being written, will be rescheduled. */
+    if (pe->skip) {
+      s_post_tail += pe->len;
+      continue;
+    }
+    if (n == MGOS_EVENT_POST_BATCH) break;
+    mgos_ints_enable();
+    /* The record stays reserved until the handlers are done with it. */
+    mgos_event_trigger(pe->ev, (pe->len > 0 ? pe + 1 : NULL));
+    n++;
+    mgos_ints_disable();
+    s_post_tail += POSTED_EVENT_SIZE(pe->len);
+  }
+  bool more = (s_post_tail != s_post_head);
+  mgos_ints_enable();
+  if (more) {
+    /* Either the batch is over or a producer is mid-copy: come back later. */
+    mgos_event_post_schedule(false /* from_isr */);
+  }
+  (void) arg;
+}
+
+IRAM bool mgos_event_post(int ev, const void *ev_data, size_t len,
+                          bool from_isr) {
+  if (len > MGOS_EVENT_POST_MAX_DATA_LEN) return false;
+  uint32_t size = POSTED_EVENT_SIZE(len);
+  struct posted_event *pe;
+  mgos_ints_disable();
+  uint32_t off = s_post_head & (MGOS_EVENT_POST_BUF_SIZE - 1);
+  uint32_t skip = (off + size > MGOS_EVENT_POST_BUF_SIZE
+                       ? MGOS_EVENT_POST_BUF_SIZE - off
+                       : 0);
+  if (s_post_head - s_post_tail + skip + size > MGOS_EVENT_POST_BUF_SIZE) {
+    mgos_ints_enable();
+    return false;
+  }
+  if (skip > 0) {
+    pe = posted_event_at(s_post_head);
+    pe->ev = 0;
+    pe->len = skip;
+    pe->skip = true;
+    pe->ready = true;
+    s_post_head += skip;
+  }
+  pe = posted_event_at(s_post_head);
+  pe->ev = ev;
+  pe->len = len;
+  pe->skip = false;
+  pe->ready = false;
+  s_post_head += size;
+  mgos_ints_enable();
+
+  if (len > 0) memcpy(pe + 1, ev_data, len);
+
+  mgos_ints_disable();
+  pe->ready = true;
+  mgos_ints_enable();
+  /*
+   * Even if the callback cannot be scheduled now, the event stays queued
+   * and goes out with the next successful post.
+   */
+  mgos_event_post_schedule(from_isr);
+  return true;
+}
@@ -19,6 +19,7 @@
 #include "mgos_net_internal.h"
 
 #include "common/cs_dbg.h"
+#include "common/cs_pool.h"
 #include "common/queue.h"
 
 #include "mgos_event.h"
@@ -38,6 +39,18 @@ struct net_ev_info {
   enum mgos_net_event ev;
 };
 
+#ifndef MGOS_NET_EV_POOL_PREALLOC
+#define MGOS_NET_EV_POOL_PREALLOC 4
+#endif
+#ifndef MGOS_NET_EV_POOL_GROW
+#define MGOS_NET_EV_POOL_GROW 4
+#endif
+
+/* Events are posted from network stack tasks, pool is guarded by mgos_lock. */
+static struct cs_pool s_net_ev_pool =
+    CS_POOL_INIT(sizeof(struct net_ev_info), MGOS_NET_EV_POOL_PREALLOC,
+                 MGOS_NET_EV_POOL_GROW);
+
 static const char *get_if_name(enum mgos_net_if_type if_type, int if_instance) {
   const char *name = "";
   switch (if_type) {
@@ -109,18 +122,32 @@ static void mgos_net_on_change_cb(void *arg) {
 
   mgos_event_trigger(ei->ev, &evd);
 
-  free(ei);
+  mgos_lock();
+  cs_pool_free(&s_net_ev_pool, ei);
+  mgos_unlock();
   (void) if_name;
 }
 
 void mgos_net_dev_event_cb(enum mgos_net_if_type if_type, int if_instance,
                            enum mgos_net_event ev) {
-  struct net_ev_info *ei = (struct net_ev_info *) calloc(1, sizeof(*ei));
+  mgos_lock();
+  struct net_ev_info *ei = (struct net_ev_info *) cs_pool_alloc(&s_net_ev_pool);
+  mgos_unlock();
   if (ei == NULL) return;
   ei->if_type = if_type;
   ei->if_instance = if_instance;
   ei->ev = ev;
-  mgos_invoke_cb(mgos_net_on_change_cb, ei, false /* from_isr */);
+  if (!mgos_invoke_cb(mgos_net_on_change_cb, ei, false /* from_isr */)) {
+    mgos_lock();
+    cs_pool_free(&s_net_ev_pool, ei);
+    mgos_unlock();
+  }
+}
+
+void mgos_net_get_ev_pool_stats(struct cs_pool_stats *stats) {
+  mgos_lock();
+  cs_pool_get_stats(&s_net_ev_pool, stats);
+  mgos_unlock();
 }
 
 bool mgos_net_get_ip_info(enum mgos_net_if_type if_type, int if_instance,
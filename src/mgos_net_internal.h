@@ -8,6 +8,8 @@
 
 #include <stdbool.h>
 
+#include "common/cs_pool.h"
+
 #include "mgos_init.h"
 
 #include "mgos_net.h"
@@ -18,6 +20,9 @@ extern "C" {
 
 enum mgos_init_result mgos_net_init(void);
 
+/* Get occupancy stats of the network event pool. */
+void mgos_net_get_ev_pool_stats(struct cs_pool_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
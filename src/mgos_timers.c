@@ -17,7 +17,8 @@
 
 #include "mgos_timers_internal.h"
 
-#include "common/queue.h"
+#include "common/cs_dbg.h"
+#include "common/cs_pool.h"
 
 #include "mgos_event.h"
 #include "mgos_features.h"
@@ -27,9 +28,28 @@
 #include "mgos_time.h"
 
 #ifdef __LP64__
-#define MGOS_SW_TIMER_MASK 0xffff000000000000
+typedef uint32_t timer_gen_t;
 #else
-#define MGOS_SW_TIMER_MASK 0xffff0000
+typedef uint16_t timer_gen_t;
+#endif
+
+/*
+ * Software timer ID is a slot index in the lower bits and the slot generation
+ * in the bits covered by MGOS_SW_TIMER_MASK. Generation is never 0, so SW timer
+ * IDs never collide with HW timer IDs, and it changes every time the slot is
+ * released, so IDs of timers that have fired or have been cleared are rejected
+ * even if the slot has been reused.
+ * Where the ID is 32 bits, the generation is 16 bits and an ID held across
+ * 65535 re-arms of the same slot matches again. On 64-bit hosts it's 32 bits.
+ */
+#define MGOS_SW_TIMER_MAX_SLOTS 0xffff
+
+/* Timers are allocated from a pool: this many up front, then in chunks. */
+#ifndef MGOS_SW_TIMERS_POOL_PREALLOC
+#define MGOS_SW_TIMERS_POOL_PREALLOC 16
+#endif
+#ifndef MGOS_SW_TIMERS_POOL_GROW
+#define MGOS_SW_TIMERS_POOL_GROW 8
 #endif
 
 #ifndef IRAM
@@ -38,110 +58,326 @@
 
 struct timer_info {
   int interval_ms;
-  double next_invocation;
+  /* Timer may be fired up to this many ms past next_invocation */
+  int slack_ms;
+  /* Monotonic time of the next invocation, in mgos_uptime_micros() units */
+  int64_t next_invocation;
   timer_callback cb;
   void *cb_arg;
-  LIST_ENTRY(timer_info) entries;
+  /* Position of this timer in timer_data.heap */
+  int heap_idx;
+  /* Index of this timer in timer_data.slots */
+  int slot_idx;
+};
+
+struct timer_slot {
+  struct timer_info *ti; /* NULL if the slot is free */
+  timer_gen_t gen;
+  int next_free;
 };
 
 struct timer_data {
-  struct timer_info *current;
   struct mg_connection *nc;
-  LIST_HEAD(timers, timer_info) timers;
+  /*
+   * Armed timers, kept as a binary min-heap ordered by next_invocation:
+   * the timer that is due first is always at heap[0].
+   */
+  struct timer_info **heap;
+  int num_timers;
+  int heap_size;
+  /* ID -> timer mapping, free slots are chained through next_free. */
+  struct timer_slot *slots;
+  int num_slots;
+  int free_slot;
+  struct cs_pool pool;
+  struct mgos_timers_stats stats;
+  /* Callbacks running longer than this are reported, 0 - disabled. */
+  int cb_budget_us;
 };
 
+#define TIMER_HEAP_INITIAL_SIZE 8
+
 static struct timer_data *s_timer_data = NULL;
 static struct mgos_rlock_type *s_timer_data_lock = NULL;
 
-static void schedule_next_timer(struct timer_data *td) {
-  struct timer_info *ti;
-  struct timer_info *min_ti = NULL;
-  LIST_FOREACH(ti, &td->timers, entries) {
-    if (min_ti == NULL || ti->next_invocation < min_ti->next_invocation) {
-      min_ti = ti;
+static inline void heap_set(struct timer_data *td, int i,
+                            struct timer_info *ti) {
+  td->heap[i] = ti;
+  ti->heap_idx = i;
+}
+
+static void heap_sift_up(struct timer_data *td, int i) {
+  struct timer_info *ti = td->heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (td->heap[parent]->next_invocation <= ti->next_invocation) break;
+    heap_set(td, i, td->heap[parent]);
+    i = parent;
+  }
+  heap_set(td, i, ti);
+}
+
+static void heap_sift_down(struct timer_data *td, int i) {
+  struct timer_info *ti = td->heap[i];
+  while (true) {
+    int child = 2 * i + 1;
+    if (child >= td->num_timers) break;
+    if (child + 1 < td->num_timers &&
+        td->heap[child + 1]->next_invocation <
+            td->heap[child]->next_invocation) {
+      child++;
+    }
+    if (ti->next_invocation <= td->heap[child]->next_invocation) break;
+    heap_set(td, i, td->heap[child]);
+    i = child;
+  }
+  heap_set(td, i, ti);
+}
+
+static bool heap_insert(struct timer_data *td, struct timer_info *ti) {
+  if (td->num_timers == td->heap_size) {
+    int new_size =
+        (td->heap_size > 0 ? td->heap_size * 2 : TIMER_HEAP_INITIAL_SIZE);
+    struct timer_info **new_heap = (struct timer_info **) realloc(
+        td->heap, new_size * sizeof(*new_heap));
+    if (new_heap == NULL) return false;
+    td->heap = new_heap;
+    td->heap_size = new_size;
+  }
+  heap_set(td, td->num_timers++, ti);
+  heap_sift_up(td, ti->heap_idx);
+  return true;
+}
+
+static void heap_remove(struct timer_data *td, struct timer_info *ti) {
+  int i = ti->heap_idx;
+  struct timer_info *last = td->heap[--td->num_timers];
+  if (last == ti) return;
+  heap_set(td, i, last);
+  if (i > 0 && td->heap[(i - 1) / 2]->next_invocation > last->next_invocation) {
+    heap_sift_up(td, i);
+  } else {
+    heap_sift_down(td, i);
+  }
+}
+
+static bool slot_alloc(struct timer_data *td, struct timer_info *ti) {
+  if (td->free_slot < 0) {
+    int i;
+    int new_num =
+        (td->num_slots > 0 ? td->num_slots * 2 : TIMER_HEAP_INITIAL_SIZE);
+    if (new_num > MGOS_SW_TIMER_MAX_SLOTS) new_num = MGOS_SW_TIMER_MAX_SLOTS;
+    if (new_num <= td->num_slots) return false;
+    struct timer_slot *new_slots = (struct timer_slot *) realloc(
+        td->slots, new_num * sizeof(*new_slots));
+    if (new_slots == NULL) return false;
+    for (i = td->num_slots; i < new_num; i++) {
+      new_slots[i].ti = NULL;
+      new_slots[i].gen = 1;
+      new_slots[i].next_free = (i + 1 < new_num ? i + 1 : -1);
     }
+    td->slots = new_slots;
+    td->free_slot = td->num_slots;
+    td->num_slots = new_num;
   }
-  td->current = min_ti;
-  td->nc->ev_timer_time = (min_ti != NULL ? min_ti->next_invocation : 0);
+  struct timer_slot *ts = &td->slots[td->free_slot];
+  ti->slot_idx = td->free_slot;
+  td->free_slot = ts->next_free;
+  ts->ti = ti;
+  return true;
+}
+
+static void slot_free(struct timer_data *td, struct timer_info *ti) {
+  struct timer_slot *ts = &td->slots[ti->slot_idx];
+  ts->ti = NULL;
+  if (++ts->gen == 0) ts->gen = 1;
+  ts->next_free = td->free_slot;
+  td->free_slot = ti->slot_idx;
+}
+
+static inline mgos_timer_id slot_timer_id(const struct timer_data *td,
+                                          const struct timer_info *ti) {
+  return (((mgos_timer_id) td->slots[ti->slot_idx].gen)
+          << MGOS_SW_TIMER_GEN_SHIFT) |
+         (mgos_timer_id) ti->slot_idx;
+}
+
+static struct timer_info *slot_get_timer(const struct timer_data *td,
+                                         mgos_timer_id id) {
+  mgos_timer_id idx = (id & ~MGOS_SW_TIMER_MASK);
+  timer_gen_t gen = (timer_gen_t) (id >> MGOS_SW_TIMER_GEN_SHIFT);
+  if (idx >= (mgos_timer_id) td->num_slots) return NULL;
+  if (td->slots[idx].gen != gen) return NULL;
+  return td->slots[idx].ti;
+}
+
+/*
+ * Returns the latest time not past the slack window of any timer in the
+ * subtree rooted at heap[i], starting with `limit`. Subtrees of timers that
+ * are not due by then are skipped, so the cost only depends on the number of
+ * timers that will fire together.
+ */
+static inline int64_t timer_latest(const struct timer_info *ti) {
+  return ti->next_invocation + ti->slack_ms * 1000LL;
+}
+
+static int64_t heap_min_latest(const struct timer_data *td, int i,
+                               int64_t limit) {
+  if (i >= td->num_timers) return limit;
+  const struct timer_info *ti = td->heap[i];
+  if (ti->next_invocation > limit) return limit;
+  const int64_t latest = timer_latest(ti);
+  if (latest < limit) limit = latest;
+  limit = heap_min_latest(td, 2 * i + 1, limit);
+  return heap_min_latest(td, 2 * i + 2, limit);
+}
+
+/*
+ * Wake up as late as slack of the pending timers allows: that way expirations
+ * with overlapping windows are handled by a single wakeup.
+ * Mongoose timer runs on wall time, so the monotonic deadline is converted
+ * here. This is the only place where it's done.
+ */
+static void schedule_next_timer(struct timer_data *td) {
+  double next = 0;
+  if (td->num_timers > 0) {
+    int64_t delta = heap_min_latest(td, 0, timer_latest(td->heap[0])) -
+                    mgos_uptime_micros();
+    if (delta < 0) delta = 0;
+    next = mg_time() + delta / 1000000.0;
+  }
+  td->nc->ev_timer_time = next;
+}
+
+static void hist_add(uint32_t *hist, int64_t v) {
+  int i = 0;
+  while (v > 0 && i < MGOS_TIMERS_STATS_HIST_SIZE - 1) {
+    v >>= 1;
+    i++;
+  }
+  hist[i]++;
+}
+
+static void timer_stats_add(struct timer_data *td, timer_callback cb,
+                            int64_t lateness, int64_t duration) {
+  struct mgos_timers_stats *st = &td->stats;
+  hist_add(st->lateness_hist, lateness);
+  hist_add(st->duration_hist, duration);
+  if (lateness > st->max_lateness_us) st->max_lateness_us = lateness;
+  if (duration > st->max_duration_us) st->max_duration_us = duration;
+  if (td->cb_budget_us > 0 && duration > td->cb_budget_us) {
+    st->num_over_budget++;
+    LOG(LL_WARN, ("Timer cb %p took %lld us (budget %d)", cb,
+                  (long long) duration, td->cb_budget_us));
+  }
+  (void) cb;
 }
 
 static void mgos_timer_ev(struct mg_connection *nc, int ev, void *ev_data,
                           void *user_data) {
   if (ev != MG_EV_TIMER) return;
-  timer_callback cb = NULL;
-  void *cb_arg = NULL;
-  {
-    mgos_rlock(s_timer_data_lock);
-    struct timer_data *td = (struct timer_data *) user_data;
-    struct timer_info *ti = td->current;
-    /* Current can be NULL if it was the first to fire but was cleared. */
-    if (ti != NULL) {
-      cb = ti->cb;
-      cb_arg = ti->cb_arg;
-      if (ti->interval_ms >= 0) {
-        const double now = mg_time();
-        const double intvl = (ti->interval_ms / 1000.0);
-        ti->next_invocation += intvl;
-        /* Polling loop was delayed, re-sync the invocation. */
-        if (ti->next_invocation < now) ti->next_invocation = now + intvl;
-        ti = NULL;
-      } else {
-        LIST_REMOVE(ti, entries);
-      }
+  struct timer_data *td = (struct timer_data *) user_data;
+  int num_fired = 0;
+  mgos_rlock(s_timer_data_lock);
+  const int64_t now = mgos_uptime_micros();
+  /* Repeating timers re-armed during this wakeup must wait for the next one. */
+  const int max_fired = td->num_timers;
+  /* Heap can be empty if the timer that was due has been cleared. */
+  while (num_fired < max_fired && td->num_timers > 0 &&
+         td->heap[0]->next_invocation <= now) {
+    struct timer_info *ti = td->heap[0];
+    timer_callback cb = ti->cb;
+    void *cb_arg = ti->cb_arg;
+    /* Earlier callbacks in this batch may have taken a while. */
+    const int64_t lateness = mgos_uptime_micros() - ti->next_invocation;
+    if (ti->interval_ms >= 0) {
+      const int64_t intvl = ti->interval_ms * 1000LL;
+      ti->next_invocation += intvl;
+      /* Polling loop was delayed, re-sync the invocation. */
+      if (ti->next_invocation < now) ti->next_invocation = now + intvl;
+      heap_sift_down(td, 0);
+    } else {
+      heap_remove(td, ti);
+      slot_free(td, ti);
+      cs_pool_free(&td->pool, ti);
     }
-    schedule_next_timer(td);
+    num_fired++;
     mgos_runlock(s_timer_data_lock);
-    if (ti != NULL) free(ti);
+    const int64_t cb_start = mgos_uptime_micros();
+    if (cb != NULL) cb(cb_arg);
+    const int64_t duration = mgos_uptime_micros() - cb_start;
+    mgos_rlock(s_timer_data_lock);
+    timer_stats_add(td, cb, lateness, duration);
   }
-  if (cb != NULL) cb(cb_arg);
+  if (num_fired > 0) {
+    td->stats.num_wakeups++;
+    td->stats.num_fired += num_fired;
+    td->stats.num_merged += num_fired - 1;
+  }
+  schedule_next_timer(td);
+  mgos_runlock(s_timer_data_lock);
   (void) ev_data;
   (void) nc;
 }
 
 mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb,
                              void *arg) {
-  struct timer_info *ti = (struct timer_info *) calloc(1, sizeof(*ti));
-  if (ti == NULL) return MGOS_INVALID_TIMER_ID;
+  return mgos_set_timer_ex(msecs, 0 /* slack_ms */, flags, cb, arg);
+}
+
+mgos_timer_id mgos_set_timer_ex(int msecs, int slack_ms, int flags,
+                                timer_callback cb, void *arg) {
+  mgos_timer_id id = MGOS_INVALID_TIMER_ID;
+  mgos_rlock(s_timer_data_lock);
+  struct timer_info *ti =
+      (struct timer_info *) cs_pool_alloc(&s_timer_data->pool);
+  if (ti == NULL) goto out;
   if (flags & MGOS_TIMER_REPEAT) {
     ti->interval_ms = msecs;
   } else {
     ti->interval_ms = -1;
   }
-  if (flags & MGOS_TIMER_RUN_NOW) {
-    ti->next_invocation = 1;
-  } else {
-    ti->next_invocation = mg_time() + msecs / 1000.0;
-  }
+  ti->slack_ms = (slack_ms > 0 ? slack_ms : 0);
+  /* RUN_NOW timers are due when armed, lateness is counted from then. */
+  ti->next_invocation = mgos_uptime_micros();
+  if (!(flags & MGOS_TIMER_RUN_NOW)) ti->next_invocation += msecs * 1000LL;
   ti->cb = cb;
   ti->cb_arg = arg;
-  {
-    mgos_rlock(s_timer_data_lock);
-    LIST_INSERT_HEAD(&s_timer_data->timers, ti, entries);
-    schedule_next_timer(s_timer_data);
-    mgos_runlock(s_timer_data_lock);
+  if (!slot_alloc(s_timer_data, ti)) {
+    cs_pool_free(&s_timer_data->pool, ti);
+    goto out;
+  }
+  if (!heap_insert(s_timer_data, ti)) {
+    slot_free(s_timer_data, ti);
+    cs_pool_free(&s_timer_data->pool, ti);
+    goto out;
   }
-  mongoose_schedule_poll(false /* from_isr */);
-  return (mgos_timer_id) ti;
+  id = slot_timer_id(s_timer_data, ti);
+  schedule_next_timer(s_timer_data);
+out:
+  mgos_runlock(s_timer_data_lock);
+  if (id != MGOS_INVALID_TIMER_ID) mongoose_schedule_poll(false /* from_isr */);
+  return id;
 }
 
 static void mgos_clear_sw_timer(mgos_timer_id id) {
-  struct timer_info *ti = (struct timer_info *) id, *ti2;
   mgos_rlock(s_timer_data_lock);
-  LIST_FOREACH(ti2, &s_timer_data->timers, entries) {
-    if (ti2 == ti) break;
-  }
-  if (ti2 == NULL) {
+  struct timer_info *ti = slot_get_timer(s_timer_data, id);
+  if (ti == NULL) {
     /* Not a valid timer */
     mgos_runlock(s_timer_data_lock);
     return;
   }
-  LIST_REMOVE(ti, entries);
-  if (s_timer_data->current == ti) {
-    schedule_next_timer(s_timer_data);
-    /* Removing a timer can only push back invocation, no need to do a poll. */
-  }
+  heap_remove(s_timer_data, ti);
+  slot_free(s_timer_data, ti);
+  cs_pool_free(&s_timer_data->pool, ti);
+  /*
+   * Any timer due within the slack window of the first one may have set the
+   * wakeup time, not just the first one.
+   * Removing a timer can only push back invocation, no need to do a poll.
+   */
+  schedule_next_timer(s_timer_data);
   mgos_runlock(s_timer_data_lock);
-  free(ti);
 }
 
 void mgos_clear_hw_timer(mgos_timer_id id);
@@ -158,15 +394,40 @@ IRAM void mgos_clear_timer(mgos_timer_id id) {
 
 static void mgos_time_change_cb(int ev, void *evd, void *arg) {
   struct timer_data *td = (struct timer_data *) arg;
-  struct mgos_time_changed_arg *ev_data = (struct mgos_time_changed_arg *) evd;
+  /*
+   * Timers run on monotonic time and are not affected, only the wall time
+   * deadline of the mongoose timer needs to be recalculated.
+   */
   mgos_rlock(s_timer_data_lock);
-  struct timer_info *ti;
-  LIST_FOREACH(ti, &td->timers, entries) {
-    ti->next_invocation += ev_data->delta;
-  }
+  schedule_next_timer(td);
   mgos_runlock(s_timer_data_lock);
 
   (void) ev;
+  (void) evd;
+}
+
+void mgos_timers_get_stats(struct mgos_timers_stats *stats) {
+  mgos_rlock(s_timer_data_lock);
+  memcpy(stats, &s_timer_data->stats, sizeof(*stats));
+  mgos_runlock(s_timer_data_lock);
+}
+
+void mgos_timers_reset_stats(void) {
+  mgos_rlock(s_timer_data_lock);
+  memset(&s_timer_data->stats, 0, sizeof(s_timer_data->stats));
+  mgos_runlock(s_timer_data_lock);
+}
+
+void mgos_timers_set_cb_budget(int budget_us) {
+  mgos_rlock(s_timer_data_lock);
+  s_timer_data->cb_budget_us = budget_us;
+  mgos_runlock(s_timer_data_lock);
+}
+
+void mgos_timers_get_pool_stats(struct cs_pool_stats *stats) {
+  mgos_rlock(s_timer_data_lock);
+  cs_pool_get_stats(&s_timer_data->pool, stats);
+  mgos_runlock(s_timer_data_lock);
 }
 
 enum mgos_init_result mgos_hw_timers_init(void);
@@ -175,6 +436,9 @@ enum mgos_init_result mgos_timers_init(void) {
   struct timer_data *td = (struct timer_data *) calloc(1, sizeof(*td));
   struct mg_add_sock_opts opts;
   memset(&opts, 0, sizeof(opts));
+  td->free_slot = -1;
+  cs_pool_init(&td->pool, sizeof(struct timer_info),
+               MGOS_SW_TIMERS_POOL_PREALLOC, MGOS_SW_TIMERS_POOL_GROW);
   td->nc =
       mg_add_sock_opt(mgos_get_mgr(), INVALID_SOCKET, mgos_timer_ev, td, opts);
   if (td->nc == NULL) {
@@ -8,14 +8,28 @@
 
 #include "mgos_timers.h"
 
+#include "common/cs_pool.h"
+
 #include "mgos_init.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+/* Bits of a software timer ID that hold the slot generation, never 0. */
+#ifdef __LP64__
+#define MGOS_SW_TIMER_MASK 0xffffffff00000000
+#define MGOS_SW_TIMER_GEN_SHIFT 32
+#else
+#define MGOS_SW_TIMER_MASK 0xffff0000
+#define MGOS_SW_TIMER_GEN_SHIFT 16
+#endif
+
 enum mgos_init_result mgos_timers_init(void);
 
+/* Get occupancy stats of the software timer pool. */
+void mgos_timers_get_pool_stats(struct cs_pool_stats *stats);
+
 /* Initialize uptime */
 void mgos_uptime_init(void);
 
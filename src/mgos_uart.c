@@ -17,7 +17,11 @@
 
 #include "mgos_uart_internal.h"
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common/cs_dbg.h"
 
@@ -57,56 +61,369 @@ IRAM void mgos_uart_schedule_dispatcher(int uart_no, bool from_isr) {
 #endif
 }
 
+static inline bool uart_is_fc_char(uint8_t ch) {
+  return (ch == MGOS_UART_XON_CHAR || ch == MGOS_UART_XOFF_CHAR);
+}
+
+/*
+ * Find the first XON or XOFF in [p, end), a word at a time.
+ * Returns end if there are none, which is by far the most common case.
+ */
+static const uint8_t *uart_find_fc_char(const uint8_t *p, const uint8_t *end) {
+  const uintptr_t ones = ((uintptr_t) -1) / 0xff, highs = ones << 7;
+  const uintptr_t xon = ones * MGOS_UART_XON_CHAR;
+  const uintptr_t xoff = ones * MGOS_UART_XOFF_CHAR;
+  while (p < end && ((uintptr_t) p & (sizeof(uintptr_t) - 1)) != 0) {
+    if (uart_is_fc_char(*p)) return p;
+    p++;
+  }
+  for (; end - p >= (ptrdiff_t) sizeof(uintptr_t); p += sizeof(uintptr_t)) {
+    uintptr_t w, a, b;
+    memcpy(&w, p, sizeof(w));
+    a = w ^ xon;
+    b = w ^ xoff;
+    /* Non-zero if any byte of a or b is zero. */
+    if (((a - ones) & ~a & highs) | ((b - ones) & ~b & highs)) break;
+  }
+  while (p < end && !uart_is_fc_char(*p)) p++;
+  return p;
+}
+
+/* Copy len bytes from src to *w, wrapping *w around the end of the ring. */
+static void uart_rx_move(cs_rbuf_t *b, uint8_t **w, const uint8_t *src,
+                         uint16_t len) {
+  while (len > 0) {
+    uint16_t n = MIN(len, b->end - *w);
+    memmove(*w, src, n);
+    *w += n;
+    if (*w >= b->end) *w = b->begin;
+    src += n;
+    len -= n;
+  }
+}
+
+/*
+ * Remove XON/XOFF characters from the data that has just been received and
+ * act on them. Done at ingest time so that rx_buf only ever contains
+ * payload and can be handed out as is.
+ * Data is scanned in contiguous runs and nothing is moved until a control
+ * character is found; after that, clean runs are moved back to close the
+ * gap.
+ */
+static void uart_rx_filter_sw_fc(struct mgos_uart_state *us, uint16_t start) {
+  cs_rbuf_t *b = &us->rx_buf;
+  uint16_t n = b->used - start, removed = 0;
+  uint8_t *r = b->head + start, *w = NULL;
+  if (r >= b->end) r = b->begin + (r - b->end);
+  while (n > 0) {
+    uint16_t seg = MIN(n, b->end - r);
+    uint16_t clean = uart_find_fc_char(r, r + seg) - r;
+    if (w != NULL) uart_rx_move(b, &w, r, clean);
+    r += clean;
+    n -= clean;
+    if (clean < seg) {
+      us->xoff_recd = (*r == MGOS_UART_XOFF_CHAR);
+      if (w == NULL) w = r;
+      removed++;
+      r++;
+      n--;
+    }
+    if (r >= b->end) r = b->begin;
+  }
+  if (removed == 0) return;
+  b->tail = w;
+  b->used -= removed;
+  b->avail += removed;
+  if (b->used == 0) b->head = b->tail = b->begin;
+}
+
+static void uart_rx_top(struct mgos_uart_state *us) {
+  uint16_t start = us->rx_buf.used;
+  mgos_uart_hal_dispatch_rx_top(us);
+  if (us->cfg.tx_fc_type == MGOS_UART_FC_SW && us->rx_buf.used > start) {
+    uart_rx_filter_sw_fc(us, start);
+  }
+}
+
+/*
+ * Point spans at the first len bytes of rx_buf.
+ * Empty spans still get a valid pointer, so they can be passed to memcpy().
+ */
+static void uart_rxb_spans(const cs_rbuf_t *b, size_t len,
+                           struct mg_str spans[2]) {
+  spans[0].p = spans[1].p = (b != NULL ? (const char *) b->begin : "");
+  spans[0].len = spans[1].len = 0;
+  if (len == 0) return;
+  spans[0].p = (const char *) b->head;
+  spans[0].len = MIN(len, (size_t)(b->end - b->head));
+  if (spans[0].len < len) {
+    spans[1].p = (const char *) b->begin;
+    spans[1].len = len - spans[0].len;
+  }
+}
+
+/* Consume len bytes from the start of rx_buf. */
+static void uart_rxb_consume(struct mgos_uart_state *us, size_t len) {
+  cs_rbuf_t *b = &us->rx_buf;
+  len = MIN(len, b->used);
+  while (len > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(b, len, &data);
+    cs_rbuf_consume(b, n);
+    len -= n;
+  }
+  /* Scan state is relative to the start of the buffer. */
+  us->rx_frame_scanned = 0;
+}
+
+/* Returns pointer to the byte at offset i from the start of rx_buf. */
+static inline uint8_t *uart_rxb_at(cs_rbuf_t *b, uint16_t i) {
+  uint8_t *p = b->head + i;
+  if (p >= b->end) p -= b->size;
+  return p;
+}
+
+/*
+ * Find the first occurrence of c in rx_buf at or after offset start.
+ * Returns its offset or -1 if there is none.
+ */
+static int uart_rxb_find(cs_rbuf_t *b, uint16_t start, uint8_t c) {
+  while (start < b->used) {
+    uint8_t *p = uart_rxb_at(b, start);
+    uint16_t n = MIN(b->used - start, b->end - p);
+    const uint8_t *q = (const uint8_t *) memchr(p, c, n);
+    if (q != NULL) return start + (q - p);
+    start += n;
+  }
+  return -1;
+}
+
+#define UART_SLIP_END 0xc0
+#define UART_SLIP_ESC 0xdb
+#define UART_SLIP_ESC_END 0xdc
+#define UART_SLIP_ESC_ESC 0xdd
+
+static uint8_t uart_frame_delim(enum mgos_uart_framing framing) {
+  switch (framing) {
+    case MGOS_UART_FRAMING_LINE:
+      return '\n';
+    case MGOS_UART_FRAMING_SLIP:
+      return UART_SLIP_END;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Decode the frame in the first len bytes of rx_buf in place (decoded data
+ * is never longer than encoded, so it is always safe to do).
+ * Returns the length of the decoded frame or -1 if it is malformed.
+ */
+static int uart_frame_decode(struct mgos_uart_state *us, uint16_t len) {
+  cs_rbuf_t *b = &us->rx_buf;
+  uint16_t r = 0, w = 0;
+  switch (us->cfg.rx_framing) {
+    case MGOS_UART_FRAMING_LINE:
+      if (len > 0 && *uart_rxb_at(b, len - 1) == '\r') len--;
+      return len;
+    case MGOS_UART_FRAMING_SLIP:
+      while (r < len) {
+        uint8_t c = *uart_rxb_at(b, r++);
+        if (c == UART_SLIP_ESC) {
+          if (r == len) return -1;
+          c = *uart_rxb_at(b, r++);
+          if (c == UART_SLIP_ESC_END) {
+            c = UART_SLIP_END;
+          } else if (c == UART_SLIP_ESC_ESC) {
+            c = UART_SLIP_ESC;
+          } else {
+            return -1;
+          }
+        }
+        *uart_rxb_at(b, w++) = c;
+      }
+      return w;
+    case MGOS_UART_FRAMING_COBS:
+      while (r < len) {
+        /* Code byte: number of data bytes that follow, plus one. */
+        uint8_t code = *uart_rxb_at(b, r++);
+        if (code == 0 || code - 1 > len - r) return -1;
+        for (uint8_t i = 1; i < code; i++) {
+          *uart_rxb_at(b, w++) = *uart_rxb_at(b, r++);
+        }
+        /* Every block but the last and maximum-length ones ends with 0. */
+        if (code < 0xff && r < len) *uart_rxb_at(b, w++) = 0;
+      }
+      return w;
+    default:
+      return -1;
+  }
+}
+
+/*
+ * Deliver complete frames from rx_buf to the frame handler.
+ * Only the bytes received since the last call are scanned for the delimiter,
+ * using memchr over contiguous runs of the ring; per-byte work is only done
+ * to decode SLIP and COBS frames once they are complete.
+ */
+static void uart_rx_frames(struct mgos_uart_state *us) {
+  cs_rbuf_t *b = &us->rx_buf;
+  uint8_t delim = uart_frame_delim(us->cfg.rx_framing);
+  while (true) {
+    int pos = uart_rxb_find(b, us->rx_frame_scanned, delim);
+    if (pos < 0) {
+      us->rx_frame_scanned = b->used;
+      if (b->avail == 0 && b->used > 0) {
+        /* Frame does not fit, drop it all the way to the next delimiter. */
+        if (!us->rx_frame_discard) us->stats.rx_frame_errors++;
+        us->rx_frame_discard = true;
+        uart_rxb_consume(us, b->used);
+      }
+      break;
+    }
+    int len = -1;
+    if (us->rx_frame_discard) {
+      us->rx_frame_discard = false;
+    } else {
+      len = uart_frame_decode(us, pos);
+      if (len < 0) us->stats.rx_frame_errors++;
+    }
+    if (len > 0 || (len == 0 && us->cfg.rx_framing == MGOS_UART_FRAMING_LINE)) {
+      struct mg_str frame[2];
+      uart_rxb_spans(b, len, frame);
+      us->stats.rx_frames++;
+      uart_unlock(us);
+      us->frame_cb(us->uart_no, frame, us->frame_cb_arg);
+      uart_lock(us);
+    }
+    uart_rxb_consume(us, pos + 1);
+  }
+}
+
 void mgos_uart_dispatcher(void *arg) {
   int uart_no = (intptr_t) arg;
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) return;
   uart_lock(us);
-  if (us->rx_enabled) mgos_uart_hal_dispatch_rx_top(us);
+  if (us->rx_enabled) uart_rx_top(us);
   if (!us->xoff_recd) mgos_uart_hal_dispatch_tx_top(us);
+  if (us->rx_enabled && us->cfg.rx_framing != MGOS_UART_FRAMING_NONE &&
+      us->frame_cb != NULL) {
+    uart_rx_frames(us);
+  }
   if (us->dispatcher_cb != NULL) {
     uart_unlock(us);
     us->dispatcher_cb(uart_no, us->dispatcher_data);
     uart_lock(us);
   }
-  mgos_uart_hal_dispatch_bottom(us);
   if (us->xoff_sent && us->rx_enabled && mgos_uart_rxb_free(us) > 0) {
     char xon = MGOS_UART_XON_CHAR;
     /* We put it at the end of tx_buf, so antire TX fifo will need to drain
-     * before remote transmitter will be re-enabled. */
-    mbuf_append(&us->tx_buf, &xon, 1);
-    us->xoff_sent = false;
+     * before remote transmitter will be re-enabled. If tx_buf is full,
+     * we'll try again on the next dispatch.
+     * This is done before dispatch_bottom so that TX is enabled for it. */
+    if (us->tx_buf.avail > 0) {
+      cs_rbuf_append_one(&us->tx_buf, xon);
+      us->xoff_sent = false;
+    }
   }
-  if (us->rx_buf.len == 0) mbuf_trim(&us->rx_buf);
-  if (us->tx_buf.len == 0) mbuf_trim(&us->tx_buf);
+  mgos_uart_hal_dispatch_bottom(us);
   uart_unlock(us);
 }
 
-size_t mgos_uart_write(int uart_no, const void *buf, size_t len) {
+static size_t uart_writev(int uart_no, const struct mg_str *iov, int cnt,
+                          bool block) {
   size_t written = 0;
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) return 0;
   uart_lock(us);
-  while (written < len) {
-    size_t nw = MIN(len - written, mgos_uart_write_avail(uart_no));
-    mbuf_append(&us->tx_buf, ((const char *) buf) + written, nw);
-    written += nw;
-    if (written < len) mgos_uart_flush(uart_no);
+  for (int i = 0; i < cnt; i++) {
+    size_t seg_written = 0, len = iov[i].len;
+    while (seg_written < len) {
+      size_t nw = MIN(len - seg_written, us->tx_buf.avail);
+      cs_rbuf_append(&us->tx_buf, iov[i].p + seg_written, nw);
+      seg_written += nw;
+      if (seg_written < len) {
+        if (!block) break;
+        mgos_uart_flush(uart_no);
+        if (us->tx_buf.avail == 0) break;
+      }
+    }
+    written += seg_written;
+    if (seg_written < len) break;
   }
   uart_unlock(us);
-  mgos_uart_schedule_dispatcher(uart_no, false /* from_isr */);
+  if (written > 0) {
+    mgos_uart_schedule_dispatcher(uart_no, false /* from_isr */);
+  }
   return written;
 }
 
+size_t mgos_uart_write(int uart_no, const void *buf, size_t len) {
+  struct mg_str s = mg_mk_str_n((const char *) buf, len);
+  return uart_writev(uart_no, &s, 1, true /* block */);
+}
+
+size_t mgos_uart_writev(int uart_no, const struct mg_str *iov, int cnt) {
+  return uart_writev(uart_no, iov, cnt, true /* block */);
+}
+
+size_t mgos_uart_writev_nb(int uart_no, const struct mg_str *iov, int cnt) {
+  return uart_writev(uart_no, iov, cnt, false /* block */);
+}
+
 int mgos_uart_printf(int uart_no, const char *fmt, ...) {
   int len;
-  va_list ap;
+  va_list ap, ap2;
   char buf[100], *data = buf;
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) return 0;
+  /*
+   * Try formatting directly into the free space at the tail of tx_buf.
+   * This works as long as the output fits in the contiguous part of it,
+   * including the terminating NUL (which is not committed).
+   */
+  uart_lock(us);
+  cs_rbuf_t *b = &us->tx_buf;
+  uint8_t *tail = NULL;
+  uint16_t space = MIN(cs_rbuf_contig_tail_space(b, &tail), b->avail);
   va_start(ap, fmt);
-  len = mg_avprintf(&data, sizeof(buf), fmt, ap);
+  va_copy(ap2, ap);
+  len = vsnprintf((char *) tail, space, fmt, ap);
   va_end(ap);
+  bool done = (len >= 0 && len < space);
+  if (!done && len >= 0 && len <= b->avail) {
+    /*
+     * Output wraps around the end of the ring. Format it again into the free
+     * space at the start of the ring, or on the stack if it's short, and move
+     * the part that goes before the end into place.
+     */
+    char *p = NULL;
+    if (len < b->avail - space) {
+      p = (char *) b->begin;
+    } else if (len < (int) sizeof(buf)) {
+      p = buf;
+    }
+    if (p != NULL) {
+      va_copy(ap, ap2);
+      vsnprintf(p, len + 1, fmt, ap);
+      va_end(ap);
+      memcpy(tail, p, space);
+      memmove(b->begin, p + space, len - space);
+      done = true;
+    }
+  }
+  if (done) {
+    cs_rbuf_advance_tail(b, len);
+    uart_unlock(us);
+    va_end(ap2);
+    mgos_uart_schedule_dispatcher(uart_no, false /* from_isr */);
+    return len;
+  }
+  uart_unlock(us);
+  /* Did not fit, format separately and write out (may block). */
+  len = mg_avprintf(&data, sizeof(buf), fmt, ap2);
+  va_end(ap2);
   if (len > 0) {
     len = mgos_uart_write(uart_no, data, len);
   }
@@ -118,28 +435,9 @@ size_t mgos_uart_read(int uart_no, void *buf, size_t len) {
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL || !us->rx_enabled) return 0;
   uart_lock(us);
-  mgos_uart_hal_dispatch_rx_top(us);
-  size_t tr = MIN(len, us->rx_buf.len);
-  if (us->cfg.tx_fc_type == MGOS_UART_FC_SW) {
-    size_t i, j;
-    for (i = 0, j = 0; i < tr; i++) {
-      uint8_t ch = (uint8_t) us->rx_buf.buf[i];
-      switch (ch) {
-        case MGOS_UART_XON_CHAR:
-          us->xoff_recd = false;
-          break;
-        case MGOS_UART_XOFF_CHAR:
-          us->xoff_recd = true;
-          break;
-        default:
-          ((uint8_t *) buf)[j++] = ch;
-          break;
-      }
-    }
-  } else {
-    memcpy(buf, us->rx_buf.buf, tr);
-  }
-  mbuf_remove(&us->rx_buf, tr);
+  uart_rx_top(us);
+  size_t tr = cs_rbuf_read(&us->rx_buf, buf, MIN(len, us->rx_buf.used));
+  us->rx_frame_scanned = 0;
   uart_unlock(us);
   return tr;
 }
@@ -161,27 +459,84 @@ size_t mgos_uart_read_mbuf(int uart_no, struct mbuf *mb, size_t len) {
   return nr;
 }
 
+size_t mgos_uart_rx_peek(int uart_no, struct mg_str spans[2]) {
+  struct mgos_uart_state *us = s_uart_state[uart_no];
+  if (us == NULL || !us->rx_enabled) {
+    uart_rxb_spans(NULL, 0, spans);
+    return 0;
+  }
+  uart_lock(us);
+  uart_rx_top(us);
+  uart_rxb_spans(&us->rx_buf, us->rx_buf.used, spans);
+  uart_unlock(us);
+  return spans[0].len + spans[1].len;
+}
+
+void mgos_uart_rx_consume(int uart_no, size_t len) {
+  struct mgos_uart_state *us = s_uart_state[uart_no];
+  if (us == NULL) return;
+  uart_lock(us);
+  uart_rxb_consume(us, len);
+  uart_unlock(us);
+}
+
 void mgos_uart_flush(int uart_no) {
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL || us->xoff_recd) return;
-  while (us->tx_buf.len > 0) {
+  while (us->tx_buf.used > 0) {
+    uint16_t used = us->tx_buf.used;
     uart_lock(us);
     mgos_uart_hal_dispatch_tx_top(us);
     uart_unlock(us);
+    if (us->tx_buf.used < used) continue;
+    /*
+     * Device does not take any more data, wait for it to drain. Give up if
+     * that does not help either (e.g. a pty that nobody reads).
+     */
+    mgos_uart_hal_flush_fifo(us);
+    uart_lock(us);
+    mgos_uart_hal_dispatch_tx_top(us);
+    uart_unlock(us);
+    if (us->tx_buf.used == used) return;
   }
   mgos_uart_hal_flush_fifo(us);
 }
 
+/*
+ * Allocate a ring buffer of the new size, to be swapped in with
+ * uart_rbuf_swap() once the HAL has accepted the config.
+ */
+static bool uart_rbuf_alloc(cs_rbuf_t *nb, int size) {
+  cs_rbuf_init(nb, size);
+  return (nb->begin != NULL || size == 0);
+}
+
+/* Replace b with nb, keeping as much of the existing data as fits. */
+static void uart_rbuf_swap(cs_rbuf_t *b, cs_rbuf_t *nb) {
+  while (b->used > 0 && nb->avail > 0) {
+    uint8_t *data = NULL;
+    uint16_t n = cs_rbuf_get(b, nb->avail, &data);
+    cs_rbuf_append(nb, data, n);
+    cs_rbuf_consume(b, n);
+  }
+  cs_rbuf_deinit(b);
+  *b = *nb;
+}
+
 bool mgos_uart_configure(int uart_no, const struct mgos_uart_config *cfg) {
   if (uart_no < 0 || uart_no >= MGOS_MAX_NUM_UARTS) return false;
+  if (cfg->rx_buf_size < 0 || cfg->rx_buf_size > UINT16_MAX ||
+      cfg->tx_buf_size < 0 || cfg->tx_buf_size > UINT16_MAX) {
+    return false;
+  }
   bool res = false;
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) {
     us = (struct mgos_uart_state *) calloc(1, sizeof(*us));
     if (us == NULL) return false;
     us->uart_no = uart_no;
-    mbuf_init(&us->rx_buf, 0);
-    mbuf_init(&us->tx_buf, 0);
+    cs_rbuf_init(&us->rx_buf, 0);
+    cs_rbuf_init(&us->tx_buf, 0);
     if (mgos_uart_hal_init(us)) {
       us->lock = mgos_rlock_create();
 #ifndef MGOS_BOOT_BUILD
@@ -190,19 +545,39 @@ bool mgos_uart_configure(int uart_no, const struct mgos_uart_config *cfg) {
       s_uart_state[uart_no] = us;
       res = true;
     } else {
-      mbuf_free(&us->rx_buf);
-      mbuf_free(&us->tx_buf);
+      cs_rbuf_deinit(&us->rx_buf);
+      cs_rbuf_deinit(&us->tx_buf);
       free(us);
       us = NULL;
     }
   }
   if (us != NULL) {
-    res = mgos_uart_hal_configure(us, cfg);
+    /*
+     * Buffers are allocated up front but only swapped in after the HAL has
+     * accepted the config, a rejected config leaves the UART as it was.
+     */
+    bool new_rxb = (us->rx_buf.size != (cs_rbuf_size_t) cfg->rx_buf_size);
+    bool new_txb = (us->tx_buf.size != (cs_rbuf_size_t) cfg->tx_buf_size);
+    cs_rbuf_t rxb, txb;
+    memset(&rxb, 0, sizeof(rxb));
+    memset(&txb, 0, sizeof(txb));
+    res = ((!new_rxb || uart_rbuf_alloc(&rxb, cfg->rx_buf_size)) &&
+           (!new_txb || uart_rbuf_alloc(&txb, cfg->tx_buf_size)));
+    if (res) res = mgos_uart_hal_configure(us, cfg);
     if (res) {
+      uart_lock(us);
+      if (new_rxb) uart_rbuf_swap(&us->rx_buf, &rxb);
+      if (new_txb) uart_rbuf_swap(&us->tx_buf, &txb);
+      uart_unlock(us);
       memcpy(&us->cfg, cfg, sizeof(us->cfg));
       if (us->cfg.tx_fc_type != MGOS_UART_FC_SW) {
         us->xoff_sent = us->xoff_recd = false;
       }
+      us->rx_frame_scanned = 0;
+      us->rx_frame_discard = false;
+    } else {
+      cs_rbuf_deinit(&rxb);
+      cs_rbuf_deinit(&txb);
     }
   }
   if (res) {
@@ -270,6 +645,15 @@ void mgos_uart_set_dispatcher(int uart_no, mgos_uart_dispatcher_t cb,
   us->dispatcher_data = arg;
 }
 
+void mgos_uart_set_frame_handler(int uart_no, mgos_uart_frame_handler_t cb,
+                                 void *arg) {
+  struct mgos_uart_state *us = s_uart_state[uart_no];
+  if (us == NULL) return;
+  us->frame_cb = cb;
+  us->frame_cb_arg = arg;
+  mgos_uart_schedule_dispatcher(uart_no, false /* from_isr */);
+}
+
 bool mgos_uart_is_rx_enabled(int uart_no) {
   struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) return false;
@@ -284,20 +668,20 @@ void mgos_uart_set_rx_enabled(int uart_no, bool enabled) {
 }
 
 size_t mgos_uart_rxb_free(const struct mgos_uart_state *us) {
-  if (us == NULL || ((int) us->rx_buf.len) > us->cfg.rx_buf_size) return 0;
-  return us->cfg.rx_buf_size - us->rx_buf.len;
+  if (us == NULL) return 0;
+  return us->rx_buf.avail;
 }
 
 size_t mgos_uart_read_avail(int uart_no) {
   const struct mgos_uart_state *us = s_uart_state[uart_no];
   if (us == NULL) return 0;
-  return us->rx_buf.len;
+  return us->rx_buf.used;
 }
 
 size_t mgos_uart_write_avail(int uart_no) {
   const struct mgos_uart_state *us = s_uart_state[uart_no];
-  if (us == NULL || ((int) us->tx_buf.len) > us->cfg.tx_buf_size) return 0;
-  return us->cfg.tx_buf_size - us->tx_buf.len;
+  if (us == NULL) return 0;
+  return us->tx_buf.avail;
 }
 
 const struct mgos_uart_stats *mgos_uart_get_stats(int uart_no) {
@@ -6,6 +6,8 @@
 #ifndef CS_FW_SRC_MGOS_UART_HAL_H_
 #define CS_FW_SRC_MGOS_UART_HAL_H_
 
+#include "common/cs_rbuf.h"
+
 #include "mgos_system.h"
 #include "mgos_uart.h"
 
@@ -16,14 +18,21 @@ extern "C" {
 struct mgos_uart_state {
   int uart_no;
   struct mgos_uart_config cfg;
-  struct mbuf rx_buf;
-  struct mbuf tx_buf;
+  /* Fixed-size rings, cfg.rx_buf_size and cfg.tx_buf_size bytes. */
+  cs_rbuf_t rx_buf;
+  cs_rbuf_t tx_buf;
   bool rx_enabled;
   bool xoff_recd;
   bool xoff_sent;
   struct mgos_uart_stats stats;
   mgos_uart_dispatcher_t dispatcher_cb;
   void *dispatcher_data;
+  mgos_uart_frame_handler_t frame_cb;
+  void *frame_cb_arg;
+  /* Bytes at the start of rx_buf known not to contain a frame delimiter. */
+  uint16_t rx_frame_scanned;
+  /* Dropping the rest of an oversized frame. */
+  bool rx_frame_discard;
   void *dev_data;
   struct mgos_rlock_type *lock;
   int locked;
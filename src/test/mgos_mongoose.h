@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2014-2018 Cesanta Software Limited
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the ""License"");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an ""AS IS"" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stand-in for the Mongoose OS glue header, enough for the core modules that
+ * the unit test links. The functions are implemented in unit_test.c.
+ */
+
+#ifndef CS_FW_SRC_TEST_MGOS_MONGOOSE_H_
+#define CS_FW_SRC_TEST_MGOS_MONGOOSE_H_
+
+#include <stdbool.h>
+
+#include "mongoose.h"
+
+typedef void (*mgos_poll_cb_t)(void *cb_arg);
+
+struct mg_mgr *mgos_get_mgr(void);
+
+void mgos_add_poll_cb(mgos_poll_cb_t cb, void *cb_arg);
+
+void mongoose_schedule_poll(bool from_isr);
+
+#endif /* CS_FW_SRC_TEST_MGOS_MONGOOSE_H_ */
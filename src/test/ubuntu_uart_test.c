@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2014-2016 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * The ubuntu UART HAL on a pty (ubuntu.uart0.dev = "pty"), driven by the
+ * Mongoose manager the way the ubuntu main loop does it. The test plays the
+ * other end of the serial line through the slave side of the pty.
+ */
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/cs_dbg.h"
+
+#include "mgos_mongoose.h"
+#include "mgos_sys_config.h"
+#include "mgos_system.h"
+#include "mgos_time.h"
+#include "mgos_uart.h"
+#include "mgos_uart_hal.h"
+#include "ubuntu.h"
+#include "ubuntu_ipc.h"
+
+#include "test_main.h"
+#include "test_util.h"
+
+/* Environment of mgos_uart.c and the HAL: real clock, no locking. */
+static struct mg_mgr s_mgr;
+static mgos_poll_cb_t s_poll_cb;
+static void *s_poll_cb_arg;
+static bool s_poll_scheduled;
+
+struct mg_mgr *mgos_get_mgr(void) {
+  return &s_mgr;
+}
+
+void mgos_add_poll_cb(mgos_poll_cb_t cb, void *cb_arg) {
+  s_poll_cb = cb;
+  s_poll_cb_arg = cb_arg;
+}
+
+void mongoose_schedule_poll(bool from_isr) {
+  s_poll_scheduled = true;
+  (void) from_isr;
+}
+
+int64_t mgos_uptime_micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct mgos_rlock_type *mgos_rlock_create(void) {
+  return NULL;
+}
+
+void mgos_rlock(struct mgos_rlock_type *l) {
+  (void) l;
+}
+
+void mgos_runlock(struct mgos_rlock_type *l) {
+  (void) l;
+}
+
+/* No privilege separation in the test. */
+int ubuntu_ipc_open(const char *pathname, int flags) {
+  return open(pathname, flags);
+}
+
+/* One iteration of the main loop: Mongoose I/O, then the UART dispatcher. */
+static void loop_once(int timeout_ms) {
+  mg_mgr_poll(&s_mgr, timeout_ms);
+  if (s_poll_scheduled && s_poll_cb != NULL) {
+    s_poll_scheduled = false;
+    s_poll_cb(s_poll_cb_arg);
+  }
+}
+
+/* Runs the loop while reading from the slave, until len bytes are read. */
+static size_t peer_read(int fd, uint8_t *buf, size_t len) {
+  size_t n = 0;
+  int64_t deadline = mgos_uptime_micros() + 2000000;
+  while (n < len && mgos_uptime_micros() < deadline) {
+    loop_once(1);
+    ssize_t r = read(fd, buf + n, len - n);
+    if (r > 0) n += r;
+  }
+  return n;
+}
+
+/*
+ * (Re)configures UART0 and clears its stats. Returns a new fd of the slave
+ * end of its pty or -1.
+ */
+static int uart_pty_setup(int rx_buf_size, int tx_buf_size) {
+  struct mgos_uart_config cfg;
+  mgos_uart_config_set_defaults(0, &cfg);
+  cfg.rx_buf_size = rx_buf_size;
+  cfg.tx_buf_size = tx_buf_size;
+  if (!mgos_uart_configure(0, &cfg)) return -1;
+  mgos_uart_set_rx_enabled(0, true);
+  const char *name = ubuntu_uart_get_pty_name(0);
+  if (name == NULL) return -1;
+  memset(&mgos_uart_hal_get_state(0)->stats, 0,
+         sizeof(struct mgos_uart_stats));
+  return open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+}
+
+static const char *test_uart_pty_rw(void) {
+  const struct mgos_uart_stats *st;
+  uint8_t buf[64];
+  int i, fd = uart_pty_setup(64, 64);
+  ASSERT(fd >= 0);
+  st = mgos_uart_get_stats(0);
+
+  /* UART to the slave. The line is raw: no echo, no CR/LF translation. */
+  ASSERT_EQ(mgos_uart_write(0, "hello\n", 6), 6);
+  ASSERT_EQ(peer_read(fd, buf, 6), 6);
+  ASSERT_EQ(memcmp(buf, "hello\n", 6), 0);
+  ASSERT_EQ(st->tx_bytes, 6);
+  ASSERT_EQ(st->tx_throttles, 0);
+
+  /* Slave to the UART. */
+  ASSERT_EQ(write(fd, "world\r\n", 7), 7);
+  for (i = 0; i < 1000 && mgos_uart_read_avail(0) < 7; i++) loop_once(1);
+  ASSERT_EQ(mgos_uart_read(0, buf, sizeof(buf)), 7);
+  ASSERT_EQ(memcmp(buf, "world\r\n", 7), 0);
+  ASSERT_EQ(st->rx_bytes, 7);
+  ASSERT(st->rx_ints > 0);
+  ASSERT(st->ints >= st->rx_ints);
+  /* Nothing else was sent, in particular no echo. */
+  ASSERT_EQ(read(fd, buf, 1), -1);
+
+  close(fd);
+  return NULL;
+}
+
+static const char *test_uart_pty_short_write(void) {
+  static uint8_t data[64 * 1024], recd[sizeof(data)];
+  const struct mgos_uart_stats *st;
+  size_t i, n = 0;
+  int fd = uart_pty_setup(64, 256);
+  ASSERT(fd >= 0);
+  st = mgos_uart_get_stats(0);
+  for (i = 0; i < sizeof(data); i++) data[i] = rand();
+
+  /*
+   * Nobody reads the slave: the pty fills up, a write to it comes up short
+   * and the rest is left to Mongoose. tx_buf does not drain until that has
+   * gone out, so the writer is held back.
+   */
+  for (i = 0; i < 100; i++) {
+    struct mg_str s = mg_mk_str_n((const char *) data + n, sizeof(data) - n);
+    n += mgos_uart_writev_nb(0, &s, 1);
+    loop_once(1);
+  }
+  ASSERT(st->tx_throttles > 0);
+  ASSERT_LT(n, sizeof(data));
+  ASSERT_LT(st->tx_bytes, n);
+  ASSERT_EQ(mgos_uart_write_avail(0), 0);
+
+  /* Flushing and blocking writes give up instead of hanging. */
+  mgos_uart_flush(0);
+  ASSERT_EQ(mgos_uart_write(0, data + n, sizeof(data) - n), 0);
+  ASSERT_LT(st->tx_bytes, n);
+
+  /* Once the slave is read, the rest goes out too, in order. */
+  int64_t deadline = mgos_uptime_micros() + 5000000;
+  for (i = 0; i < sizeof(recd) && mgos_uptime_micros() < deadline;) {
+    struct mg_str s = mg_mk_str_n((const char *) data + n, sizeof(data) - n);
+    n += mgos_uart_writev_nb(0, &s, 1);
+    loop_once(1);
+    ssize_t r = read(fd, recd + i, sizeof(recd) - i);
+    if (r > 0) i += r;
+  }
+  ASSERT_EQ(i, sizeof(recd));
+  ASSERT_EQ(memcmp(recd, data, sizeof(data)), 0);
+  ASSERT_EQ(st->tx_bytes, sizeof(data));
+
+  close(fd);
+  return NULL;
+}
+
+void tests_setup(void) {
+  cs_log_set_level(LL_ERROR);
+  mg_mgr_init(&s_mgr, NULL);
+  mgos_sys_config_set_ubuntu_uart0_dev("pty");
+}
+
+const char *tests_run(const char *filter) {
+  RUN_TEST(test_uart_pty_rw);
+  RUN_TEST(test_uart_pty_short_write);
+  return NULL;
+}
+
+void tests_teardown(void) {
+  mg_mgr_free(&s_mgr);
+}
@@ -11,6 +11,13 @@
 
 #include "mgos_config_util.h"
 #include "mgos_event.h"
+#include "mgos_mongoose.h"
+#include "mgos_system.h"
+#include "mgos_time.h"
+#include "mgos_timers_internal.h"
+#include "mgos_uart.h"
+#include "mgos_uart_hal.h"
+#include "mgos_utils.h"
 
 #include "mgos_config.h"
 #include "test_main.h"
@@ -226,6 +233,1063 @@ static const char *test_events(void) {
   return NULL;
 }
 
+#define GRP4 MGOS_EVENT_BASE('G', '0', '4')
+
+struct ev_order {
+  int calls[8];
+  int num_calls;
+};
+
+static struct ev_order s_ev_order;
+
+static void ev_order_cb(int ev, void *ev_data, void *userdata) {
+  s_ev_order.calls[s_ev_order.num_calls++] = (int) (intptr_t) userdata;
+  (void) ev;
+  (void) ev_data;
+}
+
+static void ev_order_remove_self_cb(int ev, void *ev_data, void *userdata) {
+  ev_order_cb(ev, ev_data, userdata);
+  mgos_event_remove_group_handler(GRP4, ev_order_remove_self_cb, userdata);
+}
+
+static const char *test_events_order(void) {
+  ASSERT(mgos_event_register_base(GRP4, "grp4") == true);
+
+  /* Exact and group handlers interleaved, plus unrelated ones. */
+  ASSERT(mgos_event_add_handler(GRP4 + 1, ev_order_cb, (void *) 1));
+  ASSERT(mgos_event_add_group_handler(GRP4, ev_order_cb, (void *) 2));
+  ASSERT(mgos_event_add_handler(GRP4 + 2, ev_order_cb, (void *) 3));
+  ASSERT(mgos_event_add_handler(GRP4 + 1, ev_order_cb, (void *) 4));
+  ASSERT(mgos_event_add_group_handler(GRP4 + 5, ev_order_cb, (void *) 5));
+  ASSERT(mgos_event_add_group_handler(GRP1, ev_order_cb, (void *) 6));
+
+  /* Most recently added handler is invoked first. */
+  memset(&s_ev_order, 0, sizeof(s_ev_order));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 1, NULL), 4);
+  ASSERT_EQ(s_ev_order.num_calls, 4);
+  ASSERT_EQ(s_ev_order.calls[0], 5);
+  ASSERT_EQ(s_ev_order.calls[1], 4);
+  ASSERT_EQ(s_ev_order.calls[2], 2);
+  ASSERT_EQ(s_ev_order.calls[3], 1);
+
+  memset(&s_ev_order, 0, sizeof(s_ev_order));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 0xff, NULL), 2);
+  ASSERT_EQ(s_ev_order.calls[0], 5);
+  ASSERT_EQ(s_ev_order.calls[1], 2);
+
+  /* Removal keeps the order of the remaining handlers. */
+  ASSERT(mgos_event_remove_group_handler(GRP4, ev_order_cb, (void *) 5));
+  ASSERT(!mgos_event_remove_group_handler(GRP4, ev_order_cb, (void *) 5));
+  ASSERT(!mgos_event_remove_handler(GRP4, ev_order_cb, (void *) 2));
+  ASSERT(mgos_event_remove_handler(GRP4 + 1, ev_order_cb, (void *) 1));
+  memset(&s_ev_order, 0, sizeof(s_ev_order));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 1, NULL), 2);
+  ASSERT_EQ(s_ev_order.calls[0], 4);
+  ASSERT_EQ(s_ev_order.calls[1], 2);
+
+  /* A handler may remove itself while being dispatched. */
+  ASSERT(mgos_event_add_group_handler(GRP4, ev_order_remove_self_cb,
+                                      (void *) 7));
+  memset(&s_ev_order, 0, sizeof(s_ev_order));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 2, NULL), 3);
+  ASSERT_EQ(s_ev_order.calls[0], 7);
+  ASSERT_EQ(s_ev_order.calls[1], 3);
+  ASSERT_EQ(s_ev_order.calls[2], 2);
+  memset(&s_ev_order, 0, sizeof(s_ev_order));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 2, NULL), 2);
+
+  ASSERT(mgos_event_remove_group_handler(GRP4, ev_order_cb, (void *) 2));
+  ASSERT(mgos_event_remove_handler(GRP4 + 2, ev_order_cb, (void *) 3));
+  ASSERT(mgos_event_remove_handler(GRP4 + 1, ev_order_cb, (void *) 4));
+  ASSERT(mgos_event_remove_group_handler(GRP1, ev_order_cb, (void *) 6));
+  ASSERT_EQ(mgos_event_trigger(GRP4 + 1, NULL), 0);
+
+  return NULL;
+}
+
+/*
+ * mgos_event_post() hooks: callbacks are queued and run by
+ * run_invoked_cbs(), ints are not a concern for a single-threaded test.
+ */
+static struct {
+  mgos_cb_t cb;
+  void *arg;
+} s_invoked_cbs[4];
+static int s_num_invoked_cbs = 0;
+
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr) {
+  if (s_num_invoked_cbs == (int) ARRAY_SIZE(s_invoked_cbs)) return false;
+  s_invoked_cbs[s_num_invoked_cbs].cb = cb;
+  s_invoked_cbs[s_num_invoked_cbs].arg = arg;
+  s_num_invoked_cbs++;
+  (void) from_isr;
+  return true;
+}
+
+void mgos_ints_disable(void) {
+}
+
+void mgos_ints_enable(void) {
+}
+
+static int run_invoked_cbs(void) {
+  int n = s_num_invoked_cbs;
+  for (int i = 0; i < n; i++) {
+    s_invoked_cbs[i].cb(s_invoked_cbs[i].arg);
+  }
+  memmove(s_invoked_cbs, s_invoked_cbs + n,
+          (s_num_invoked_cbs - n) * sizeof(s_invoked_cbs[0]));
+  s_num_invoked_cbs -= n;
+  return n;
+}
+
+#define GRP5 MGOS_EVENT_BASE('G', '0', '5')
+
+static struct {
+  int num_events;
+  int last_ev;
+  int last_seq;
+  bool out_of_order;
+  bool null_data;
+} s_posted;
+
+static void ev_post_cb(int ev, void *ev_data, void *userdata) {
+  if (ev_data == NULL) {
+    s_posted.null_data = true;
+  } else {
+    int seq;
+    memcpy(&seq, ev_data, sizeof(seq));
+    if (s_posted.num_events > 0 && seq != s_posted.last_seq + 1) {
+      s_posted.out_of_order = true;
+    }
+    s_posted.last_seq = seq;
+  }
+  s_posted.last_ev = ev;
+  s_posted.num_events++;
+  (void) userdata;
+}
+
+static const char *test_event_post(void) {
+  char big[MGOS_EVENT_POST_MAX_DATA_LEN + 1];
+  int seq = 0;
+  memset(big, 0, sizeof(big));
+  memset(&s_posted, 0, sizeof(s_posted));
+  ASSERT(mgos_event_register_base(GRP5, "grp5") == true);
+  ASSERT(mgos_event_add_group_handler(GRP5, ev_post_cb, NULL));
+
+  /* Delivery is deferred until the main loop runs the callback. */
+  ASSERT(mgos_event_post(GRP5 + 1, &seq, sizeof(seq), false));
+  seq++;
+  ASSERT(mgos_event_post(GRP5 + 2, NULL, 0, true));
+  ASSERT_EQ(s_posted.num_events, 0);
+  ASSERT_EQ(s_num_invoked_cbs, 1);
+  ASSERT_EQ(run_invoked_cbs(), 1);
+  ASSERT_EQ(s_posted.num_events, 2);
+  ASSERT_EQ(s_posted.last_ev, GRP5 + 2);
+  ASSERT(s_posted.null_data);
+  ASSERT_EQ(s_num_invoked_cbs, 0);
+
+  ASSERT(!mgos_event_post(GRP5, big, sizeof(big), false));
+  ASSERT(mgos_event_post(GRP5, big, sizeof(big) - 1, false));
+  ASSERT_EQ(run_invoked_cbs(), 1);
+  ASSERT_EQ(s_posted.num_events, 3);
+
+  /* Fill up the queue, records of different sizes wrap around. */
+  memset(&s_posted, 0, sizeof(s_posted));
+  int num_posted = 0;
+  for (seq = 0; seq < 10000; seq++) {
+    memcpy(big, &seq, sizeof(seq));
+    if (!mgos_event_post(GRP5 + 3, big, sizeof(seq) + (seq % 5) * 7, false)) {
+      break;
+    }
+    num_posted++;
+  }
+  ASSERT(num_posted > 1 && num_posted < 10000);
+  /* Only one drain callback is scheduled for the lot. */
+  ASSERT_EQ(s_num_invoked_cbs, 1);
+
+  /* Delivered in batches, each batch reschedules the drain. */
+  int num_runs = 0;
+  while (run_invoked_cbs() > 0) num_runs++;
+  ASSERT_EQ(s_posted.num_events, num_posted);
+  ASSERT(num_runs > 1);
+  ASSERT(!s_posted.out_of_order);
+
+  /* Space has been released. */
+  for (int i = 0; i < 100; i++) {
+    seq = i;
+    ASSERT(mgos_event_post(GRP5 + 4, &seq, sizeof(seq), false));
+    if (i % 7 == 0) run_invoked_cbs();
+  }
+  while (run_invoked_cbs() > 0) {
+  }
+  ASSERT_EQ(s_posted.num_events, num_posted + 100);
+  ASSERT_EQ(s_posted.last_seq, 99);
+
+  ASSERT(mgos_event_remove_group_handler(GRP5, ev_post_cb, NULL));
+  return NULL;
+}
+
+/* Environment of mgos_timers.c: manual monotonic clock, no locking. */
+static struct mg_mgr s_mgr;
+static int64_t s_uptime_us = 0;
+
+struct mg_mgr *mgos_get_mgr(void) {
+  return &s_mgr;
+}
+
+int64_t mgos_uptime_micros(void) {
+  return s_uptime_us;
+}
+
+struct mgos_rlock_type *mgos_rlock_create(void) {
+  return NULL;
+}
+
+void mgos_rlock(struct mgos_rlock_type *l) {
+  (void) l;
+}
+
+void mgos_runlock(struct mgos_rlock_type *l) {
+  (void) l;
+}
+
+void mongoose_schedule_poll(bool from_isr) {
+  (void) from_isr;
+}
+
+enum mgos_init_result mgos_hw_timers_init(void) {
+  return MGOS_INIT_OK;
+}
+
+void mgos_clear_hw_timer(mgos_timer_id id) {
+  (void) id;
+}
+
+/* Timers connection is the only one in the manager. */
+static struct mg_connection *timers_conn(void) {
+  return mg_next(&s_mgr, NULL);
+}
+
+/* Milliseconds until the next wakeup, -1 if no timers are armed. */
+static int timers_next_ms(void) {
+  struct mg_connection *nc = timers_conn();
+  if (nc->ev_timer_time == 0) return -1;
+  return (int) ((nc->ev_timer_time - mg_time()) * 1000 + 0.5);
+}
+
+/* Advances the clock by `ms` and delivers the timer event, like mongoose. */
+static void timers_run(int ms) {
+  struct mg_connection *nc = timers_conn();
+  s_uptime_us += ms * 1000LL;
+  nc->ev_timer_time = 0;
+  nc->handler(nc, MG_EV_TIMER, NULL, nc->user_data);
+}
+
+#define NUM_TEST_TIMERS 200
+
+static struct {
+  int64_t deadline[NUM_TEST_TIMERS];
+  int num_fired[NUM_TEST_TIMERS];
+  int total_fired;
+  bool bad_order;
+  int64_t last_fired;
+  /* Callback advances the clock by this much. */
+  int cb_duration_us;
+} s_tt;
+
+static void timer_cb(void *arg) {
+  intptr_t i = (intptr_t) arg;
+  if (s_tt.deadline[i] < s_tt.last_fired) s_tt.bad_order = true;
+  s_tt.last_fired = s_tt.deadline[i];
+  s_tt.num_fired[i]++;
+  s_tt.total_fired++;
+  s_uptime_us += s_tt.cb_duration_us;
+}
+
+static mgos_timer_id set_test_timer(intptr_t i, int msecs, int slack_ms) {
+  s_tt.deadline[i] = s_uptime_us + msecs * 1000LL;
+  return mgos_set_timer_ex(msecs, slack_ms, 0, timer_cb, (void *) i);
+}
+
+static const char *test_timers_order(void) {
+  mgos_timer_id ids[NUM_TEST_TIMERS];
+  bool cleared[NUM_TEST_TIMERS];
+  int i, num_cleared = 0;
+
+  memset(&s_tt, 0, sizeof(s_tt));
+  ASSERT_EQ(timers_next_ms(), -1);
+
+  /* Clear timers at random positions in the heap while it is being built. */
+  for (i = 0; i < NUM_TEST_TIMERS; i++) {
+    ids[i] = set_test_timer(i, 1 + rand() % 1000, 0);
+    ASSERT(ids[i] != MGOS_INVALID_TIMER_ID);
+    cleared[i] = false;
+    if (rand() % 3 == 0) {
+      int j = rand() % (i + 1);
+      if (!cleared[j]) num_cleared++;
+      cleared[j] = true;
+      mgos_clear_timer(ids[j]);
+    }
+  }
+
+  /* Timers fire in the order of deadlines, each exactly at its deadline. */
+  while ((i = timers_next_ms()) >= 0) {
+    int num_before = s_tt.total_fired;
+    timers_run(i);
+    ASSERT_GT(s_tt.total_fired, num_before);
+    ASSERT_EQ64(s_tt.last_fired, s_uptime_us);
+  }
+  ASSERT(!s_tt.bad_order);
+  ASSERT_EQ(s_tt.total_fired, NUM_TEST_TIMERS - num_cleared);
+  for (i = 0; i < NUM_TEST_TIMERS; i++) {
+    ASSERT_EQ(s_tt.num_fired[i], (cleared[i] ? 0 : 1));
+  }
+
+  /* Repeating timer stays in the heap and keeps its interval. */
+  memset(&s_tt, 0, sizeof(s_tt));
+  mgos_timer_id id = mgos_set_timer(100, MGOS_TIMER_REPEAT, timer_cb, 0);
+  s_tt.deadline[0] = s_uptime_us + 100000;
+  set_test_timer(1, 250, 0);
+  ASSERT_EQ(timers_next_ms(), 100);
+  timers_run(100);
+  ASSERT_EQ(timers_next_ms(), 100);
+  timers_run(100);
+  ASSERT_EQ(timers_next_ms(), 50);
+  timers_run(50);
+  ASSERT_EQ(s_tt.num_fired[0], 2);
+  ASSERT_EQ(s_tt.num_fired[1], 1);
+  ASSERT_EQ(timers_next_ms(), 50);
+  mgos_clear_timer(id);
+  ASSERT_EQ(timers_next_ms(), -1);
+
+  return NULL;
+}
+
+static const char *test_timers_ids(void) {
+  mgos_timer_id ids[NUM_TEST_TIMERS];
+  struct cs_pool_stats ps;
+  int i, j;
+
+  memset(&s_tt, 0, sizeof(s_tt));
+  mgos_timers_get_pool_stats(&ps);
+  const uint32_t num_used = ps.num_used;
+
+  /* SW timer IDs have the generation bits set and are all different. */
+  for (i = 0; i < NUM_TEST_TIMERS; i++) {
+    ids[i] = set_test_timer(i, 100, 0);
+    ASSERT((ids[i] & MGOS_SW_TIMER_MASK) != 0);
+    ASSERT_LT(ids[i] & ~MGOS_SW_TIMER_MASK, 0xffff);
+    for (j = 0; j < i; j++) ASSERT(ids[j] != ids[i]);
+  }
+  mgos_timers_get_pool_stats(&ps);
+  ASSERT_EQ(ps.num_used, num_used + NUM_TEST_TIMERS);
+
+  /* Clearing releases the timer right away, clearing it again is a no-op. */
+  for (i = 0; i < NUM_TEST_TIMERS; i++) {
+    mgos_clear_timer(ids[i]);
+    mgos_clear_timer(ids[i]);
+    mgos_timers_get_pool_stats(&ps);
+    ASSERT_EQ(ps.num_used, num_used + NUM_TEST_TIMERS - i - 1);
+  }
+  ASSERT_EQ(timers_next_ms(), -1);
+
+  /* ID of a cleared timer does not match the timer that reuses its slot. */
+  mgos_timer_id id1 = set_test_timer(1, 100, 0);
+  mgos_clear_timer(id1);
+  mgos_timer_id id2 = set_test_timer(2, 100, 0);
+  ASSERT_EQ(id2 & ~MGOS_SW_TIMER_MASK, id1 & ~MGOS_SW_TIMER_MASK);
+  ASSERT(id2 != id1);
+  mgos_clear_timer(id1);
+  timers_run(timers_next_ms());
+  ASSERT_EQ(s_tt.num_fired[1], 0);
+  ASSERT_EQ(s_tt.num_fired[2], 1);
+
+  /* Same for a timer that has fired. */
+  mgos_timer_id id3 = set_test_timer(3, 100, 0);
+  ASSERT_EQ(id3 & ~MGOS_SW_TIMER_MASK, id2 & ~MGOS_SW_TIMER_MASK);
+  ASSERT(id3 != id2 && id3 != id1);
+  mgos_clear_timer(id2);
+  timers_run(timers_next_ms());
+  ASSERT_EQ(s_tt.num_fired[3], 1);
+
+  /* Made-up IDs are ignored. */
+  id1 = set_test_timer(4, 100, 0);
+  mgos_clear_timer(id1 + 1);
+  mgos_clear_timer(id1 ^ (1ULL << MGOS_SW_TIMER_GEN_SHIFT));
+  mgos_clear_timer(MGOS_SW_TIMER_MASK | 0xfffe);
+  timers_run(timers_next_ms());
+  ASSERT_EQ(s_tt.num_fired[4], 1);
+  ASSERT_EQ(timers_next_ms(), -1);
+  mgos_timers_get_pool_stats(&ps);
+  ASSERT_EQ(ps.num_used, num_used);
+
+  return NULL;
+}
+
+static const char *test_timers_slack(void) {
+  struct mgos_timers_stats st;
+
+  memset(&s_tt, 0, sizeof(s_tt));
+  mgos_timers_reset_stats();
+
+  /* Single timer is fired at the end of its window. */
+  set_test_timer(0, 100, 30);
+  ASSERT_EQ(timers_next_ms(), 130);
+  timers_run(130);
+  ASSERT_EQ(s_tt.num_fired[0], 1);
+
+  /* Overlapping windows: fired together as late as both allow. */
+  set_test_timer(1, 100, 50);
+  set_test_timer(2, 120, 0);
+  set_test_timer(3, 110, 100);
+  ASSERT_EQ(timers_next_ms(), 120);
+  timers_run(120);
+  ASSERT_EQ(s_tt.num_fired[1], 1);
+  ASSERT_EQ(s_tt.num_fired[2], 1);
+  ASSERT_EQ(s_tt.num_fired[3], 1);
+
+  /* Disjoint windows: separate wakeups, the later window is not shortened. */
+  set_test_timer(4, 100, 10);
+  set_test_timer(5, 200, 20);
+  ASSERT_EQ(timers_next_ms(), 110);
+  timers_run(110);
+  ASSERT_EQ(s_tt.num_fired[4], 1);
+  ASSERT_EQ(s_tt.num_fired[5], 0);
+  ASSERT_EQ(timers_next_ms(), 110);
+  timers_run(110);
+  ASSERT_EQ(s_tt.num_fired[5], 1);
+
+  /* Timer due within the window of another one cuts it short. */
+  set_test_timer(6, 100, 1000);
+  set_test_timer(7, 500, 0);
+  ASSERT_EQ(timers_next_ms(), 500);
+  /* Clearing it restores the full window. */
+  mgos_clear_timer(set_test_timer(8, 200, 0));
+  ASSERT_EQ(timers_next_ms(), 500);
+  timers_run(500);
+  ASSERT_EQ(s_tt.num_fired[6], 1);
+  ASSERT_EQ(s_tt.num_fired[7], 1);
+  ASSERT_EQ(s_tt.num_fired[8], 0);
+  ASSERT_EQ(timers_next_ms(), -1);
+
+  mgos_timers_get_stats(&st);
+  ASSERT_EQ(st.num_wakeups, 5);
+  ASSERT_EQ(st.num_fired, 8);
+  ASSERT_EQ(st.num_merged, 3);
+
+  return NULL;
+}
+
+static const char *test_timers_monotonic(void) {
+  struct mgos_time_changed_arg tca = {.delta = -3600};
+  mgos_timer_id id;
+
+  memset(&s_tt, 0, sizeof(s_tt));
+
+  /* Uptime past 32 bits of microseconds, interval past 32 bits too. */
+  s_uptime_us += (1LL << 40);
+  set_test_timer(0, 3000000, 0);
+  set_test_timer(1, 100, 0);
+  ASSERT_EQ(timers_next_ms(), 100);
+  timers_run(100);
+  ASSERT_EQ(s_tt.num_fired[1], 1);
+  ASSERT_EQ(timers_next_ms(), 3000000 - 100);
+
+  /* Wall time change only moves the mongoose deadline. */
+  timers_conn()->ev_timer_time -= 3600;
+  mgos_event_trigger(MGOS_EVENT_TIME_CHANGED, &tca);
+  ASSERT_EQ(timers_next_ms(), 3000000 - 100);
+  timers_run(3000000 - 100);
+  ASSERT_EQ(s_tt.num_fired[0], 1);
+  ASSERT_EQ64(s_tt.last_fired, s_uptime_us);
+
+  /* Repeating timer does not try to catch up after a delayed poll. */
+  id = mgos_set_timer(100, MGOS_TIMER_REPEAT, timer_cb, (void *) 2);
+  s_tt.deadline[2] = s_uptime_us + 100000;
+  timers_run(350);
+  ASSERT_EQ(s_tt.num_fired[2], 1);
+  ASSERT_EQ(timers_next_ms(), 100);
+  timers_run(100);
+  ASSERT_EQ(s_tt.num_fired[2], 2);
+  mgos_clear_timer(id);
+  ASSERT_EQ(timers_next_ms(), -1);
+
+  return NULL;
+}
+
+static int hist_bucket(const uint32_t *hist) {
+  int i, bucket = -1;
+  for (i = 0; i < MGOS_TIMERS_STATS_HIST_SIZE; i++) {
+    if (hist[i] == 0) continue;
+    if (bucket >= 0 || hist[i] != 1) return -1;
+    bucket = i;
+  }
+  return bucket;
+}
+
+static const char *test_timers_stats(void) {
+  static const struct {
+    int64_t lateness_us;
+    int duration_us;
+    int lateness_bucket;
+    int duration_bucket;
+  } cases[] = {
+      {0, 0, 0, 0},
+      {1, 1, 1, 1},
+      {2, 3, 2, 2},
+      {1000, 999, 10, 10},
+      {1024, 1023, 11, 10},
+      {(1LL << 22) - 1, 1 << 22, 22, 23},
+      {1LL << 40, 1 << 30, 23, 23},
+  };
+  struct mgos_timers_stats st;
+  size_t i;
+
+  /* Each value goes to the [2^(i-1), 2^i) bucket, the last one takes all. */
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    memset(&s_tt, 0, sizeof(s_tt));
+    mgos_timers_reset_stats();
+    set_test_timer(0, 10, 0);
+    s_tt.cb_duration_us = cases[i].duration_us;
+    s_uptime_us += cases[i].lateness_us;
+    timers_run(10);
+    ASSERT_EQ(s_tt.num_fired[0], 1);
+    mgos_timers_get_stats(&st);
+    ASSERT_EQ(hist_bucket(st.lateness_hist), cases[i].lateness_bucket);
+    ASSERT_EQ(hist_bucket(st.duration_hist), cases[i].duration_bucket);
+    ASSERT_EQ64(st.max_lateness_us, cases[i].lateness_us);
+    ASSERT_EQ64(st.max_duration_us, cases[i].duration_us);
+  }
+
+  /* Callbacks over the budget are counted. */
+  memset(&s_tt, 0, sizeof(s_tt));
+  mgos_timers_reset_stats();
+  mgos_timers_set_cb_budget(100);
+  s_tt.cb_duration_us = 100;
+  set_test_timer(0, 10, 0);
+  timers_run(10);
+  s_tt.cb_duration_us = 101;
+  set_test_timer(1, 10, 0);
+  timers_run(10);
+  mgos_timers_set_cb_budget(0);
+  mgos_timers_get_stats(&st);
+  ASSERT_EQ(st.num_over_budget, 1);
+  ASSERT_EQ64(st.max_duration_us, 101);
+
+  /* RUN_NOW timer is due when armed, not since boot. */
+  memset(&s_tt, 0, sizeof(s_tt));
+  mgos_timers_reset_stats();
+  mgos_timer_id id = mgos_set_timer(
+      100, MGOS_TIMER_REPEAT | MGOS_TIMER_RUN_NOW, timer_cb, (void *) 0);
+  ASSERT_EQ(timers_next_ms(), 0);
+  timers_run(0);
+  ASSERT_EQ(s_tt.num_fired[0], 1);
+  ASSERT_EQ(timers_next_ms(), 100);
+  mgos_clear_timer(id);
+  mgos_timers_get_stats(&st);
+  ASSERT_EQ(hist_bucket(st.lateness_hist), 0);
+  ASSERT_EQ64(st.max_lateness_us, 0);
+
+  return NULL;
+}
+
+/*
+ * Fake UART HAL: RX is fed from s_fu.rx, TX is drained into s_fu.tx.
+ * Chunk sizes limit the number of bytes moved per call, 0 - no limit.
+ */
+static struct {
+  uint8_t rx[4096];
+  size_t rx_len, rx_pos, rx_chunk;
+  uint8_t tx[4096];
+  size_t tx_len, tx_chunk;
+  int num_tx_tops;
+} s_fu;
+
+/* UART dispatcher, the only poll callback. */
+static mgos_poll_cb_t s_poll_cb;
+static void *s_poll_cb_arg;
+
+void mgos_add_poll_cb(mgos_poll_cb_t cb, void *cb_arg) {
+  s_poll_cb = cb;
+  s_poll_cb_arg = cb_arg;
+}
+
+bool mgos_uart_hal_init(struct mgos_uart_state *us) {
+  (void) us;
+  return true;
+}
+
+bool mgos_uart_hal_configure(struct mgos_uart_state *us,
+                             const struct mgos_uart_config *cfg) {
+  (void) us;
+  return (cfg->baud_rate > 0);
+}
+
+void mgos_uart_hal_config_set_defaults(int uart_no,
+                                       struct mgos_uart_config *cfg) {
+  (void) uart_no;
+  (void) cfg;
+}
+
+void mgos_uart_hal_dispatch_rx_top(struct mgos_uart_state *us) {
+  size_t n = MIN(s_fu.rx_len - s_fu.rx_pos, us->rx_buf.avail);
+  if (s_fu.rx_chunk > 0) n = MIN(n, s_fu.rx_chunk);
+  cs_rbuf_append(&us->rx_buf, s_fu.rx + s_fu.rx_pos, n);
+  s_fu.rx_pos += n;
+}
+
+void mgos_uart_hal_dispatch_tx_top(struct mgos_uart_state *us) {
+  size_t n = MIN(us->tx_buf.used, sizeof(s_fu.tx) - s_fu.tx_len);
+  if (s_fu.tx_chunk > 0) n = MIN(n, s_fu.tx_chunk);
+  s_fu.tx_len += cs_rbuf_read(&us->tx_buf, s_fu.tx + s_fu.tx_len, n);
+  s_fu.num_tx_tops++;
+}
+
+void mgos_uart_hal_dispatch_bottom(struct mgos_uart_state *us) {
+  (void) us;
+}
+
+void mgos_uart_hal_flush_fifo(struct mgos_uart_state *us) {
+  (void) us;
+}
+
+void mgos_uart_hal_set_rx_enabled(struct mgos_uart_state *us, bool enabled) {
+  (void) us;
+  (void) enabled;
+}
+
+/*
+ * Moves head and tail of an empty ring `offset` bytes in. Consuming all the
+ * data rewinds the ring to the start, so this has to be done by hand.
+ */
+static void fake_uart_rbuf_reset(cs_rbuf_t *b, int offset) {
+  cs_rbuf_clear(b);
+  b->head = b->tail = b->begin + offset;
+}
+
+/* (Re)configures UART 0 with empty rings, `offset` bytes from the start. */
+static struct mgos_uart_state *fake_uart_setup(int rx_buf_size,
+                                               int tx_buf_size, int offset) {
+  struct mgos_uart_config cfg;
+  struct mgos_uart_state *us;
+  mgos_uart_config_set_defaults(0, &cfg);
+  cfg.rx_buf_size = rx_buf_size;
+  cfg.tx_buf_size = tx_buf_size;
+  memset(&s_fu, 0, sizeof(s_fu));
+  if (!mgos_uart_configure(0, &cfg)) return NULL;
+  us = mgos_uart_hal_get_state(0);
+  fake_uart_rbuf_reset(&us->rx_buf, offset % rx_buf_size);
+  fake_uart_rbuf_reset(&us->tx_buf, offset % tx_buf_size);
+  memset(&us->stats, 0, sizeof(us->stats));
+  us->xoff_recd = us->xoff_sent = false;
+  mgos_uart_set_dispatcher(0, NULL, NULL);
+  mgos_uart_set_rx_enabled(0, true);
+  return us;
+}
+
+static void fake_uart_rx(const void *data, size_t len) {
+  memcpy(s_fu.rx + s_fu.rx_len, data, len);
+  s_fu.rx_len += len;
+}
+
+static const char *test_uart_rx_zero_copy(void) {
+  static const struct {
+    int rx_buf_size;
+    int offset;
+  } cases[] = {
+      {1, 0}, {7, 0}, {7, 6}, {16, 3}, {64, 60}, {256, 100},
+  };
+  struct mg_str spans[2];
+  size_t i, j, n, pos;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    struct mgos_uart_state *us = fake_uart_setup(cases[i].rx_buf_size, 16,
+                                                 cases[i].offset);
+    ASSERT(us != NULL);
+    for (j = 0; j < sizeof(s_fu.rx); j++) s_fu.rx[j] = rand();
+    s_fu.rx_len = sizeof(s_fu.rx);
+
+    /* Spans always cover the received data, in order, up to the wrap. */
+    for (pos = 0; pos < s_fu.rx_len;) {
+      s_fu.rx_chunk = 1 + rand() % cases[i].rx_buf_size;
+      n = mgos_uart_rx_peek(0, spans);
+      ASSERT_EQ(n, us->rx_buf.used);
+      ASSERT_EQ(n, spans[0].len + spans[1].len);
+      ASSERT(n > 0);
+      ASSERT_PTREQ(spans[0].p, us->rx_buf.head);
+      if (spans[1].len > 0) {
+        ASSERT_PTREQ(spans[0].p + spans[0].len, us->rx_buf.end);
+        ASSERT_PTREQ(spans[1].p, us->rx_buf.begin);
+      } else {
+        ASSERT_PTREQ(spans[1].p, us->rx_buf.begin);
+      }
+      ASSERT_EQ(memcmp(spans[0].p, s_fu.rx + pos, spans[0].len), 0);
+      ASSERT_EQ(memcmp(spans[1].p, s_fu.rx + pos + spans[0].len, spans[1].len),
+                0);
+      /* Consuming more than there is drops what there is. */
+      n = rand() % (n + 2);
+      mgos_uart_rx_consume(0, n);
+      pos = MIN(pos + n, s_fu.rx_pos);
+      ASSERT_EQ(mgos_uart_read_avail(0), s_fu.rx_pos - pos);
+    }
+  }
+
+  /* Nothing while RX is disabled. */
+  ASSERT(fake_uart_setup(16, 16, 0) != NULL);
+  fake_uart_rx("abc", 3);
+  mgos_uart_set_rx_enabled(0, false);
+  ASSERT_EQ(mgos_uart_rx_peek(0, spans), 0);
+  ASSERT(spans[0].p != NULL && spans[1].p != NULL);
+  ASSERT_EQ(spans[0].len, 0);
+  ASSERT_EQ(spans[1].len, 0);
+  mgos_uart_set_rx_enabled(0, true);
+  ASSERT_EQ(mgos_uart_rx_peek(0, spans), 3);
+  ASSERT_EQ(memcmp(spans[0].p, "abc", 3), 0);
+  mgos_uart_rx_consume(0, 3);
+  ASSERT_EQ(mgos_uart_rx_peek(0, spans), 0);
+  ASSERT(spans[0].p != NULL && spans[1].p != NULL);
+
+  return NULL;
+}
+
+static const char *test_uart_configure(void) {
+  struct mgos_uart_config cfg, cfg2;
+  struct mg_str spans[2];
+  struct mgos_uart_state *us = fake_uart_setup(16, 8, 0);
+  ASSERT(us != NULL);
+  fake_uart_rx("abc", 3);
+  ASSERT_EQ(mgos_uart_rx_peek(0, spans), 3);
+  ASSERT(mgos_uart_config_get(0, &cfg));
+
+  /* Rejected by the HAL: buffers and config stay as they were. */
+  cfg.rx_buf_size = 32;
+  cfg.tx_buf_size = 64;
+  cfg.baud_rate = 0;
+  ASSERT(!mgos_uart_configure(0, &cfg));
+  ASSERT_EQ(us->rx_buf.size, 16);
+  ASSERT_EQ(us->tx_buf.size, 8);
+  ASSERT(mgos_uart_config_get(0, &cfg2));
+  ASSERT_EQ(cfg2.rx_buf_size, 16);
+  ASSERT_EQ(cfg2.tx_buf_size, 8);
+
+  /* Sizes that do not fit a ring are rejected rather than clamped. */
+  cfg.baud_rate = 115200;
+  cfg.rx_buf_size = UINT16_MAX + 1;
+  ASSERT(!mgos_uart_configure(0, &cfg));
+  cfg.rx_buf_size = 32;
+  cfg.tx_buf_size = -1;
+  ASSERT(!mgos_uart_configure(0, &cfg));
+  ASSERT_EQ(us->rx_buf.size, 16);
+  ASSERT_EQ(us->tx_buf.size, 8);
+
+  /* Accepted: resized, received data is kept. */
+  cfg.tx_buf_size = 64;
+  ASSERT(mgos_uart_configure(0, &cfg));
+  ASSERT_EQ(us->rx_buf.size, 32);
+  ASSERT_EQ(us->tx_buf.size, 64);
+  ASSERT_EQ(mgos_uart_rx_peek(0, spans), 3);
+  ASSERT_EQ(memcmp(spans[0].p, "abc", 3), 0);
+  ASSERT(mgos_uart_config_get(0, &cfg2));
+  ASSERT_EQ(cfg2.rx_buf_size, 32);
+  ASSERT_EQ(cfg2.tx_buf_size, 64);
+
+  return NULL;
+}
+
+static const char *test_uart_writev(void) {
+  static const struct {
+    int tx_buf_size, offset, tx_chunk;
+    bool block;
+    int cnt;
+    const char *iov[4];
+    size_t written;
+    bool drained;
+  } cases[] = {
+      {16, 0, 0, false, 0, {NULL}, 0, false},
+      {16, 0, 0, false, 3, {"", "abc", ""}, 3, false},
+      {16, 10, 0, false, 2, {"abc", "defghij"}, 10, false},
+      /* Non-blocking write stops mid-segment when the ring is full. */
+      {8, 5, 0, false, 3, {"abc", "defghij", "kl"}, 8, false},
+      {8, 0, 0, false, 2, {"abcdefgh", "i"}, 8, false},
+      /* Blocking write waits for the ring to drain. */
+      {8, 0, 0, true, 2, {"abcdefgh", "i"}, 9, true},
+      {4, 3, 1, true, 3, {"abc", "defghij", "kl"}, 12, true},
+      {5, 2, 3, true, 4, {"0123456789", "", "a", "bcdefghijklmnop"}, 26, true},
+  };
+  char expected[100];
+  size_t i, total;
+  int j;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    struct mg_str iov[4];
+    ASSERT(fake_uart_setup(16, cases[i].tx_buf_size, cases[i].offset) !=
+           NULL);
+    s_fu.tx_chunk = cases[i].tx_chunk;
+    for (j = 0, total = 0; j < cases[i].cnt; j++) {
+      iov[j] = mg_mk_str(cases[i].iov[j]);
+      memcpy(expected + total, iov[j].p, iov[j].len);
+      total += iov[j].len;
+    }
+    if (cases[i].block) {
+      ASSERT_EQ(mgos_uart_writev(0, iov, cases[i].cnt), cases[i].written);
+    } else {
+      ASSERT_EQ(mgos_uart_writev_nb(0, iov, cases[i].cnt), cases[i].written);
+    }
+    ASSERT_EQ(s_fu.num_tx_tops > 0, cases[i].drained);
+    /* What has been sent and what is queued is a prefix of the input. */
+    mgos_uart_flush(0);
+    ASSERT_EQ(s_fu.tx_len, cases[i].written);
+    ASSERT_EQ(memcmp(s_fu.tx, expected, s_fu.tx_len), 0);
+  }
+
+  /* Plain write is a single-segment writev. */
+  ASSERT(fake_uart_setup(16, 4, 1) != NULL);
+  ASSERT_EQ(mgos_uart_write(0, "hello world", 11), 11);
+  mgos_uart_flush(0);
+  ASSERT_EQ(s_fu.tx_len, 11);
+  ASSERT_EQ(memcmp(s_fu.tx, "hello world", 11), 0);
+
+  return NULL;
+}
+
+/* Reads everything the fake UART has to give. */
+static size_t fake_uart_read_all(uint8_t *buf, size_t size) {
+  size_t len = 0;
+  while (len < size &&
+         (s_fu.rx_pos < s_fu.rx_len || mgos_uart_read_avail(0) > 0)) {
+    len += mgos_uart_read(0, buf + len, 1 + rand() % (size - len));
+  }
+  return len;
+}
+
+static const char *test_uart_sw_fc(void) {
+  static const struct {
+    int rx_buf_size, offset, rx_chunk;
+    const char *in, *out;
+    bool xoff_recd;
+  } cases[] = {
+      {16, 0, 0, "ab\x13" "cd", "abcd", true},
+      {16, 0, 0, "\x13" "ab\x11", "ab", false},
+      {16, 5, 1, "\x11\x13\x11\x13", "", true},
+      {8, 6, 0, "ab\x13" "cdef", "abcdef", true},
+      {8, 6, 0, "abcdef\x11" "g", "abcdefg", false},
+      {64, 60, 0, "0123456789abcdef\x11" "ghijklmnopqrstuvwxyz\x13",
+       "0123456789abcdefghijklmnopqrstuvwxyz", true},
+      {32, 17, 5, "0123456789abcdefghijklmnopqrstuvwxyz",
+       "0123456789abcdefghijklmnopqrstuvwxyz", false},
+  };
+  static const int ring_sizes[] = {1, 9, 64, 255};
+  uint8_t out[sizeof(s_fu.rx)], ref[sizeof(s_fu.rx)];
+  size_t i, j, n, ref_len;
+
+  /* Flow control characters are removed from the data at any position. */
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    struct mgos_uart_state *us = fake_uart_setup(cases[i].rx_buf_size, 16,
+                                                 cases[i].offset);
+    ASSERT(us != NULL);
+    us->cfg.tx_fc_type = MGOS_UART_FC_SW;
+    s_fu.rx_chunk = cases[i].rx_chunk;
+    fake_uart_rx(cases[i].in, strlen(cases[i].in));
+    n = fake_uart_read_all(out, sizeof(out));
+    ASSERT_EQ(n, strlen(cases[i].out));
+    ASSERT_EQ(memcmp(out, cases[i].out, n), 0);
+    ASSERT_EQ(us->xoff_recd, cases[i].xoff_recd);
+  }
+
+  /* Random data against a reference, across ring wraps and word alignments. */
+  for (i = 0; i < ARRAY_SIZE(ring_sizes); i++) {
+    struct mgos_uart_state *us =
+        fake_uart_setup(ring_sizes[i], 16, rand() % ring_sizes[i]);
+    ASSERT(us != NULL);
+    us->cfg.tx_fc_type = MGOS_UART_FC_SW;
+    for (j = 0, ref_len = 0; j < sizeof(s_fu.rx); j++) {
+      uint8_t c = rand();
+      if (rand() % 8 == 0) {
+        c = (rand() % 2 ? MGOS_UART_XON_CHAR : MGOS_UART_XOFF_CHAR);
+      }
+      s_fu.rx[j] = c;
+      if (c != MGOS_UART_XON_CHAR && c != MGOS_UART_XOFF_CHAR) {
+        ref[ref_len++] = c;
+      }
+    }
+    s_fu.rx_len = sizeof(s_fu.rx);
+    for (n = 0; n < ref_len;) {
+      bool xoff = false;
+      s_fu.rx_chunk = 1 + rand() % ring_sizes[i];
+      n += mgos_uart_read(0, out + n, 1 + rand() % ring_sizes[i]);
+      ASSERT_EQ(memcmp(out, ref, n), 0);
+      /* State is set by the last flow control character received. */
+      for (j = 0; j < s_fu.rx_pos; j++) {
+        if (s_fu.rx[j] == MGOS_UART_XON_CHAR) xoff = false;
+        if (s_fu.rx[j] == MGOS_UART_XOFF_CHAR) xoff = true;
+      }
+      ASSERT_EQ(us->xoff_recd, xoff);
+    }
+    ASSERT_EQ(n, ref_len);
+  }
+
+  return NULL;
+}
+
+static const char *test_uart_printf(void) {
+  static const struct {
+    int tx_buf_size, offset, len;
+    /*
+     * Offset of the NUL left behind by formatting in tx_buf, -1 if there is
+     * none (formatted on the stack or the heap and then copied).
+     */
+    int nul_pos;
+    bool drained;
+  } cases[] = {
+      {16, 0, 0, 0, false},
+      {16, 0, 5, 5, false},
+      /* Output and the NUL fit in the contiguous space at the tail. */
+      {16, 10, 5, 15, false},
+      /* Output wraps, formatted in the free space at the start of tx_buf. */
+      {16, 11, 5, 5, false},
+      {16, 10, 6, 6, false},
+      {256, 200, 150, 150, false},
+      /* Neither part holds the output, short enough for the stack. */
+      {16, 4, 13, -1, false},
+      {16, 0, 16, -1, false},
+      /* Does not fit. */
+      {16, 0, 17, -1, true},
+      {256, 0, 150, 150, false},
+      /* Neither part holds it and longer than the buffer on the stack. */
+      {256, 100, 190, -1, false},
+      {8, 3, 150, -1, true},
+  };
+  char str[200], expected[200];
+  size_t i;
+  int j;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    struct mgos_uart_state *us =
+        fake_uart_setup(16, cases[i].tx_buf_size, cases[i].offset);
+    ASSERT(us != NULL);
+    for (j = 0; j < cases[i].len; j++) str[j] = 'a' + j % 26;
+    str[cases[i].len] = '\0';
+    /* Formatting in tx_buf leaves a NUL past the output, data has none. */
+    memset(us->tx_buf.begin, 0xff, us->tx_buf.size);
+    ASSERT_EQ(mgos_uart_printf(0, "%s", str), cases[i].len);
+    for (j = 0; j < us->tx_buf.size; j++) {
+      ASSERT_EQ(us->tx_buf.begin[j] == '\0', j == cases[i].nul_pos);
+    }
+    ASSERT_EQ(s_fu.num_tx_tops > 0, cases[i].drained);
+    mgos_uart_flush(0);
+    ASSERT_EQ(s_fu.tx_len, cases[i].len);
+    ASSERT_EQ(memcmp(s_fu.tx, str, cases[i].len), 0);
+    ASSERT_EQ(us->tx_buf.used, 0);
+  }
+
+  ASSERT(fake_uart_setup(16, 32, 20) != NULL);
+  j = snprintf(expected, sizeof(expected), "%d-%s-%c", 42, "foo", 'x');
+  ASSERT_EQ(mgos_uart_printf(0, "%d-%s-%c", 42, "foo", 'x'), j);
+  ASSERT_EQ(mgos_uart_printf(0, "%d-%s-%c", 42, "foo", 'x'), j);
+  mgos_uart_flush(0);
+  ASSERT_EQ(s_fu.tx_len, 2 * j);
+  ASSERT_EQ(memcmp(s_fu.tx, expected, j), 0);
+  ASSERT_EQ(memcmp(s_fu.tx + j, expected, j), 0);
+
+  return NULL;
+}
+
+static struct {
+  struct mg_str frames[4];
+  char data[4][64];
+  int num_frames;
+  int num_null_ptrs;
+} s_uf;
+
+static void uart_frame_cb(int uart_no, const struct mg_str frame[2],
+                          void *arg) {
+  int i = s_uf.num_frames++;
+  if (frame[0].p == NULL || frame[1].p == NULL) s_uf.num_null_ptrs++;
+  if (i >= (int) ARRAY_SIZE(s_uf.frames)) return;
+  memcpy(s_uf.data[i], frame[0].p, frame[0].len);
+  memcpy(s_uf.data[i] + frame[0].len, frame[1].p, frame[1].len);
+  s_uf.frames[i] = mg_mk_str_n(s_uf.data[i], frame[0].len + frame[1].len);
+  (void) uart_no;
+  (void) arg;
+}
+
+static const char *test_uart_framing(void) {
+  static const struct {
+    enum mgos_uart_framing framing;
+    int rx_buf_size, offset, rx_chunk;
+    struct mg_str in;
+    int num_frames;
+    struct mg_str frames[3];
+    uint32_t num_errors;
+  } cases[] = {
+      /* Empty lines are frames too. */
+      {MGOS_UART_FRAMING_LINE, 16, 0, 0, MG_MK_STR("ab\r\ncd\n\n\r\n"), 4,
+       {MG_MK_STR("ab"), MG_MK_STR("cd"), MG_MK_STR("")}, 0},
+      {MGOS_UART_FRAMING_LINE, 16, 0, 1, MG_MK_STR("hello\nworld\nfoo"), 2,
+       {MG_MK_STR("hello"), MG_MK_STR("world")}, 0},
+      {MGOS_UART_FRAMING_LINE, 8, 5, 0, MG_MK_STR("abcdef\n"), 1,
+       {MG_MK_STR("abcdef")}, 0},
+      /* Frame with the delimiter must fit in the buffer. */
+      {MGOS_UART_FRAMING_LINE, 8, 3, 0, MG_MK_STR("abcdefg\nabcdefgh\nok\n"),
+       2, {MG_MK_STR("abcdefg"), MG_MK_STR("ok")}, 1},
+      {MGOS_UART_FRAMING_LINE, 8, 0, 3,
+       MG_MK_STR("0123456789abcdefghij\nok\n"), 1, {MG_MK_STR("ok")}, 1},
+      /* Empty SLIP frames are not delivered. */
+      {MGOS_UART_FRAMING_SLIP, 16, 0, 0,
+       MG_MK_STR("\xc0" "a\xdb\xdc" "b\xdb\xdd" "\xc0\xc0"), 1,
+       {MG_MK_STR("a\xc0" "b\xdb")}, 0},
+      /* Escape at the end of a frame and an invalid escape. */
+      {MGOS_UART_FRAMING_SLIP, 16, 0, 0,
+       MG_MK_STR("ab\xdb\xc0" "\xdb\x41\xc0" "cd\xc0"), 1, {MG_MK_STR("cd")},
+       2},
+      /* Escape at the end of the ring, escaped byte at the start. */
+      {MGOS_UART_FRAMING_SLIP, 8, 7, 0, MG_MK_STR("\xdb\xdc" "x\xc0"), 1,
+       {MG_MK_STR("\xc0" "x")}, 0},
+      {MGOS_UART_FRAMING_SLIP, 4, 0, 1, MG_MK_STR("abcdefg\xc0" "hi\xc0"), 1,
+       {MG_MK_STR("hi")}, 1},
+      {MGOS_UART_FRAMING_COBS, 16, 0, 0,
+       MG_MK_STR("\x03" "ab\x02" "c\x00" "\x01\x01\x00"), 2,
+       {MG_MK_STR("ab\x00" "c"), MG_MK_STR("\x00")}, 0},
+      {MGOS_UART_FRAMING_COBS, 16, 0, 0, MG_MK_STR("\x00\x01\x00"), 0,
+       {MG_NULL_STR}, 0},
+      /* Code byte pointing past the end of the frame. */
+      {MGOS_UART_FRAMING_COBS, 16, 0, 0,
+       MG_MK_STR("\x05" "ab\x00" "\x03" "ok\x00"), 1, {MG_MK_STR("ok")}, 1},
+      {MGOS_UART_FRAMING_COBS, 8, 6, 0, MG_MK_STR("\x03" "ab\x02" "c\x00"), 1,
+       {MG_MK_STR("ab\x00" "c")}, 0},
+      {MGOS_UART_FRAMING_COBS, 4, 0, 0,
+       MG_MK_STR("\x06" "abcde\x00" "\x02" "z\x00"), 1, {MG_MK_STR("z")}, 1},
+  };
+  size_t i;
+  int j;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    struct mgos_uart_state *us = fake_uart_setup(cases[i].rx_buf_size, 16,
+                                                 cases[i].offset);
+    ASSERT(us != NULL);
+    us->cfg.rx_framing = cases[i].framing;
+    memset(&s_uf, 0, sizeof(s_uf));
+    mgos_uart_set_frame_handler(0, uart_frame_cb, NULL);
+    s_fu.rx_chunk = cases[i].rx_chunk;
+    fake_uart_rx(cases[i].in.p, cases[i].in.len);
+    do {
+      s_poll_cb(s_poll_cb_arg);
+    } while (s_fu.rx_pos < s_fu.rx_len);
+    ASSERT_EQ(s_uf.num_frames, cases[i].num_frames);
+    ASSERT_EQ(s_uf.num_null_ptrs, 0);
+    for (j = 0; j < s_uf.num_frames && j < 3; j++) {
+      ASSERT_EQ(mg_strcmp(s_uf.frames[j], cases[i].frames[j]), 0);
+    }
+    ASSERT_EQ(us->stats.rx_frames, (uint32_t) cases[i].num_frames);
+    ASSERT_EQ(us->stats.rx_frame_errors, cases[i].num_errors);
+  }
+
+  mgos_uart_set_frame_handler(0, NULL, NULL);
+  return NULL;
+}
+
 static const char *test_cs_hex(void) {
   unsigned char dst[32];
   int dst_len = 0;
@@ -260,12 +1324,27 @@ static const char *test_cs_hex(void) {
 }
 
 void tests_setup(void) {
+  mg_mgr_init(&s_mgr, NULL);
+  mgos_timers_init();
 }
 
 const char *tests_run(const char *filter) {
   RUN_TEST(test_config);
   RUN_TEST(test_json_scanf);
   RUN_TEST(test_events);
+  RUN_TEST(test_events_order);
+  RUN_TEST(test_event_post);
+  RUN_TEST(test_timers_order);
+  RUN_TEST(test_timers_ids);
+  RUN_TEST(test_timers_slack);
+  RUN_TEST(test_timers_monotonic);
+  RUN_TEST(test_timers_stats);
+  RUN_TEST(test_uart_rx_zero_copy);
+  RUN_TEST(test_uart_configure);
+  RUN_TEST(test_uart_writev);
+  RUN_TEST(test_uart_sw_fc);
+  RUN_TEST(test_uart_printf);
+  RUN_TEST(test_uart_framing);
   RUN_TEST(test_cs_hex);
   return NULL;
 }